@@ -0,0 +1,800 @@
+/* File: bench.c
+ * Date: 2026-10-17
+ *
+ * Benchmarks for reed's hot paths, results as JSON on stdout.
+ *
+ * Synthetic libraries are generated once per shape and size (in a tmpfs by
+ * default) and reused by later runs. reed.c is linked in with its main()
+ * renamed, so the menu and shuffle code measured here is the real one; the
+ * menu is drawn on an off-screen terminal whose output goes to /dev/null.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <ncurses.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/loader.h"
+#include "../src/mpvproc.h"
+#include "../src/scan.h"
+#include "../src/search.h"
+#include "../src/session.h"
+#include "../src/shuffle.h"
+#include "../src/songarr.h"
+
+#define BENCH_FORMAT 1
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+#define MAX_REPS 64
+#define IPC_MESSAGES 200000
+#define IPC_CHUNK 32768   /* Bytes written per round, well below RX_SIZE */
+#define MENU_STEPS 5000
+#define SEARCH_QUERY "123"
+
+/* From reed.c */
+extern SongArr *songarr;
+bool player_init(size_t n_songs);
+bool ui_init_windows(void);
+void ui_destroy(void);
+void update_maxyx(void);
+void menu_forget_rows(void);
+void draw_menu(void);
+void render_frame(void);
+void cursor_scroll_down(void);
+void cursor_scroll_top(void);
+void cursor_scroll_bottom(void);
+void event_shuffle(void);
+
+typedef enum { SHAPE_FLAT, SHAPE_DEEP, SHAPE_UNICODE, N_SHAPES } Shape;
+
+static const char *shape_names[N_SHAPES] = { "flat", "deep", "unicode" };
+
+struct BenchOpts {
+    const char *dir;
+    size_t files;
+    int reps;
+    int threads;
+    bool shapes[N_SHAPES];
+} bopts = {
+    .dir = "/dev/shm/reed-bench",
+    .files = 100000,
+    .reps = 5,
+    .threads = 0,
+};
+
+static bool first_result = true;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, const char *shape, size_t files,
+                   size_t ops, long long *samples, int n)
+{
+    /* samples: nanoseconds per repetition, each covering ops operations */
+    qsort(samples, n, sizeof(long long), compare_ll);
+    double per = ops > 0 ? (double)ops : 1.0;
+    printf("%s\n    {\"name\": \"%s\", \"shape\": \"%s\", \"files\": %zu, "
+           "\"ops\": %zu, \"reps\": %d, \"min_ns\": %.1f, "
+           "\"median_ns\": %.1f, \"max_ns\": %.1f}",
+           first_result ? "" : ",", name, shape,
+           files, ops, n,
+           samples[0] / per, samples[n / 2] / per, samples[n - 1] / per);
+    first_result = false;
+    fflush(stdout);
+}
+
+/* Library generation */
+
+static bool make_file(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static bool make_dir(const char *path)
+{
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool gen_flat(const char *root, size_t n)
+{
+    char path[PATH_MAX];
+    for (size_t i = 0; i < n; i++) {
+        if (snprintf(path, sizeof(path), "%s/Track %zu.mp3", root, i)
+                >= (int)sizeof(path) || !make_file(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool gen_deep(const char *root, size_t n)
+{
+    /* Artist/Album (Year)/Disc N/NN - Title.flac, 12 tracks per disc, two
+     * discs per album, five albums per artist, and a cover per album */
+    char path[PATH_MAX];
+    size_t i = 0;
+    for (size_t artist = 0; i < n; artist++) {
+        if (snprintf(path, sizeof(path), "%s/Artist %zu", root, artist)
+                >= (int)sizeof(path) || !make_dir(path)) {
+            return false;
+        }
+        for (int album = 0; album < 5 && i < n; album++) {
+            int len = snprintf(path, sizeof(path),
+                               "%s/Artist %zu/Album %d (%d)", root, artist,
+                               album, 1960 + (int)(i % 60));
+            if (!make_dir(path)) {
+                return false;
+            }
+            snprintf(path + len, sizeof(path) - len, "/cover.jpg");
+            if (!make_file(path)) {
+                return false;
+            }
+            for (int disc = 1; disc <= 2 && i < n; disc++) {
+                snprintf(path + len, sizeof(path) - len, "/Disc %d", disc);
+                if (!make_dir(path)) {
+                    return false;
+                }
+                int dlen = (int)strlen(path);
+                for (int t = 1; t <= 12 && i < n; t++, i++) {
+                    snprintf(path + dlen, sizeof(path) - dlen,
+                             "/%02d - Song %zu.flac", t, i);
+                    if (!make_file(path)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool gen_unicode(const char *root, size_t n)
+{
+    /* Long multi-byte names (about 200 bytes) in directories of 500 */
+    static const char *words[] = {
+        "Ünïcödé", "Ελληνικά", "Русский", "日本語の歌", "한국어",
+        "Ñandú", "Ærøskøbing", "e\xcc\x81te\xcc\x81", "中文歌曲", "🎵",
+        "Łódź", "Straße",
+    };
+    size_t n_words = sizeof(words) / sizeof(words[0]);
+    char path[PATH_MAX];
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(path, sizeof(path), "%s/Répertoire %zu", root,
+                           i / 500);
+        if (i % 500 == 0 && !make_dir(path)) {
+            return false;
+        }
+        len += snprintf(path + len, sizeof(path) - len, "/%zu", i);
+        for (size_t w = 0; w < 12; w++) {
+            len += snprintf(path + len, sizeof(path) - len, " %s",
+                            words[(i * 7 + w * 3) % n_words]);
+        }
+        snprintf(path + len, sizeof(path) - len, ".opus");
+        if (!make_file(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool gen_library(Shape shape, size_t n, char *root, size_t size)
+{
+    /* Reuses a library generated by an earlier run */
+    /* The generators assume names up to 512 bytes always fit */
+    int len = snprintf(root, size, "%s/%s-%zu", bopts.dir, shape_names[shape],
+                       n);
+    if (len < 0 || (size_t)len + 512 >= size) {
+        fprintf(stderr, "Library path is too long: %s\n", bopts.dir);
+        return false;
+    }
+    char done[PATH_MAX];
+    if (snprintf(done, sizeof(done), "%s.done", root) >= (int)sizeof(done)) {
+        return false;
+    }
+    if (access(done, F_OK) == 0) {
+        return true;
+    }
+    if (!make_dir(bopts.dir) || !make_dir(root)) {
+        return false;
+    }
+
+    fprintf(stderr, "Generating %s (%zu files)...\n", root, n);
+    bool ok = false;
+    switch (shape) {
+        case SHAPE_FLAT: ok = gen_flat(root, n); break;
+        case SHAPE_DEEP: ok = gen_deep(root, n); break;
+        case SHAPE_UNICODE: ok = gen_unicode(root, n); break;
+        default: break;
+    }
+    return ok && make_file(done);
+}
+
+/* Benchmarks */
+
+static bool bench_loader(Shape shape, const char *root)
+{
+    /* Until the menu has something to show, scanning in the background */
+    long long t[MAX_REPS];
+    SongArrOpts lib = { .n_threads = bopts.threads, .rescan = true };
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        int fd = loader_start(&root, 1, &lib);
+        if (fd == -1) {
+            return false;
+        }
+        LoadBatch batch = { .add = NULL, .done = false };
+        while (batch.add == NULL && !batch.done) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, -1) == 1) {
+                loader_take(&batch);
+            }
+        }
+        t[r] = now_ns() - t0;
+        if (batch.add != NULL) {
+            songarr_destroy(batch.add);
+        }
+        loader_stop();
+    }
+    report("loader_first_batch", shape_names[shape], bopts.files, 1, t,
+           bopts.reps);
+    return true;
+}
+
+static SongArr *split_half(const SongArr *all, size_t half)
+{
+    /* Every other file, in scan order, with all the directories */
+    SongArr *sa = songarr_new();
+    uint32_t *dir_map = malloc((all->n_dirs + 1) * sizeof(uint32_t));
+    bool ok = (sa != NULL && dir_map != NULL);
+    struct timespec none = { 0, 0 };
+    for (size_t d = 0; ok && d < all->n_dirs; d++) {
+        ok = songarr_add_dir(sa, songarr_dirpath(all, (uint32_t)d), none,
+                             &dir_map[d]);
+    }
+    for (size_t i = half; ok && i < all->size; i += 2) {
+        ok = songarr_append(sa, dir_map[all->arr[i].dir], songarr_name(all, i));
+    }
+    free(dir_map);
+    if (!ok && sa != NULL) {
+        songarr_destroy(sa);
+        sa = NULL;
+    }
+    return sa;
+}
+
+static bool bench_apply(Shape shape, const char *root)
+{
+    /* One big batch merged into a library of the same size, as when the
+     * background scan hands over what it found */
+    long long t[MAX_REPS];
+    SongArr *all = songarr_new();
+    ScanOpts scan = { .n_threads = bopts.threads };
+    if (all == NULL || !scan_tree(&root, 1, &scan, all)) {
+        if (all != NULL) {
+            songarr_destroy(all);
+        }
+        return false;
+    }
+    bool ok = true;
+    for (int r = 0; ok && r < bopts.reps; r++) {
+        SongArr *base = split_half(all, 0);
+        SongArr *add = split_half(all, 1);
+        size_t *remap = NULL;
+        ok = base != NULL && add != NULL && songarr_sort(base, bopts.threads);
+        if (ok) {
+            remap = malloc((base->size + 1) * sizeof(size_t));
+            SongArrDelta delta = { .add = add };
+            long long t0 = now_ns();
+            ok = remap != NULL && songarr_apply(base, &delta, remap);
+            t[r] = now_ns() - t0;
+        }
+        free(remap);
+        if (base != NULL) {
+            songarr_destroy(base);
+        }
+        if (add != NULL) {
+            songarr_destroy(add);
+        }
+    }
+    songarr_destroy(all);
+    if (ok) {
+        report("songarr_apply_half", shape_names[shape], bopts.files, 1, t,
+               bopts.reps);
+    }
+    return ok;
+}
+
+static bool bench_library(Shape shape, const char *root)
+{
+    const char *name = shape_names[shape];
+    long long t[MAX_REPS];
+    SongArrOpts lib = { .n_threads = bopts.threads, .rescan = true };
+
+    /* Full cold path: scan, sort, save the index */
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        SongArr *sa = songarr_init(root, &lib);
+        t[r] = now_ns() - t0;
+        if (sa == NULL) {
+            return false;
+        }
+        songarr_destroy(sa);
+    }
+    report("songarr_init_scan", name, bopts.files, 1, t, bopts.reps);
+
+    /* Warm start from the index written above */
+    lib.rescan = false;
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        SongArr *sa = songarr_init(root, &lib);
+        t[r] = now_ns() - t0;
+        if (sa == NULL) {
+            return false;
+        }
+        songarr_destroy(sa);
+    }
+    report("songarr_init_index", name, bopts.files, 1, t, bopts.reps);
+
+    /* The stages on their own */
+    long long t_sort[MAX_REPS];
+    long long t_destroy[MAX_REPS];
+    for (int r = 0; r < bopts.reps; r++) {
+        SongArr *sa = songarr_new();
+        ScanOpts scan = { .n_threads = bopts.threads };
+        long long t0 = now_ns();
+        bool ok = sa != NULL && scan_tree(&root, 1, &scan, sa);
+        long long t1 = now_ns();
+        ok = ok && songarr_sort(sa, bopts.threads);
+        long long t2 = now_ns();
+        if (sa != NULL) {
+            songarr_destroy(sa);
+        }
+        long long t3 = now_ns();
+        if (!ok) {
+            return false;
+        }
+        t[r] = t1 - t0;
+        t_sort[r] = t2 - t1;
+        t_destroy[r] = t3 - t2;
+    }
+    report("scan_tree", name, bopts.files, 1, t, bopts.reps);
+    report("songarr_sort", name, bopts.files, 1, t_sort, bopts.reps);
+    report("songarr_destroy", name, bopts.files, 1, t_destroy, bopts.reps);
+    return bench_loader(shape, root) && bench_apply(shape, root);
+}
+
+static bool bench_player(Shape shape)
+{
+    long long t[MAX_REPS];
+    if (!player_init(songarr->size)) {
+        return false;
+    }
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        event_shuffle();
+        t[r] = now_ns() - t0;
+    }
+    report("event_shuffle", shape_names[shape], songarr->size, 1, t,
+           bopts.reps);
+
+    /* What a round costs in the end, per song: every position drawn */
+    Shuffle sh;
+    shuffle_init(&sh, 1);
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        shuffle_restart(&sh, songarr->size);
+        for (size_t i = 0; i < songarr->size; i++) {
+            if (shuffle_song(&sh, i) == SHUFFLE_NONE) {
+                shuffle_destroy(&sh);
+                return false;
+            }
+        }
+        t[r] = now_ns() - t0;
+    }
+    shuffle_destroy(&sh);
+    report("shuffle_draw", shape_names[shape], songarr->size, songarr->size,
+           t, bopts.reps);
+    return true;
+}
+
+static bool bench_session(Shape shape, const char *root)
+{
+    /* Worst case: a shuffle round that went through the whole library */
+    long long t_hash[MAX_REPS], t_save[MAX_REPS], t_load[MAX_REPS];
+    long long t_order[MAX_REPS];
+    size_t n = songarr->size;
+    Shuffle sh;
+    shuffle_init(&sh, 1);
+    shuffle_restart(&sh, n);
+    Session s = { .list_idx = -1, .shuffle_idx = -1, .n_order = n };
+    s.order = malloc((n + 1) * sizeof(*s.order));
+    bool ok = s.order != NULL;
+    for (size_t i = 0; ok && i < n; i++) {
+        size_t song = shuffle_song(&sh, i);
+        ok = song != SHUFFLE_NONE;
+        s.order[i] = (uint32_t)song;
+    }
+    for (int r = 0; ok && r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        s.lib_hash = session_lib_hash(songarr);
+        long long t1 = now_ns();
+        ok = session_save(&root, 1, &s);
+        long long t2 = now_ns();
+        Session back;
+        ok = ok && session_load(&root, 1, &back);
+        long long t3 = now_ns();
+        /* What session_apply() does with it */
+        shuffle_restart(&sh, n);
+        ok = ok && shuffle_reserve(&sh, back.n_order);
+        for (size_t i = 0; ok && i < back.n_order; i++) {
+            ok = shuffle_pos(&sh, back.order[i]) != SHUFFLE_NONE;
+        }
+        long long t4 = now_ns();
+        if (back.n_order != n) {
+            ok = false;
+        }
+        session_free(&back);
+        t_hash[r] = t1 - t0;
+        t_save[r] = t2 - t1;
+        t_load[r] = t3 - t2;
+        t_order[r] = t4 - t3;
+    }
+    free(s.order);
+    shuffle_destroy(&sh);
+    if (!ok) {
+        return false;
+    }
+    report("session_lib_hash", shape_names[shape], n, 1, t_hash, bopts.reps);
+    report("session_save", shape_names[shape], n, 1, t_save, bopts.reps);
+    report("session_load", shape_names[shape], n, 1, t_load, bopts.reps);
+    report("session_restore_order", shape_names[shape], n, 1, t_order,
+           bopts.reps);
+    return true;
+}
+
+static bool bench_search(Shape shape)
+{
+    /* Type a query, then backspace it away: each pop must give back the
+     * matches that query length had on the way in */
+    Search search;
+    search_init(&search, NULL);
+    size_t len = strlen(SEARCH_QUERY);
+    size_t typed[SEARCH_MAX + 1];
+    long long t_push[MAX_REPS];
+    long long t_pop[MAX_REPS];
+    bool ok = true;
+    for (int r = 0; ok && r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        for (size_t k = 0; ok && k < len; k++) {
+            ok = search_push(&search, songarr, SEARCH_QUERY[k]);
+            typed[k + 1] = search.n_ranked;
+        }
+        long long t1 = now_ns();
+        while (ok && search.len > 0) {
+            ok = search_pop(&search, songarr) &&
+                 (search.len == 0 || search.n_ranked == typed[search.len]);
+        }
+        t_push[r] = t1 - t0;
+        t_pop[r] = now_ns() - t1;
+    }
+    search_clear(&search);
+    if (!ok) {
+        fprintf(stderr, "Search results changed after backspace\n");
+        return false;
+    }
+    report("search_push", shape_names[shape], songarr->size, len, t_push,
+           bopts.reps);
+    report("search_pop", shape_names[shape], songarr->size, len, t_pop,
+           bopts.reps);
+    return true;
+}
+
+static bool bench_menu(Shape shape)
+{
+    /* An 80x50 terminal nobody sees: curses does all of its work, the
+     * bytes go to /dev/null */
+    FILE *out = fopen("/dev/null", "w");
+    FILE *in = fopen("/dev/null", "r");
+    SCREEN *scr = NULL;
+    if (out != NULL && in != NULL) {
+        setenv("LINES", "50", 1);
+        setenv("COLUMNS", "160", 1);
+        scr = newterm("xterm", out, in);
+    }
+    if (scr == NULL) {
+        fprintf(stderr, "No off-screen terminal, menu benchmarks skipped\n");
+        if (out != NULL) {
+            fclose(out);
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+        return true;
+    }
+    set_term(scr);
+    if (!ui_init_windows()) {
+        endwin();
+        delscreen(scr);
+        fclose(out);
+        fclose(in);
+        return false;
+    }
+    update_maxyx();
+    render_frame();
+
+    const char *name = shape_names[shape];
+    long long t[MAX_REPS];
+
+    /* Every row drawn again, without sending anything */
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        for (int i = 0; i < 100; i++) {
+            menu_forget_rows();
+            draw_menu();
+        }
+        t[r] = now_ns() - t0;
+    }
+    report("draw_menu_full", name, songarr->size, 100, t, bopts.reps);
+
+    /* Held-down 'j': one row scrolls in per frame */
+    for (int r = 0; r < bopts.reps; r++) {
+        cursor_scroll_top();
+        render_frame();
+        long long t0 = now_ns();
+        for (int i = 0; i < MENU_STEPS; i++) {
+            cursor_scroll_down();
+            render_frame();
+        }
+        t[r] = now_ns() - t0;
+    }
+    report("frame_scroll_line", name, songarr->size, MENU_STEPS, t, bopts.reps);
+
+    /* 'g' / 'G': a whole new page per frame */
+    for (int r = 0; r < bopts.reps; r++) {
+        long long t0 = now_ns();
+        for (int i = 0; i < 500; i++) {
+            if (i % 2 == 0) {
+                cursor_scroll_bottom();
+            } else {
+                cursor_scroll_top();
+            }
+            render_frame();
+        }
+        t[r] = now_ns() - t0;
+    }
+    report("frame_scroll_page", name, songarr->size, 500, t, bopts.reps);
+
+    ui_destroy();
+    delscreen(scr);
+    fclose(out);
+    fclose(in);
+    return true;
+}
+
+static size_t fill_messages(char *buf, size_t size, size_t *n_msgs)
+{
+    /* The traffic of a playing mpv: mostly time-pos updates */
+    size_t len = 0;
+    *n_msgs = 0;
+    for (size_t i = 0; ; i++) {
+        char msg[512];
+        int n;
+        switch (i % 8) {
+            case 7:
+                n = snprintf(msg, sizeof(msg), "{\"event\":\"property-change\","
+                             "\"id\":4,\"name\":\"path\",\"data\":\"/home/user/"
+                             "media/music/Artist %zu/Album/%02zu - Song "
+                             "\\u00e9t\\u00e9.flac\"}\n", i, i % 20);
+                break;
+            case 6:
+                n = snprintf(msg, sizeof(msg), "{\"request_id\":%zu,"
+                             "\"error\":\"success\",\"data\":null}\n", i);
+                break;
+            case 5:
+                n = snprintf(msg, sizeof(msg), "{\"event\":\"end-file\","
+                             "\"reason\":\"eof\",\"playlist_entry_id\":%zu}\n",
+                             i);
+                break;
+            default:
+                n = snprintf(msg, sizeof(msg), "{\"event\":\"property-change\","
+                             "\"id\":1,\"name\":\"time-pos\","
+                             "\"data\":%zu.%06zu}\n", i / 10,
+                             i * 7919 % 1000000);
+                break;
+        }
+        if (len + (size_t)n > size) {
+            return len;
+        }
+        memcpy(buf + len, msg, n);
+        len += n;
+        (*n_msgs)++;
+    }
+}
+
+static bool bench_ipc(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        return false;
+    }
+    mpv_attach(sv[0]);
+
+    static char chunk[IPC_CHUNK];
+    size_t per_chunk;
+    size_t len = fill_messages(chunk, sizeof(chunk), &per_chunk);
+    size_t rounds = IPC_MESSAGES / per_chunk + 1;
+
+    long long t[MAX_REPS];
+    bool ok = true;
+    for (int r = 0; ok && r < bopts.reps; r++) {
+        size_t seen = 0;
+        long long t0 = now_ns();
+        for (size_t k = 0; ok && k < rounds; k++) {
+            ok = write(sv[1], chunk, len) == (ssize_t)len;
+            MPVEvent ev;
+            while (ok && mpv_read_events() > 0) {
+                while (mpv_next_event(&ev)) {
+                    seen++;
+                }
+            }
+        }
+        t[r] = now_ns() - t0;
+        ok = ok && seen == rounds * per_chunk;
+    }
+    if (ok) {
+        report("ipc_parse", "none", 0, rounds * per_chunk, t, bopts.reps);
+    }
+    close(sv[1]);
+    close(sv[0]);
+    return ok;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -n, --files N     songs per library "
+                    "(default: 100000)\n");
+    fprintf(stderr, "  -s, --shape S     flat, deep or unicode; repeatable "
+                    "(default: all)\n");
+    fprintf(stderr, "  -d, --dir PATH    where libraries are generated "
+                    "(default: /dev/shm/reed-bench)\n");
+    fprintf(stderr, "  -r, --reps N      repetitions per benchmark "
+                    "(default: 5)\n");
+    fprintf(stderr, "  -j, --jobs N      scanner and sort threads "
+                    "(default: one per CPU)\n");
+}
+
+static bool parse_args(int argc, char *argv[])
+{
+    static const struct option long_opts[] = {
+        { "files", required_argument, NULL, 'n' },
+        { "shape", required_argument, NULL, 's' },
+        { "dir",   required_argument, NULL, 'd' },
+        { "reps",  required_argument, NULL, 'r' },
+        { "jobs",  required_argument, NULL, 'j' },
+        { NULL,    0,                 NULL, 0   },
+    };
+
+    bool any_shape = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "n:s:d:r:j:", long_opts, NULL)) != -1) {
+        char *end = NULL;
+        long n = 0;
+        if (c == 'n' || c == 'r' || c == 'j') {
+            n = strtol(optarg, &end, 10);
+            if (*end != '\0' || n < 1) {
+                fprintf(stderr, "Invalid number: %s\n", optarg);
+                return false;
+            }
+        }
+        switch (c) {
+            case 'n': bopts.files = (size_t)n; break;
+            case 'r': bopts.reps = n > MAX_REPS ? MAX_REPS : (int)n; break;
+            case 'j': bopts.threads = (int)n; break;
+            case 'd': bopts.dir = optarg; break;
+            case 's': {
+                int s;
+                for (s = 0; s < N_SHAPES; s++) {
+                    if (strcmp(optarg, shape_names[s]) == 0) {
+                        break;
+                    }
+                }
+                if (s == N_SHAPES) {
+                    fprintf(stderr, "Unknown shape: %s\n", optarg);
+                    return false;
+                }
+                bopts.shapes[s] = true;
+                any_shape = true;
+                break;
+            }
+            default: return false;
+        }
+    }
+    if (!any_shape) {
+        for (int s = 0; s < N_SHAPES; s++) {
+            bopts.shapes[s] = true;
+        }
+    }
+    return optind == argc;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse_args(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* Library indexes go next to the libraries, not into the user's cache */
+    char cache[PATH_MAX];
+    snprintf(cache, sizeof(cache), "%s/cache", bopts.dir);
+    setenv("XDG_CACHE_HOME", cache, 1);
+
+    printf("{\n  \"format\": %d,\n  \"revision\": \"%s\",\n"
+           "  \"threads\": %d,\n  \"results\": [",
+           BENCH_FORMAT, BENCH_REV, bopts.threads > 0 ? bopts.threads
+                                           : scan_default_threads());
+
+    bool ok = true;
+    for (int s = 0; ok && s < N_SHAPES; s++) {
+        if (!bopts.shapes[s]) {
+            continue;
+        }
+        char root[PATH_MAX];
+        ok = gen_library(s, bopts.files, root, sizeof(root)) &&
+             bench_library(s, root);
+        if (!ok) {
+            break;
+        }
+
+        SongArrOpts lib = { .n_threads = bopts.threads, .rescan = false };
+        songarr = songarr_init(root, &lib);
+        ok = songarr != NULL && bench_player(s) && bench_session(s, root) &&
+             bench_search(s) && bench_menu(s);
+        if (songarr != NULL) {
+            songarr_destroy(songarr);
+            songarr = NULL;
+        }
+    }
+    ok = ok && bench_ipc();
+    printf("\n  ]\n}\n");
+
+    if (!ok) {
+        fprintf(stderr, "Benchmark failed\n");
+        return 1;
+    }
+    return 0;
+}
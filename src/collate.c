@@ -0,0 +1,106 @@
+/* File: collate.c
+ * Date: 2026-10-17
+ *
+ * Natural, locale-aware ordering of song names.
+ *
+ * Names are first normalized so that runs of digits compare by value:
+ * leading zeros are dropped and each run is prefixed with its length
+ * ("Track 2" -> "Track 12", "Track 10" -> "Track 210"). The normalized
+ * strings are then ordered by the LC_COLLATE locale, with plain byte order
+ * as the final tie-break so that distinct names never compare equal.
+ */
+
+#include <limits.h>
+#include <locale.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "collate.h"
+
+/* Normalizing at most doubles a name ("1a1a" -> "11a11a") */
+#define NORM_MAX (2 * NAME_MAX + 2)
+
+static bool plain_bytes = true; /* C/POSIX collation: strcoll == strcmp */
+static char name_buf[COLLATE_NAME_MAX] = "C";
+
+void collate_init(void)
+{
+    /* Call after setlocale(LC_COLLATE, "") */
+    const char *name = setlocale(LC_COLLATE, NULL);
+    if (name == NULL) {
+        name = "C";
+    }
+    snprintf(name_buf, sizeof(name_buf), "%s", name);
+    plain_bytes = strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0 ||
+                  strncmp(name, "C.", 2) == 0;
+}
+
+const char *collate_name(void)
+{
+    /* Stored with the library index, whose order depends on it */
+    return name_buf;
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static size_t normalize(const char *s, char *buf)
+{
+    /* Writes at most NORM_MAX bytes including the terminator */
+    size_t k = 0;
+    while (*s != '\0' && k + 1 < NORM_MAX) {
+        if (!is_digit(*s)) {
+            buf[k++] = *s++;
+            continue;
+        }
+        while (*s == '0' && is_digit(s[1])) {
+            s++;
+        }
+        size_t len = 0;
+        while (is_digit(s[len])) {
+            len++;
+        }
+        /* The length as '9' per nine digits plus the remainder keeps
+         * longer runs after shorter ones */
+        for (size_t n = len; n >= 9 && k + 1 < NORM_MAX; n -= 9) {
+            buf[k++] = '9';
+        }
+        if (k + 1 < NORM_MAX) {
+            buf[k++] = (char)('0' + len % 9);
+        }
+        for (size_t i = 0; i < len && k + 1 < NORM_MAX; i++) {
+            buf[k++] = s[i];
+        }
+        s += len;
+    }
+    buf[k] = '\0';
+    return k;
+}
+
+int collate_compare(const char *a, const char *b)
+{
+    char na[NORM_MAX];
+    char nb[NORM_MAX];
+    normalize(a, na);
+    normalize(b, nb);
+    int cmp = plain_bytes ? strcmp(na, nb) : strcoll(na, nb);
+    return cmp != 0 ? cmp : strcmp(a, b);
+}
+
+size_t collate_key(const char *s, char *buf, size_t size)
+{
+    /* Like strxfrm(): strcmp() on two keys orders like collate_compare()
+     * short of its byte-order tie-break. Returns the key length; if that
+     * is >= size, buf is unspecified and must be grown. */
+    char norm[NORM_MAX];
+    size_t len = normalize(s, norm);
+    if (plain_bytes) {
+        if (len < size) {
+            memcpy(buf, norm, len + 1);
+        }
+        return len;
+    }
+    return strxfrm(buf, norm, size);
+}
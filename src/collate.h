@@ -0,0 +1,20 @@
+/* File: collate.h
+ * Date: 2026-10-17
+ *
+ * Natural, locale-aware ordering of song names.
+ */
+
+#ifndef COLLATE_H
+#define COLLATE_H
+
+#include <stddef.h>
+
+#define COLLATE_NAME_MAX 32
+
+void collate_init(void);
+const char *collate_name(void);
+int collate_compare(const char *a, const char *b);
+size_t collate_key(const char *s, char *buf, size_t size);
+
+#endif
+
@@ -0,0 +1,463 @@
+/* File: ctl.c
+ * Date: 2026-10-17
+ *
+ * Control socket: many local clients, one line per message each way.
+ *
+ * One epoll instance watches the listening socket and every client, and
+ * its fd sits in the main poll() set: the loop wakes only for clients that
+ * have something to say, so idle ones cost their buffers and nothing else.
+ * Sockets are non-blocking. Input is cut into lines per client; output is
+ * written as far as the socket takes it at once and the rest kept, with
+ * EPOLLOUT asked for only while something is waiting. A client that stops
+ * reading is dropped once its backlog grows too large, rather than holding
+ * up everyone else.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ctl.h"
+
+#define LINE_MAX_LEN 4096    /* Longer commands are skipped */
+#define TX_MIN 4096
+#define TX_LIMIT (1 << 20)   /* Backlog a client may leave unread */
+#define MAX_CLIENTS 1024
+#define MAX_EVENTS 64
+
+struct CtlClient {
+    int fd;
+    bool dead;          /* Closed at the end of the current pass */
+    bool closing;       /* Hung up: gone once the backlog is out */
+    bool want_out;      /* EPOLLOUT is on */
+    bool discarding;    /* Skipping the rest of an overlong line */
+    size_t rx_len;
+    char rx[LINE_MAX_LEN];
+    char *tx;           /* Backlog, tx[tx_head, tx_head + tx_len) */
+    size_t tx_head;
+    size_t tx_len;
+    size_t tx_cap;
+    CtlClient *next;
+};
+
+struct Control {
+    int epfd;
+    int lfd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    ino_t ino;          /* Of the socket file, while it is ours */
+    CtlClient *clients;
+    size_t n_clients;
+    bool handling;      /* Inside ctl_handle(): clients stay allocated */
+    CtlLineFn on_line;
+    CtlHelloFn on_hello;
+} ct = { .epfd = -1, .lfd = -1 };
+
+static bool socket_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Control socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+bool ctl_default_path(char *buf, size_t size)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] != '/') {
+        return false;
+    }
+    return snprintf(buf, size, "%s/reed.sock", dir) < (int)size;
+}
+
+static bool watch_events(CtlClient *c, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    return epoll_ctl(ct.epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+}
+
+static void reap(void)
+{
+    CtlClient **link = &ct.clients;
+    while (*link != NULL) {
+        CtlClient *c = *link;
+        if (!c->dead) {
+            link = &c->next;
+            continue;
+        }
+        *link = c->next;
+        close(c->fd); /* Leaves the epoll set with it */
+        free(c->tx);
+        free(c);
+        ct.n_clients--;
+    }
+}
+
+static void flush_client(CtlClient *c)
+{
+    while (c->tx_len > 0) {
+        ssize_t n = send(c->fd, c->tx + c->tx_head, c->tx_len,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            c->dead = errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        }
+        c->tx_head += (size_t)n;
+        c->tx_len -= (size_t)n;
+    }
+    if (c->tx_len == 0) {
+        c->tx_head = 0;
+        if (c->closing) {
+            c->dead = true;
+        }
+    }
+    /* Writable wakeups only while a backlog waits */
+    bool want_out = c->tx_len > 0 && !c->dead;
+    if (want_out != c->want_out && !c->dead) {
+        uint32_t events = (c->closing ? 0 : EPOLLIN) |
+                          (want_out ? EPOLLOUT : 0);
+        c->dead = !watch_events(c, events);
+        c->want_out = want_out;
+    }
+}
+
+static bool backlog(CtlClient *c, const char *msg, size_t len)
+{
+    if (c->tx_len + len > TX_LIMIT) {
+        return false;
+    }
+    if (c->tx_head + c->tx_len + len > c->tx_cap) {
+        memmove(c->tx, c->tx + c->tx_head, c->tx_len);
+        c->tx_head = 0;
+    }
+    if (c->tx_len + len > c->tx_cap) {
+        size_t cap = c->tx_cap > 0 ? c->tx_cap : TX_MIN;
+        while (cap < c->tx_len + len) {
+            cap *= 2;
+        }
+        char *tx = realloc(c->tx, cap);
+        if (tx == NULL) {
+            return false;
+        }
+        c->tx = tx;
+        c->tx_cap = cap;
+    }
+    memcpy(c->tx + c->tx_head + c->tx_len, msg, len);
+    c->tx_len += len;
+    return true;
+}
+
+void ctl_send(CtlClient *c, const char *msg, size_t len)
+{
+    if (c->dead) {
+        return;
+    }
+    /* Straight to the socket when nothing is queued ahead of it */
+    while (c->tx_len == 0 && len > 0) {
+        ssize_t n = send(c->fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                c->dead = true;
+                return;
+            }
+            break;
+        }
+        msg += n;
+        len -= (size_t)n;
+    }
+    if (len == 0) {
+        return;
+    }
+    if (!backlog(c, msg, len)) {
+        c->dead = true; /* Too far behind to catch up */
+        return;
+    }
+    flush_client(c);
+}
+
+void ctl_broadcast(const char *msg, size_t len)
+{
+    for (CtlClient *c = ct.clients; c != NULL; c = c->next) {
+        if (!c->closing) {
+            ctl_send(c, msg, len);
+        }
+    }
+    if (!ct.handling) {
+        reap();
+    }
+}
+
+size_t ctl_clients(void)
+{
+    return ct.n_clients;
+}
+
+static void take_lines(CtlClient *c, const char *buf, size_t len)
+{
+    while (len > 0) {
+        const char *nl = memchr(buf, '\n', len);
+        size_t n = nl != NULL ? (size_t)(nl - buf) : len;
+        if (!c->discarding && c->rx_len + n < sizeof(c->rx)) {
+            memcpy(c->rx + c->rx_len, buf, n);
+            c->rx_len += n;
+        } else {
+            c->discarding = true;
+        }
+        if (nl == NULL) {
+            return;
+        }
+        if (!c->discarding) {
+            if (c->rx_len > 0 && c->rx[c->rx_len - 1] == '\r') {
+                c->rx_len--;
+            }
+            c->rx[c->rx_len] = '\0';
+            ct.on_line(c, c->rx);
+        }
+        c->rx_len = 0;
+        c->discarding = false;
+        buf += n + 1;
+        len -= n + 1;
+    }
+}
+
+static void read_client(CtlClient *c)
+{
+    /* A bounded amount per wakeup, so one chatty client cannot starve the
+     * rest; epoll reports it again if there is more */
+    char buf[16384];
+    for (int round = 0; round < 4 && !c->dead && !c->closing; round++) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            c->dead = errno != EAGAIN && errno != EWOULDBLOCK;
+            return;
+        } else if (n == 0) {
+            /* Replies still waiting go out before it is closed */
+            c->closing = true;
+            c->dead = c->dead || c->tx_len == 0 ||
+                      !watch_events(c, EPOLLOUT);
+            c->want_out = true;
+            return;
+        }
+        take_lines(c, buf, (size_t)n);
+    }
+}
+
+static void accept_clients(void)
+{
+    int fd;
+    while ((fd = accept4(ct.lfd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        CtlClient *c = ct.n_clients < MAX_CLIENTS ? malloc(sizeof(*c)) : NULL;
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        *c = (CtlClient){ .fd = fd };
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(ct.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = ct.clients;
+        ct.clients = c;
+        ct.n_clients++;
+        ct.on_hello(c);
+    }
+}
+
+void ctl_handle(void)
+{
+    struct epoll_event evs[MAX_EVENTS];
+    int n = epoll_wait(ct.epfd, evs, MAX_EVENTS, 0);
+    ct.handling = true;
+    for (int i = 0; i < n; i++) {
+        CtlClient *c = evs[i].data.ptr;
+        if (c == NULL) {
+            accept_clients();
+            continue;
+        }
+        uint32_t events = evs[i].events;
+        if (c->dead) {
+            continue;
+        }
+        if (events & EPOLLOUT) {
+            flush_client(c);
+        }
+        if (c->closing && (events & (EPOLLHUP | EPOLLERR))) {
+            c->dead = true; /* Gone for good: the backlog can go too */
+        } else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            read_client(c);
+        }
+    }
+    ct.handling = false;
+    reap();
+}
+
+static bool claim_path(const struct sockaddr_un *addr)
+{
+    /* A socket left by a crash is taken over, a live one is not, and
+     * anything else at the path is left alone */
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s: path exists and is not a socket\n",
+                addr->sun_path);
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return false;
+    }
+    bool live = connect(fd, (const struct sockaddr *)addr,
+                        sizeof(*addr)) == 0;
+    close(fd);
+    if (live) {
+        fprintf(stderr, "Another reed is listening on %s\n", addr->sun_path);
+        return false;
+    }
+    unlink(addr->sun_path);
+    return true;
+}
+
+int ctl_init(const char *path, CtlLineFn on_line, CtlHelloFn on_hello)
+{
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr) || !claim_path(&addr)) {
+        return -1;
+    }
+    ct.on_line = on_line;
+    ct.on_hello = on_hello;
+    ct.lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ct.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ct.lfd == -1 || ct.epfd == -1) {
+        goto fail;
+    }
+    /* Only this user may connect */
+    mode_t mask = umask(077);
+    int bound = bind(ct.lfd, (const struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound == -1) {
+        goto fail;
+    }
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        strcpy(ct.path, path);
+        ct.ino = st.st_ino;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (listen(ct.lfd, SOMAXCONN) == -1 ||
+        epoll_ctl(ct.epfd, EPOLL_CTL_ADD, ct.lfd, &ev) == -1) {
+        goto fail;
+    }
+    return ct.epfd;
+
+fail:
+    fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+    ctl_destroy();
+    return -1;
+}
+
+void ctl_destroy(void)
+{
+    for (CtlClient *c = ct.clients; c != NULL; c = c->next) {
+        c->dead = true;
+    }
+    reap();
+    if (ct.lfd != -1) {
+        close(ct.lfd);
+        ct.lfd = -1;
+    }
+    /* Unless a newer instance has taken the path over since */
+    struct stat st;
+    if (ct.path[0] != '\0' && stat(ct.path, &st) == 0 &&
+        st.st_ino == ct.ino) {
+        unlink(ct.path);
+    }
+    ct.path[0] = '\0';
+    if (ct.epfd != -1) {
+        close(ct.epfd);
+        ct.epfd = -1;
+    }
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool ctl_attach(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 ||
+        connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", path,
+                strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+
+    /* After stdin ends the server answers what is left, then hangs up */
+    struct pollfd pfds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    char buf[16384];
+    bool ok = true;
+    while (ok && poll(pfds, 2, -1) >= 0) {
+        if (pfds[0].revents != 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            ok = write_all(STDOUT_FILENO, buf, (size_t)n);
+        }
+        if (pfds[1].revents != 0) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n > 0) {
+                ok = write_all(fd, buf, (size_t)n);
+            } else {
+                shutdown(fd, SHUT_WR);
+                pfds[1].fd = -1;
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
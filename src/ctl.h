@@ -0,0 +1,37 @@
+/* File: ctl.h
+ * Date: 2026-10-17
+ *
+ * Control socket: many local clients, one line per message each way.
+ */
+
+#ifndef CTL_H
+#define CTL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct CtlClient CtlClient;
+
+/* One line from a client, newline stripped; it may be changed in place */
+typedef void (*CtlLineFn)(CtlClient *c, char *line);
+/* A client connected: the place to send it everything it has missed */
+typedef void (*CtlHelloFn)(CtlClient *c);
+
+/* Listens on path; returns an epoll fd that becomes readable when a client
+ * needs attention (then call ctl_handle()), or -1 */
+int ctl_init(const char *path, CtlLineFn on_line, CtlHelloFn on_hello);
+void ctl_handle(void);
+/* msg holds whole lines; a client that stops reading is dropped once too
+ * much is waiting for it */
+void ctl_send(CtlClient *c, const char *msg, size_t len);
+void ctl_broadcast(const char *msg, size_t len);
+size_t ctl_clients(void);
+void ctl_destroy(void);
+
+/* $XDG_RUNTIME_DIR/reed.sock; false if that is not set */
+bool ctl_default_path(char *buf, size_t size);
+/* Client side: stdin goes to the socket at path, the socket to stdout,
+ * until the server hangs up */
+bool ctl_attach(const char *path);
+
+#endif
@@ -0,0 +1,910 @@
+/* File: dupes.c
+ * Date: 2026-10-17
+ *
+ * Background duplicate finder with a persistent hash cache.
+ *
+ * A pass runs on its own thread over a copy of the library, so the UI never
+ * waits on it, and narrows the songs down in rounds that each cost more per
+ * file than the last but see fewer files:
+ *
+ *   1. stat() every song. Only sizes shared by two files go on (empty
+ *      files never do), and paths to one inode (hard links, symlinks) are
+ *      the same file without any reading.
+ *   2. Hash a few blocks spread over each remaining file.
+ *   3. Hash the whole of the files whose samples still collide.
+ *
+ * Each round is shared out to worker threads at the lowest CPU priority.
+ * The hash is xxHash64: fast, and good enough with the size and a full
+ * pass behind it. Both hashes are cached in $XDG_CACHE_HOME/reed/<hash>.dupes,
+ * keyed by (device, inode, mtime, size) like the tags, so a later pass only
+ * reads new or changed files. Of each set of equal files, the one under the
+ * earliest root, and first in the list, is kept.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "dupes.h"
+#include "libindex.h"
+#include "scan.h"
+#include "songarr.h"
+
+#define DUPES_MAGIC "REEDDUP"
+#define DUPES_VERSION 1
+#define MAX_WORKERS 16
+#define SAMPLE_BLOCKS 4
+#define SAMPLE_LEN (16 * 1024)   /* Bytes per sampled block */
+#define CHUNK_LEN (1024 * 1024)  /* Whole files are read this much at once */
+
+#define HAVE_SAMPLE (1u << 0)
+#define HAVE_FULL   (1u << 1)
+
+/* One file in the cache file */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t sample;   /* Hash of the sampled blocks */
+    uint64_t full;     /* Hash of the whole file */
+    uint32_t flags;    /* HAVE_SAMPLE, HAVE_FULL */
+    uint32_t pad;
+} DupeRecord;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t n_records;    /* Sorted by file */
+} CacheHeader;
+
+/* One song of the pass */
+typedef struct {
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t song;     /* Index in the copy */
+    uint32_t rank;     /* Index of its root: earlier roots keep their songs */
+    bool ok;
+} FileInfo;
+
+/* One inode of a size that more files have: the songs first..first+n-1 of
+ * the sorted files */
+typedef struct {
+    DupeRecord rec;
+    size_t first;
+    size_t n;
+    bool need;         /* Another inode has its size: it must be read */
+    bool fresh;        /* Hashed by this pass */
+    bool failed;       /* Unreadable, or changed under us */
+} Cand;
+
+typedef void (*JobFn)(size_t i, unsigned char *buf);
+
+struct Dupes {
+    int n_threads;
+    int efd;
+    char path[PATH_MAX];
+    const char *const *roots;
+    size_t n_roots;
+    pthread_t thread;
+    bool running;          /* thread was started and not joined yet */
+    atomic_bool stop;
+    atomic_bool done;      /* Its result waits for dupes_take() */
+
+    /* The pass, owned by its thread until done */
+    SongArr *songs;
+    FileInfo *files;
+    Cand *cands;
+    size_t n_cands;
+    size_t *work;          /* Cands for the round, by index */
+    size_t n_work;
+    atomic_size_t next;    /* Next job for a worker */
+    JobFn job;
+    size_t *keep;
+    size_t n_dupes;
+
+    /* Read by the pass only, loaded by the first one */
+    bool cache_tried;
+    void *map;
+    size_t map_len;
+    const DupeRecord *cache;
+    size_t cache_n;
+
+    bool started;
+} dp = { .efd = -1 };
+
+/* xxHash64 */
+
+#define P1 0x9e3779b185ebca87ull
+#define P2 0xc2b2ae3d27d4eb4full
+#define P3 0x165667b19e3779f9ull
+#define P4 0x85ebca77c2b2ae63ull
+#define P5 0x27d4eb2f165667c5ull
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+    return rotl64(acc + in * P2, 31) * P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t h, uint64_t v)
+{
+    return (h ^ xxh_round(0, v)) * P1 + P4;
+}
+
+static uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += (uint64_t)len;
+    for (; end - p >= 8; p += 8) {
+        h = rotl64(h ^ xxh_round(0, read64(p)), 27) * P1 + P4;
+    }
+    if (end - p >= 4) {
+        h = rotl64(h ^ (uint64_t)read32(p) * P1, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl64(h ^ *p * P5, 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+/* Cache */
+
+static int compare_files(const DupeRecord *a, const DupeRecord *b)
+{
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    if (a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    if (a->mtime_sec != b->mtime_sec) {
+        return a->mtime_sec < b->mtime_sec ? -1 : 1;
+    }
+    if (a->mtime_nsec != b->mtime_nsec) {
+        return a->mtime_nsec < b->mtime_nsec ? -1 : 1;
+    }
+    if (a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    return 0;
+}
+
+static void unload_cache(void)
+{
+    if (dp.map != NULL) {
+        munmap(dp.map, dp.map_len);
+    }
+    dp.map = NULL;
+    dp.cache = NULL;
+    dp.cache_n = 0;
+}
+
+static void load_cache(void)
+{
+    int fd = open(dp.path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const CacheHeader *hdr = map;
+    size_t len = st.st_size;
+    if (memcmp(hdr->magic, DUPES_MAGIC, sizeof(DUPES_MAGIC)) != 0 ||
+        hdr->version != DUPES_VERSION ||
+        hdr->n_records > len / sizeof(DupeRecord) ||
+        sizeof(CacheHeader) + hdr->n_records * sizeof(DupeRecord) != len) {
+        munmap(map, len);
+        return;
+    }
+    dp.map = map;
+    dp.map_len = len;
+    dp.cache = (const DupeRecord *)(hdr + 1);
+    dp.cache_n = hdr->n_records;
+}
+
+static void cache_find(DupeRecord *rec)
+{
+    size_t lo = 0;
+    size_t hi = dp.cache_n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_files(&dp.cache[mid], rec);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            rec->sample = dp.cache[mid].sample;
+            rec->full = dp.cache[mid].full;
+            rec->flags = dp.cache[mid].flags;
+            return;
+        }
+    }
+}
+
+static int compare_records(const void *p, const void *q)
+{
+    return compare_files(p, q);
+}
+
+static void save_cache(void)
+{
+    /* Every pass sees the whole library: records of files it did not
+     * read again belong to no song any more */
+    size_t n = 0;
+    bool fresh = false;
+    for (size_t i = 0; i < dp.n_cands; i++) {
+        const Cand *c = &dp.cands[i];
+        n += (!c->failed && c->rec.flags != 0);
+        fresh = fresh || c->fresh;
+    }
+    if (!fresh && n == dp.cache_n) {
+        return;
+    }
+    DupeRecord *recs = malloc((n + 1) * sizeof(DupeRecord));
+    if (recs == NULL) {
+        return;
+    }
+    n = 0;
+    for (size_t i = 0; i < dp.n_cands; i++) {
+        const Cand *c = &dp.cands[i];
+        if (!c->failed && c->rec.flags != 0) {
+            recs[n++] = c->rec;
+        }
+    }
+    qsort(recs, n, sizeof(DupeRecord), compare_records);
+
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", dp.path, (long)getpid());
+    CacheHeader hdr = {
+        .magic = DUPES_MAGIC,
+        .version = DUPES_VERSION,
+        .n_records = n,
+    };
+    bool ok = false;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp != NULL) {
+        ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             (n == 0 || fwrite(recs, sizeof(DupeRecord), n, fp) == n);
+        ok = (fclose(fp) == 0) && ok;
+    }
+    free(recs);
+    if (!ok || rename(tmp, dp.path) == -1) {
+        unlink(tmp);
+        return;
+    }
+    /* The next pass reads what this one learnt */
+    unload_cache();
+    load_cache();
+}
+
+/* Workers */
+
+static void lower_priority(void)
+{
+    /* Per thread on Linux: the UI and the player keep their share */
+    (void)setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+}
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    lower_priority();
+    unsigned char *buf = malloc(CHUNK_LEN);
+    while (buf != NULL) {
+        size_t i = atomic_fetch_add(&dp.next, 1);
+        if (i >= dp.n_work || atomic_load(&dp.stop)) {
+            break;
+        }
+        dp.job(i, buf);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void run_round(JobFn job, size_t n)
+{
+    /* Jobs 0..n-1, spread over the workers; the pass thread joins in */
+    pthread_t threads[MAX_WORKERS];
+    int n_threads = 0;
+    dp.job = job;
+    dp.n_work = n;
+    atomic_store(&dp.next, 0);
+    for (int i = 1; i < dp.n_threads && (size_t)i < n; i++) {
+        if (pthread_create(&threads[n_threads], NULL, worker_main,
+                           NULL) != 0) {
+            break;
+        }
+        n_threads++;
+    }
+    worker_main(NULL);
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static bool song_path(uint32_t song, char *buf, size_t size)
+{
+    return songarr_path(dp.songs, song, buf, size) < size;
+}
+
+static void stat_file(size_t i, unsigned char *buf)
+{
+    (void)buf;
+    FileInfo *f = &dp.files[i];
+    char path[PATH_MAX];
+    struct stat st;
+    /* Through symlinks: a link to a song is that song */
+    if (!song_path(f->song, path, sizeof(path)) || stat(path, &st) == -1 ||
+        !S_ISREG(st.st_mode)) {
+        return;
+    }
+    f->size = st.st_size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->mtime_sec = st.st_mtim.tv_sec;
+    f->mtime_nsec = st.st_mtim.tv_nsec;
+    f->ok = true;
+}
+
+static int open_cand(Cand *c)
+{
+    /* The file must still be the one that was looked up */
+    char path[PATH_MAX];
+    struct stat st;
+    int fd = -1;
+    if (song_path(dp.files[c->first].song, path, sizeof(path))) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd != -1 && (fstat(fd, &st) == -1 ||
+                     (uint64_t)st.st_dev != c->rec.dev ||
+                     (uint64_t)st.st_ino != c->rec.ino ||
+                     (uint64_t)st.st_size != c->rec.size ||
+                     st.st_mtim.tv_sec != c->rec.mtime_sec ||
+                     st.st_mtim.tv_nsec != c->rec.mtime_nsec)) {
+        close(fd);
+        fd = -1;
+    }
+    c->failed = (fd == -1);
+    return fd;
+}
+
+static bool read_at(int fd, unsigned char *buf, size_t len, uint64_t off)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, (off_t)off);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+static bool hash_full(Cand *c, int fd, unsigned char *buf)
+{
+    /* Chunk by chunk, each seeding the next */
+    uint64_t h = c->rec.size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (uint64_t off = 0; off < c->rec.size; off += CHUNK_LEN) {
+        size_t len = c->rec.size - off < CHUNK_LEN ? c->rec.size - off
+                                                   : CHUNK_LEN;
+        if (atomic_load(&dp.stop) || !read_at(fd, buf, len, off)) {
+            return false;
+        }
+        h = xxh64(buf, len, h);
+    }
+    /* Read once, most likely never again: leave the page cache alone */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    c->rec.full = h;
+    c->rec.flags |= HAVE_FULL;
+    return true;
+}
+
+static void sample_job(size_t i, unsigned char *buf)
+{
+    Cand *c = &dp.cands[dp.work[i]];
+    int fd = open_cand(c);
+    if (fd == -1) {
+        return;
+    }
+    bool ok = true;
+    if (c->rec.size <= SAMPLE_BLOCKS * SAMPLE_LEN) {
+        /* No cheaper than reading all of it */
+        ok = hash_full(c, fd, buf);
+        c->rec.sample = c->rec.full;
+    } else {
+        uint64_t h = c->rec.size;
+        uint64_t span = c->rec.size - SAMPLE_LEN;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+        for (int k = 0; ok && k < SAMPLE_BLOCKS; k++) {
+            uint64_t off = span * k / (SAMPLE_BLOCKS - 1);
+            ok = read_at(fd, buf, SAMPLE_LEN, off);
+            h = xxh64(buf, SAMPLE_LEN, h);
+        }
+        c->rec.sample = h;
+    }
+    close(fd);
+    c->rec.flags |= ok ? HAVE_SAMPLE : 0;
+    c->failed = !ok;
+    c->fresh = ok;
+}
+
+static void full_job(size_t i, unsigned char *buf)
+{
+    Cand *c = &dp.cands[dp.work[i]];
+    int fd = open_cand(c);
+    if (fd == -1) {
+        return;
+    }
+    c->failed = !hash_full(c, fd, buf);
+    c->fresh = !c->failed;
+    close(fd);
+}
+
+/* The pass */
+
+static int compare_sizes(const void *p, const void *q)
+{
+    /* By size, then inode; the best song to keep first within each */
+    const FileInfo *a = p;
+    const FileInfo *b = q;
+    if (a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    if (a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    if (a->rank != b->rank) {
+        return a->rank < b->rank ? -1 : 1;
+    }
+    return a->song < b->song ? -1 : (a->song > b->song);
+}
+
+static bool have(const Cand *c, uint32_t flag)
+{
+    return c->need && !c->failed && (c->rec.flags & flag);
+}
+
+static int compare_hashes(const Cand *a, const Cand *b, uint32_t flag)
+{
+    uint64_t ha = flag == HAVE_FULL ? a->rec.full : a->rec.sample;
+    uint64_t hb = flag == HAVE_FULL ? b->rec.full : b->rec.sample;
+    if (have(a, flag) != have(b, flag)) {
+        return have(a, flag) ? -1 : 1;
+    }
+    if (have(a, flag) && ha != hb) {
+        return ha < hb ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_cands(const void *p, const void *q)
+{
+    /* Equal samples side by side, and equal contents among those */
+    const Cand *a = p;
+    const Cand *b = q;
+    int cmp;
+    if (a->rec.size != b->rec.size) {
+        return a->rec.size < b->rec.size ? -1 : 1;
+    }
+    if ((cmp = compare_hashes(a, b, HAVE_SAMPLE)) != 0 ||
+        (cmp = compare_hashes(a, b, HAVE_FULL)) != 0) {
+        return cmp;
+    }
+    return a->first < b->first ? -1 : (a->first > b->first);
+}
+
+static bool same_sample(const Cand *a, const Cand *b)
+{
+    return have(a, HAVE_SAMPLE) && have(b, HAVE_SAMPLE) &&
+           a->rec.size == b->rec.size && a->rec.sample == b->rec.sample;
+}
+
+static bool same_content(const Cand *a, const Cand *b)
+{
+    return have(a, HAVE_FULL) && have(b, HAVE_FULL) &&
+           a->rec.size == b->rec.size && a->rec.full == b->rec.full;
+}
+
+static uint32_t root_rank(const char *dir)
+{
+    for (size_t i = 0; i < dp.n_roots; i++) {
+        size_t len = strlen(dp.roots[i]);
+        if (strncmp(dir, dp.roots[i], len) == 0 &&
+            (dir[len] == '\0' || dir[len] == '/' ||
+             (len > 0 && dp.roots[i][len - 1] == '/'))) {
+            return (uint32_t)i;
+        }
+    }
+    return (uint32_t)dp.n_roots;
+}
+
+static bool stat_songs(size_t *n_ok)
+{
+    const SongArr *songs = dp.songs;
+    uint32_t *rank = malloc((songs->n_dirs + 1) * sizeof(uint32_t));
+    if (rank == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < songs->n_dirs; i++) {
+        rank[i] = root_rank(songarr_dirpath(songs, (uint32_t)i));
+    }
+    for (size_t i = 0; i < songs->size; i++) {
+        dp.files[i] = (FileInfo){
+            .song = (uint32_t)i,
+            .rank = rank[songs->arr[i].dir],
+        };
+        dp.keep[i] = DUPES_GONE;
+    }
+    free(rank);
+
+    run_round(stat_file, songs->size);
+    size_t n = 0;
+    for (size_t i = 0; i < songs->size; i++) {
+        if (dp.files[i].ok) {
+            dp.keep[dp.files[i].song] = dp.files[i].song;
+            dp.files[n++] = dp.files[i];
+        }
+    }
+    *n_ok = n;
+    return !atomic_load(&dp.stop);
+}
+
+static void find_cands(size_t n)
+{
+    /* One per inode of every size that more than one file has */
+    const FileInfo *files = dp.files;
+    for (size_t a = 0, b; a < n; a = b) {
+        b = a + 1;
+        while (b < n && files[b].size == files[a].size) {
+            b++;
+        }
+        if (b - a < 2 || files[a].size == 0) {
+            continue; /* Empty files are placeholders, not copies */
+        }
+        size_t from = dp.n_cands;
+        for (size_t s = a, e; s < b; s = e) {
+            e = s + 1;
+            while (e < b && files[e].dev == files[s].dev &&
+                   files[e].ino == files[s].ino) {
+                e++;
+            }
+            dp.cands[dp.n_cands++] = (Cand){
+                .rec = {
+                    .dev = files[s].dev,
+                    .ino = files[s].ino,
+                    .mtime_sec = files[s].mtime_sec,
+                    .mtime_nsec = files[s].mtime_nsec,
+                    .size = files[s].size,
+                },
+                .first = s,
+                .n = e - s,
+            };
+        }
+        for (size_t i = from; dp.n_cands - from > 1 && i < dp.n_cands; i++) {
+            dp.cands[i].need = true;
+            cache_find(&dp.cands[i].rec);
+        }
+    }
+}
+
+static void hash_cands(void)
+{
+    /* Samples for every candidate, then whole files where they agree */
+    size_t n = 0;
+    for (size_t i = 0; i < dp.n_cands; i++) {
+        if (dp.cands[i].need && !(dp.cands[i].rec.flags & HAVE_SAMPLE)) {
+            dp.work[n++] = i;
+        }
+    }
+    run_round(sample_job, n);
+    if (atomic_load(&dp.stop)) {
+        return;
+    }
+
+    qsort(dp.cands, dp.n_cands, sizeof(Cand), compare_cands);
+    n = 0;
+    for (size_t a = 0, b; a < dp.n_cands; a = b) {
+        b = a + 1;
+        while (b < dp.n_cands && same_sample(&dp.cands[a], &dp.cands[b])) {
+            b++;
+        }
+        for (size_t i = a; b - a > 1 && i < b; i++) {
+            if (!(dp.cands[i].rec.flags & HAVE_FULL)) {
+                dp.work[n++] = i;
+            }
+        }
+    }
+    run_round(full_job, n);
+    qsort(dp.cands, dp.n_cands, sizeof(Cand), compare_cands);
+}
+
+static void group_cands(void)
+{
+    /* Candidates of equal content (or one alone, with its links) make a
+     * set, side by side in the candidate order */
+    const FileInfo *files = dp.files;
+    for (size_t a = 0, b; a < dp.n_cands; a = b) {
+        b = a + 1;
+        while (b < dp.n_cands && same_content(&dp.cands[a], &dp.cands[b])) {
+            b++;
+        }
+        const FileInfo *best = &files[dp.cands[a].first];
+        for (size_t k = a + 1; k < b; k++) {
+            const FileInfo *f = &files[dp.cands[k].first];
+            if (f->rank < best->rank ||
+                (f->rank == best->rank && f->song < best->song)) {
+                best = f;
+            }
+        }
+        for (size_t k = a; k < b; k++) {
+            const Cand *c = &dp.cands[k];
+            for (size_t j = c->first; j < c->first + c->n; j++) {
+                if (files[j].song != best->song) {
+                    dp.keep[files[j].song] = best->song;
+                    dp.n_dupes++;
+                }
+            }
+        }
+    }
+}
+
+static bool find_dupes(void)
+{
+    size_t n = dp.songs->size;
+    dp.keep = malloc((n + 1) * sizeof(size_t));
+    dp.files = malloc((n + 1) * sizeof(FileInfo));
+    dp.cands = malloc((n + 1) * sizeof(Cand));
+    dp.work = malloc((n + 1) * sizeof(size_t));
+    dp.n_cands = 0;
+    dp.n_dupes = 0;
+    if (dp.keep == NULL || dp.files == NULL || dp.cands == NULL ||
+        dp.work == NULL || !stat_songs(&n)) {
+        return false;
+    }
+    qsort(dp.files, n, sizeof(FileInfo), compare_sizes);
+    find_cands(n);
+    hash_cands();
+    if (atomic_load(&dp.stop)) {
+        return false;
+    }
+    group_cands();
+    save_cache();
+    return true;
+}
+
+static void *pass_main(void *arg)
+{
+    (void)arg;
+    lower_priority();
+    if (!dp.cache_tried) {
+        load_cache();
+        dp.cache_tried = true;
+    }
+    if (!find_dupes()) {
+        free(dp.keep);
+        dp.keep = NULL;
+    }
+    free(dp.files);
+    free(dp.cands);
+    free(dp.work);
+    dp.files = NULL;
+    dp.cands = NULL;
+    dp.work = NULL;
+    if (!atomic_load(&dp.stop)) {
+        uint64_t one = 1;
+        atomic_store(&dp.done, true);
+        (void)!write(dp.efd, &one, sizeof(one));
+    }
+    return NULL;
+}
+
+static void stop_pass(void)
+{
+    if (!dp.running) {
+        return;
+    }
+    atomic_store(&dp.stop, true);
+    pthread_join(dp.thread, NULL);
+    dp.running = false;
+    atomic_store(&dp.done, false);
+    uint64_t n;
+    (void)!read(dp.efd, &n, sizeof(n));
+    free(dp.keep);
+    dp.keep = NULL;
+    if (dp.songs != NULL) {
+        songarr_destroy(dp.songs);
+        dp.songs = NULL;
+    }
+}
+
+/* UI thread */
+
+int dupes_init(const char *const *roots, size_t n_roots, int n_threads)
+{
+    if (!libindex_cache_path(roots, n_roots, "dupes", dp.path,
+                             sizeof(dp.path), true)) {
+        return -1;
+    }
+    dp.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dp.efd == -1) {
+        return -1;
+    }
+    if (n_threads <= 0) {
+        n_threads = scan_default_threads();
+    }
+    dp.n_threads = n_threads > MAX_WORKERS ? MAX_WORKERS : n_threads;
+    dp.roots = roots;
+    dp.n_roots = n_roots;
+    dp.started = true;
+    return dp.efd;
+}
+
+void dupes_destroy(void)
+{
+    if (!dp.started) {
+        return;
+    }
+    stop_pass();
+    unload_cache();
+    close(dp.efd);
+    dp.efd = -1;
+    dp.started = false;
+}
+
+bool dupes_start(const SongArr *songarr, const SongArr *extra)
+{
+    if (!dp.started) {
+        return false;
+    }
+    stop_pass();
+    SongArr *songs = songarr_copy(songarr);
+    uint32_t *dir_map = NULL;
+    bool ok = songs != NULL;
+    if (ok && extra != NULL) {
+        dir_map = malloc((extra->n_dirs + 1) * sizeof(uint32_t));
+        ok = dir_map != NULL;
+        for (size_t i = 0; ok && i < extra->n_dirs; i++) {
+            dir_map[i] = UINT32_MAX;
+        }
+    }
+    for (size_t i = 0; ok && extra != NULL && i < extra->size; i++) {
+        /* Listed again meanwhile: once is enough */
+        uint32_t dir = extra->arr[i].dir;
+        const char *path = songarr_dirpath(extra, dir);
+        const char *name = songarr_name(extra, i);
+        if (songarr_find(songarr, path, name) != SONGARR_NONE) {
+            continue;
+        }
+        if (dir_map[dir] == UINT32_MAX) {
+            struct timespec mtime = {
+                extra->dirs[dir].mtime_sec, extra->dirs[dir].mtime_nsec
+            };
+            ok = songarr_add_dir(songs, path, mtime, &dir_map[dir]);
+        }
+        ok = ok && songarr_append(songs, dir_map[dir], name);
+    }
+    free(dir_map);
+    if (!ok) {
+        if (songs != NULL) {
+            songarr_destroy(songs);
+        }
+        return false;
+    }
+
+    dp.songs = songs;
+    atomic_store(&dp.stop, false);
+    atomic_store(&dp.done, false);
+    if (pthread_create(&dp.thread, NULL, pass_main, NULL) != 0) {
+        songarr_destroy(songs);
+        dp.songs = NULL;
+        return false;
+    }
+    dp.running = true;
+    return true;
+}
+
+bool dupes_take(DupesResult *res)
+{
+    if (!dp.running || !atomic_load(&dp.done)) {
+        return false;
+    }
+    pthread_join(dp.thread, NULL);
+    dp.running = false;
+    atomic_store(&dp.done, false);
+    uint64_t n;
+    (void)!read(dp.efd, &n, sizeof(n));
+    *res = (DupesResult){
+        .songs = dp.songs,
+        .keep = dp.keep,
+        .n_dupes = dp.n_dupes,
+    };
+    dp.songs = NULL;
+    dp.keep = NULL;
+    return true;
+}
+
+void dupes_result_free(DupesResult *res)
+{
+    if (res->songs != NULL) {
+        songarr_destroy(res->songs);
+    }
+    free(res->keep);
+    *res = (DupesResult){0};
+}
@@ -0,0 +1,37 @@
+/* File: dupes.h
+ * Date: 2026-10-17
+ *
+ * Background duplicate finder with a persistent hash cache.
+ */
+
+#ifndef DUPES_H
+#define DUPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "songarr.h"
+
+/* keep value for songs that could not be read */
+#define DUPES_GONE ((size_t)-1)
+
+typedef struct {
+    SongArr *songs;   /* The copy the pass looked at */
+    size_t *keep;     /* Per song: itself, the song listed in its place if
+                       * it is a duplicate, or DUPES_GONE. NULL when the
+                       * pass failed. */
+    size_t n_dupes;
+} DupesResult;
+
+/* Returns an eventfd that becomes readable when a pass has finished, or
+ * -1. The roots must outlive the finder. */
+int dupes_init(const char *const *roots, size_t n_roots, int n_threads);
+void dupes_destroy(void);
+/* Looks at a copy of the songs of songarr, and those of extra (may be NULL)
+ * that songarr does not list, in that order. A pass still running is
+ * abandoned. */
+bool dupes_start(const SongArr *songarr, const SongArr *extra);
+/* False until the last pass started has finished */
+bool dupes_take(DupesResult *res);
+void dupes_result_free(DupesResult *res);
+
+#endif
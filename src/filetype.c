@@ -0,0 +1,207 @@
+/* File: filetype.c
+ * Date: 2026-10-17
+ *
+ * Audio file classifier for the library scanner.
+ *
+ * Tier one looks the (lower-cased) extension up in a perfect hash table of
+ * known audio and known non-audio extensions: the extension is packed into
+ * a uint64_t, multiplied by EXT_MUL and the top 8 bits pick the only slot
+ * it can live in, so a lookup is one multiply and one compare and no file
+ * is opened. Only names with no extension or an unknown one fall through
+ * to tier two, which reads the first bytes of the file with a single
+ * pread() and matches container/stream signatures.
+ *
+ * The table was generated offline: if an extension is added, EXT_MUL has
+ * to be searched again so that no two entries share a slot.
+ */
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "filetype.h"
+
+#define EXT_MAX 8
+#define EXT_MUL UINT64_C(0x5a1869f4f4c8428f)
+#define EXT_SLOT(key) ((size_t)(((key) * EXT_MUL) >> 56))
+#define SNIFF_LEN 12
+
+typedef struct {
+    char ext[EXT_MAX]; /* NUL-padded */
+    bool audio;
+} ExtSlot;
+
+static const ExtSlot ext_table[256] = {
+    [  4] = { "mpc", true },
+    [  8] = { "tta", true },
+    [  9] = { "oga", true },
+    [ 10] = { "sfv", false },
+    [ 14] = { "tif", false },
+    [ 18] = { "flac", true },
+    [ 24] = { "aifc", true },
+    [ 30] = { "html", false },
+    [ 34] = { "wv", true },
+    [ 35] = { "dff", true },
+    [ 38] = { "mp3", true },
+    [ 40] = { "m4v", false },
+    [ 43] = { "pdf", false },
+    [ 53] = { "opus", true },
+    [ 57] = { "log", false },
+    [ 60] = { "m3u8", false },
+    [ 61] = { "bmp", false },
+    [ 62] = { "webp", false },
+    [ 66] = { "tar", false },
+    [ 71] = { "txt", false },
+    [ 75] = { "au", true },
+    [ 78] = { "zip", false },
+    [ 79] = { "caf", true },
+    [ 80] = { "pls", false },
+    [ 82] = { "mp1", true },
+    [ 83] = { "xml", false },
+    [ 88] = { "jpeg", false },
+    [ 90] = { "snd", true },
+    [ 93] = { "aac", true },
+    [ 94] = { "aif", true },
+    [ 95] = { "webm", false },
+    [ 96] = { "dsf", true },
+    [ 97] = { "nfo", false },
+    [100] = { "sh", false },
+    [103] = { "mkv", false },
+    [108] = { "wma", true },
+    [119] = { "m4a", true },
+    [120] = { "json", false },
+    [122] = { "gif", false },
+    [124] = { "sfk", false },
+    [125] = { "mpga", true },
+    [126] = { "asd", false },
+    [132] = { "ogg", true },
+    [137] = { "png", false },
+    [138] = { "db", false },
+    [142] = { "rar", false },
+    [146] = { "eac3", true },
+    [156] = { "wave", true },
+    [158] = { "jpg", false },
+    [159] = { "ape", true },
+    [166] = { "m3u", false },
+    [167] = { "tiff", false },
+    [176] = { "ac3", true },
+    [182] = { "mka", true },
+    [183] = { "amr", true },
+    [185] = { "adts", true },
+    [188] = { "mp2", true },
+    [191] = { "url", false },
+    [196] = { "accurip", false },
+    [199] = { "htm", false },
+    [201] = { "mov", false },
+    [205] = { "cue", false },
+    [210] = { "spx", true },
+    [213] = { "md5", false },
+    [214] = { "pkf", false },
+    [217] = { "avi", false },
+    [218] = { "dts", true },
+    [219] = { "lrc", false },
+    [225] = { "m4b", true },
+    [226] = { "gz", false },
+    [231] = { "ini", false },
+    [247] = { "aiff", true },
+    [248] = { "wav", true },
+    [251] = { "ffp", false },
+    [253] = { "7z", false },
+};
+
+typedef enum { TYPE_UNKNOWN, TYPE_AUDIO, TYPE_OTHER } FileType;
+
+static FileType lookup_ext(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL || dot[1] == '\0' || strchr(dot, '/') != NULL) {
+        return TYPE_UNKNOWN;
+    }
+
+    char ext[EXT_MAX] = { 0 };
+    uint64_t key = 0;
+    size_t i;
+    for (i = 0; dot[i + 1] != '\0'; i++) {
+        if (i == EXT_MAX) {
+            return TYPE_UNKNOWN;
+        }
+        unsigned char c = (unsigned char)dot[i + 1];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        ext[i] = (char)c;
+        key |= (uint64_t)c << (8 * i);
+    }
+
+    const ExtSlot *slot = &ext_table[EXT_SLOT(key)];
+    if (memcmp(slot->ext, ext, EXT_MAX) != 0) {
+        return TYPE_UNKNOWN;
+    }
+    return slot->audio ? TYPE_AUDIO : TYPE_OTHER;
+}
+
+static bool mpeg_sync(const unsigned char *b)
+{
+    /* MPEG audio frame or ADTS (AAC) header without an ID3 tag in front */
+    if (b[0] != 0xFF || (b[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+    int version = (b[1] >> 3) & 3;
+    int layer = (b[1] >> 1) & 3;
+    if (layer == 0) {
+        return (b[1] & 0xF6) == 0xF0;
+    }
+    return version != 1 && (b[2] >> 4) != 15 && ((b[2] >> 2) & 3) != 3;
+}
+
+static bool sniff(const unsigned char *b, size_t len)
+{
+    static const struct {
+        const char *magic;
+        size_t off;
+    } sigs[] = {
+        { "ID3", 0 }, { "OggS", 0 }, { "fLaC", 0 }, { "MAC ", 0 },
+        { "wvpk", 0 }, { "MPCK", 0 }, { "MP+", 0 }, { "TTA1", 0 },
+        { "caff", 0 }, { ".snd", 0 }, { "#!AMR", 0 }, { "DSD ", 0 },
+        { "FRM8", 0 }, { "WAVE", 8 }, { "AIFF", 8 }, { "AIFC", 8 },
+        { "M4A ", 8 }, { "M4B ", 8 }, { "M4P ", 8 }, { "F4A ", 8 },
+        { "\x30\x26\xB2\x75\x8E\x66\xCF\x11", 0 }, /* ASF (WMA) */
+    };
+
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+        size_t n = strlen(sigs[i].magic);
+        if (sigs[i].off + n <= len &&
+            memcmp(b + sigs[i].off, sigs[i].magic, n) == 0) {
+            /* The offset-8 forms are RIFF/RF64, FORM and ftyp brands */
+            if (sigs[i].off == 0 || memcmp(b, "RIFF", 4) == 0 ||
+                memcmp(b, "RF64", 4) == 0 || memcmp(b, "FORM", 4) == 0 ||
+                memcmp(b + 4, "ftyp", 4) == 0) {
+                return true;
+            }
+        }
+    }
+    if (len >= 2 && b[0] == 0x0B && b[1] == 0x77) {
+        return true; /* AC-3 */
+    }
+    return len >= 3 && mpeg_sync(b);
+}
+
+bool filetype_is_audio(int dirfd, const char *name)
+{
+    switch (lookup_ext(name)) {
+        case TYPE_AUDIO: return true;
+        case TYPE_OTHER: return false;
+        default: break;
+    }
+
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd == -1) {
+        return false;
+    }
+    unsigned char buf[SNIFF_LEN];
+    ssize_t n = pread(fd, buf, sizeof(buf), 0);
+    close(fd);
+    return n > 0 && sniff(buf, (size_t)n);
+}
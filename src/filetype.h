@@ -0,0 +1,16 @@
+/* File: filetype.h
+ * Date: 2026-10-17
+ *
+ * Audio file classifier for the library scanner.
+ */
+
+#ifndef FILETYPE_H
+#define FILETYPE_H
+
+#include <stdbool.h>
+
+/* name is relative to dirfd (or AT_FDCWD). Decided by the extension when
+ * it is a known one, otherwise by the first bytes of the file. */
+bool filetype_is_audio(int dirfd, const char *name);
+
+#endif
@@ -0,0 +1,262 @@
+/* File: json.c
+ * Date: 2026-10-17
+ *
+ * Allocation-free JSON tokenizer.
+ *
+ * json_parse() splits one document into a flat array of tokens in document
+ * order (an object's members follow it as key, value, key, value...). No
+ * value is copied or converted until a caller asks for it.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+#define JSON_MAX_DEPTH 32
+
+typedef struct {
+    int tok;
+    int count; /* Direct children so far */
+} Level;
+
+static bool add_child(JsonTok *toks, Level *lv, int depth, JsonType type)
+{
+    /* Object members alternate key/value; keys must be strings */
+    if (depth == 0) {
+        return true;
+    }
+    Level *top = &lv[depth - 1];
+    JsonTok *parent = &toks[top->tok];
+    if (parent->type == JSON_OBJECT) {
+        if (top->count % 2 == 0) {
+            if (type != JSON_STRING) {
+                return false;
+            }
+            parent->size++;
+        }
+    } else {
+        parent->size++;
+    }
+    top->count++;
+    return true;
+}
+
+static bool is_delim(char c)
+{
+    return c == ',' || c == ']' || c == '}' || c == ':' ||
+           c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int json_parse(const char *js, size_t len, JsonTok *toks, int max_toks)
+{
+    /* Returns the number of tokens, or -1 if js is not a single valid-ish
+     * document or needs more than max_toks tokens. */
+    Level lv[JSON_MAX_DEPTH];
+    int depth = 0;
+    int n = 0;
+    bool done = false;
+
+    for (size_t pos = 0; pos < len; pos++) {
+        char c = js[pos];
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n':
+            case ':': case ',':
+                break;
+            case '{':
+            case '[': {
+                JsonType type = (c == '{') ? JSON_OBJECT : JSON_ARRAY;
+                if (done || n == max_toks || depth == JSON_MAX_DEPTH ||
+                    !add_child(toks, lv, depth, type)) {
+                    return -1;
+                }
+                toks[n] = (JsonTok){ type, (int)pos, -1, 0 };
+                lv[depth++] = (Level){ n, 0 };
+                n++;
+                break;
+            }
+            case '}':
+            case ']': {
+                JsonType type = (c == '}') ? JSON_OBJECT : JSON_ARRAY;
+                if (depth == 0 || toks[lv[depth - 1].tok].type != type ||
+                    (type == JSON_OBJECT && lv[depth - 1].count % 2 != 0)) {
+                    return -1;
+                }
+                toks[lv[--depth].tok].end = (int)pos + 1;
+                done = (depth == 0);
+                break;
+            }
+            case '"': {
+                size_t start = pos + 1;
+                for (pos = start; pos < len && js[pos] != '"'; pos++) {
+                    if (js[pos] == '\\') {
+                        pos++;
+                    }
+                }
+                if (pos >= len || done || n == max_toks ||
+                    !add_child(toks, lv, depth, JSON_STRING)) {
+                    return -1;
+                }
+                toks[n++] = (JsonTok){ JSON_STRING, (int)start, (int)pos, 0 };
+                done = (depth == 0);
+                break;
+            }
+            default: {
+                size_t start = pos;
+                while (pos < len && !is_delim(js[pos])) {
+                    pos++;
+                }
+                if (done || n == max_toks ||
+                    !add_child(toks, lv, depth, JSON_PRIMITIVE)) {
+                    return -1;
+                }
+                toks[n++] = (JsonTok){ JSON_PRIMITIVE, (int)start, (int)pos, 0 };
+                done = (depth == 0);
+                pos--; /* Re-read the delimiter */
+                break;
+            }
+        }
+    }
+    return (done && depth == 0) ? n : -1;
+}
+
+int json_skip(const JsonTok *toks, int n_toks, int i)
+{
+    /* Index of the first token after the subtree rooted at i */
+    int end = toks[i].end;
+    int j = i + 1;
+    while (j < n_toks && toks[j].start < end) {
+        j++;
+    }
+    return j;
+}
+
+int json_find(const char *js, const JsonTok *toks, int n_toks, int obj,
+              const char *key)
+{
+    /* Token index of obj[key], or -1 */
+    if (obj < 0 || obj >= n_toks || toks[obj].type != JSON_OBJECT) {
+        return -1;
+    }
+    int i = obj + 1;
+    for (int k = 0; k < toks[obj].size && i + 1 < n_toks; k++) {
+        if (json_eq(js, &toks[i], key)) {
+            return i + 1;
+        }
+        i = json_skip(toks, n_toks, i + 1);
+    }
+    return -1;
+}
+
+bool json_eq(const char *js, const JsonTok *tok, const char *s)
+{
+    size_t len = tok->end - tok->start;
+    return tok->type == JSON_STRING && strlen(s) == len &&
+           memcmp(js + tok->start, s, len) == 0;
+}
+
+bool json_string(const char *js, const JsonTok *tok, char *buf, size_t size)
+{
+    /* Unescapes into buf; \u escapes outside ASCII become '?'. Returns
+     * false if tok is not a string or buf was too small. */
+    if (tok->type != JSON_STRING || size == 0) {
+        return false;
+    }
+    size_t k = 0;
+    for (int i = tok->start; i < tok->end; i++) {
+        char c = js[i];
+        if (c == '\\' && i + 1 < tok->end) {
+            c = js[++i];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': {
+                    char hex[5] = {0};
+                    for (int h = 0; h < 4 && i + 1 < tok->end; h++) {
+                        hex[h] = js[++i];
+                    }
+                    long cp = strtol(hex, NULL, 16);
+                    c = (cp > 0 && cp < 0x80) ? (char)cp : '?';
+                    break;
+                }
+                default: break; /* \" \\ \/ */
+            }
+        }
+        if (k + 1 >= size) {
+            buf[k] = '\0';
+            return false;
+        }
+        buf[k++] = c;
+    }
+    buf[k] = '\0';
+    return true;
+}
+
+bool json_number(const char *js, const JsonTok *tok, double *out)
+{
+    if (tok->type != JSON_PRIMITIVE) {
+        return false;
+    }
+    char num[64];
+    size_t len = tok->end - tok->start;
+    if (len == 0 || len >= sizeof(num)) {
+        return false;
+    }
+    memcpy(num, js + tok->start, len);
+    num[len] = '\0';
+    char *end;
+    *out = strtod(num, &end);
+    return *end == '\0';
+}
+
+bool json_bool(const char *js, const JsonTok *tok, bool *out)
+{
+    if (tok->type != JSON_PRIMITIVE) {
+        return false;
+    }
+    size_t len = tok->end - tok->start;
+    if (len == 4 && memcmp(js + tok->start, "true", 4) == 0) {
+        *out = true;
+        return true;
+    }
+    if (len == 5 && memcmp(js + tok->start, "false", 5) == 0) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+size_t json_escape(const char *s, char *buf, size_t size)
+{
+    /* Like snprintf: returns the escaped length, writes at most size bytes
+     * including the terminator. Quotes are not added. */
+    size_t k = 0;
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        char esc[8];
+        size_t n;
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = (char)c;
+            n = 2;
+        } else if (c < 0x20) {
+            n = (size_t)snprintf(esc, sizeof(esc), "\\u%04x", c);
+        } else {
+            esc[0] = (char)c;
+            n = 1;
+        }
+        for (size_t i = 0; i < n; i++, k++) {
+            if (k + 1 < size) {
+                buf[k] = esc[i];
+            }
+        }
+    }
+    if (size > 0) {
+        buf[k < size ? k : size - 1] = '\0';
+    }
+    return k;
+}
@@ -0,0 +1,38 @@
+/* File: json.h
+ * Date: 2026-10-17
+ *
+ * Allocation-free JSON tokenizer.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE, /* Number, true, false or null */
+} JsonType;
+
+typedef struct {
+    JsonType type;
+    int start;      /* Strings exclude their quotes */
+    int end;
+    int size;       /* Members (objects) or elements (arrays) */
+} JsonTok;
+
+int json_parse(const char *js, size_t len, JsonTok *toks, int max_toks);
+int json_skip(const JsonTok *toks, int n_toks, int i);
+int json_find(const char *js, const JsonTok *toks, int n_toks, int obj,
+              const char *key);
+bool json_eq(const char *js, const JsonTok *tok, const char *s);
+bool json_string(const char *js, const JsonTok *tok, char *buf, size_t size);
+bool json_number(const char *js, const JsonTok *tok, double *out);
+bool json_bool(const char *js, const JsonTok *tok, bool *out);
+size_t json_escape(const char *s, char *buf, size_t size);
+
+#endif
+
@@ -0,0 +1,348 @@
+/* File: libindex.c
+ * Date: 2026-10-17
+ *
+ * Persistent, memory-mapped library index.
+ *
+ * The sorted SongArr is written to $XDG_CACHE_HOME/reed/<hash>.idx as:
+ *
+ *   IndexHeader | root paths | SDir[n_dirs] | SFile[n_entries] | string pool
+ *
+ * The tables are the in-memory SongArr layout, so on load the file is
+ * mapped read-only and the SongArr borrows its arrays and pool straight
+ * from the mapping: a clean start allocates nothing per entry and copies
+ * nothing. An index sorted under another collation is re-sorted first.
+ * Directories whose mtime changed are rescanned (without descending into
+ * subdirectories the index already knows about) and merged in with
+ * songarr_apply(), after which the index is rewritten.
+ */
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "collate.h"
+#include "libindex.h"
+#include "scan.h"
+#include "songarr.h"
+
+#define INDEX_MAGIC "REEDIDX"
+#define INDEX_VERSION 5 /* 5: several roots */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;  /* The root paths follow, each NUL-terminated, the
+                         * whole NUL-padded to 8 bytes */
+    uint64_t n_dirs;
+    uint64_t n_entries;
+    uint64_t pool_size;
+    char collate[COLLATE_NAME_MAX]; /* LC_COLLATE the entries are sorted by */
+} IndexHeader;
+
+#define ROOT_SPAN(len) (((uint64_t)(len) + 8) & ~(uint64_t)7)
+
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t roots_len(const char *const *roots, size_t n_roots)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < n_roots; i++) {
+        len += strlen(roots[i]) + 1;
+    }
+    return len;
+}
+
+static bool roots_match(const char *stored, const char *const *roots,
+                        size_t n_roots)
+{
+    for (size_t i = 0; i < n_roots; i++) {
+        size_t len = strlen(roots[i]) + 1;
+        if (memcmp(stored, roots[i], len) != 0) {
+            return false;
+        }
+        stored += len;
+    }
+    return true;
+}
+
+bool libindex_cache_path(const char *const *roots, size_t n_roots,
+                         const char *ext, char *buf, size_t size, bool create)
+{
+    char real[PATH_MAX];
+    char dir[PATH_MAX];
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg != NULL && xdg[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        return false;
+    }
+    if (create) {
+        (void)mkdir(dir, 0700);
+    }
+    size_t len = strlen(dir);
+    snprintf(dir + len, sizeof(dir) - len, "/reed");
+    if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        return false;
+    }
+
+    /* Entries store paths as spelled on the command line, so key on both.
+     * One root hashes as it always did: its caches stay valid. */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n_roots; i++) {
+        if (realpath(roots[i], real) == NULL) {
+            return false;
+        }
+        if (i > 0) {
+            h = fnv1a(h, "\n", 1);
+        }
+        h = fnv1a(h, real, strlen(real) + 1);
+        h = fnv1a(h, roots[i], strlen(roots[i]));
+    }
+    int n = snprintf(buf, size, "%s/%016llx.%s", dir, (unsigned long long)h,
+                     ext);
+    return n > 0 && (size_t)n < size;
+}
+
+static bool known_dir(const char *path, void *ctx)
+{
+    return songarr_find_dir(ctx, path) != SONGARR_NONE;
+}
+
+static bool index_valid(const IndexHeader *hdr, size_t map_len,
+                        const char *const *roots, size_t n_roots)
+{
+    if (map_len < sizeof(IndexHeader) ||
+        memcmp(hdr->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        hdr->version != INDEX_VERSION ||
+        hdr->root_len != roots_len(roots, n_roots) ||
+        hdr->n_dirs > UINT32_MAX || hdr->n_entries > map_len ||
+        hdr->pool_size > UINT32_MAX) {
+        return false;
+    }
+    uint64_t span = sizeof(IndexHeader) + ROOT_SPAN(hdr->root_len) +
+                    hdr->n_dirs * sizeof(SDir) +
+                    hdr->n_entries * sizeof(SFile) + hdr->pool_size;
+    if (span != map_len ||
+        !roots_match((const char *)(hdr + 1), roots, n_roots)) {
+        return false;
+    }
+
+    /* Bound every offset so lookups can never leave the mapping */
+    const SDir *dirs = (const SDir *)((const char *)(hdr + 1) +
+                                      ROOT_SPAN(hdr->root_len));
+    const SFile *ents = (const SFile *)(dirs + hdr->n_dirs);
+    const char *pool = (const char *)(ents + hdr->n_entries);
+    if (hdr->pool_size > 0 && pool[hdr->pool_size - 1] != '\0') {
+        return false;
+    }
+    for (uint64_t i = 0; i < hdr->n_dirs; i++) {
+        if ((uint64_t)dirs[i].path + dirs[i].len >= hdr->pool_size) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < hdr->n_entries; i++) {
+        if (ents[i].dir >= hdr->n_dirs || ents[i].name >= hdr->pool_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool revalidate(SongArr *songarr, int n_threads, bool *changed)
+{
+    /* Only directories whose mtime moved get read again */
+    SongArr *add = songarr_new();
+    SongArr *purge = songarr_new();
+    const char **roots = malloc((songarr->n_dirs + 1) * sizeof(char *));
+    size_t n_roots = 0;
+    bool ok = (add != NULL && purge != NULL && roots != NULL);
+
+    for (size_t i = 0; ok && i < songarr->n_dirs; i++) {
+        const SDir *d = &songarr->dirs[i];
+        const char *path = songarr_dirpath(songarr, (uint32_t)i);
+        struct stat st;
+        bool gone = (stat(path, &st) == -1 || !S_ISDIR(st.st_mode));
+        if (!gone && st.st_mtim.tv_sec == d->mtime_sec &&
+            st.st_mtim.tv_nsec == d->mtime_nsec) {
+            continue;
+        }
+        if (!gone) {
+            roots[n_roots++] = path;
+        }
+        struct timespec none = { 0, 0 };
+        ok = songarr_add_dir(purge, path, none, NULL);
+    }
+
+    *changed = (ok && purge->n_dirs > 0);
+    if (*changed) {
+        ScanOpts scan_opts = {
+            .n_threads = n_threads,
+            .skip_dir = known_dir,
+            .ctx = songarr,
+        };
+        SongArrDelta delta = { .add = add, .del = NULL, .purge = purge };
+        ok = scan_tree(roots, n_roots, &scan_opts, add) &&
+             songarr_apply(songarr, &delta, NULL);
+    }
+
+    if (add != NULL) {
+        songarr_destroy(add);
+    }
+    if (purge != NULL) {
+        songarr_destroy(purge);
+    }
+    free(roots);
+    return ok;
+}
+
+SongArr *libindex_load(const char *const *roots, size_t n_roots,
+                       int n_threads, bool *changed)
+{
+    char path[PATH_MAX];
+    if (!libindex_cache_path(roots, n_roots, "idx", path, sizeof(path),
+                             false)) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t map_len = st.st_size;
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const IndexHeader *hdr = map;
+    SongArr *songarr;
+    if (!index_valid(hdr, map_len, roots, n_roots) ||
+        (songarr = songarr_new()) == NULL) {
+        munmap(map, map_len);
+        return NULL;
+    }
+
+    /* Borrow everything: cap == 0 marks the arrays as not ours */
+    SDir *dirs = (SDir *)((char *)(hdr + 1) + ROOT_SPAN(hdr->root_len));
+    SFile *ents = (SFile *)(dirs + hdr->n_dirs);
+    songarr->dirs = dirs;
+    songarr->n_dirs = hdr->n_dirs;
+    songarr->arr = ents;
+    songarr->size = hdr->n_entries;
+    strpool_borrow(&songarr->pool, (const char *)(ents + hdr->n_entries),
+                   hdr->pool_size);
+    songarr->map = map;
+    songarr->map_len = map_len;
+
+    /* Lookups during revalidation rely on the current order */
+    bool resorted = false;
+    if (strncmp(hdr->collate, collate_name(), sizeof(hdr->collate)) != 0) {
+        if (!songarr_sort(songarr, n_threads)) {
+            songarr_destroy(songarr);
+            return NULL;
+        }
+        resorted = true;
+    }
+    if (!revalidate(songarr, n_threads, changed)) {
+        songarr_destroy(songarr);
+        return NULL;
+    }
+    *changed = *changed || resorted;
+    return songarr;
+}
+
+static bool write_all(FILE *fp, const void *buf, size_t len)
+{
+    return fwrite(buf, 1, len, fp) == len;
+}
+
+bool libindex_save(const char *const *roots, size_t n_roots,
+                   const SongArr *songarr)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 32];
+    if (!libindex_cache_path(roots, n_roots, "idx", path, sizeof(path),
+                             true)) {
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    IndexHeader hdr = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .root_len = (uint32_t)roots_len(roots, n_roots),
+        .n_dirs = songarr->n_dirs,
+        .n_entries = songarr->size,
+    };
+    strncpy(hdr.collate, collate_name(), sizeof(hdr.collate) - 1);
+    char pad[8] = {0};
+    bool ok = write_all(fp, &hdr, sizeof(hdr));
+    for (size_t i = 0; ok && i < n_roots; i++) {
+        ok = write_all(fp, roots[i], strlen(roots[i]) + 1);
+    }
+    ok = ok && write_all(fp, pad, ROOT_SPAN(hdr.root_len) - hdr.root_len);
+
+    /* Rewrite the pool in table order: drops strings left behind by
+     * removals and keeps neighbouring menu rows close in memory. */
+    uint64_t off = 0;
+    for (size_t i = 0; ok && i < songarr->n_dirs; i++) {
+        SDir d = songarr->dirs[i];
+        d.path = (uint32_t)off;
+        ok = write_all(fp, &d, sizeof(d));
+        off += d.len + 1;
+    }
+    for (size_t i = 0; ok && i < songarr->size; i++) {
+        SFile sf = { songarr->arr[i].dir, (uint32_t)off };
+        ok = write_all(fp, &sf, sizeof(sf));
+        off += strlen(songarr_name(songarr, i)) + 1;
+    }
+    ok = ok && off <= UINT32_MAX;
+    for (size_t i = 0; ok && i < songarr->n_dirs; i++) {
+        ok = write_all(fp, songarr_dirpath(songarr, (uint32_t)i),
+                       songarr->dirs[i].len + 1);
+    }
+    for (size_t i = 0; ok && i < songarr->size; i++) {
+        const char *s = songarr_name(songarr, i);
+        ok = write_all(fp, s, strlen(s) + 1);
+    }
+
+    hdr.pool_size = off;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && write_all(fp, &hdr, sizeof(hdr));
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmp, path) == -1) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+/* File: libindex.h
+ * Date: 2026-10-17
+ *
+ * Persistent, memory-mapped library index.
+ */
+
+#ifndef LIBINDEX_H
+#define LIBINDEX_H
+
+#include <stdbool.h>
+#include "songarr.h"
+
+/* Returns NULL when there is no usable index for these roots. *changed
+ * is set when directories had to be rescanned and the index should be
+ * saved. */
+SongArr *libindex_load(const char *const *roots, size_t n_roots,
+                       int n_threads, bool *changed);
+bool libindex_save(const char *const *roots, size_t n_roots,
+                   const SongArr *songarr);
+/* $XDG_CACHE_HOME/reed/<hash of roots>.<ext>, shared with other caches */
+bool libindex_cache_path(const char *const *roots, size_t n_roots,
+                         const char *ext, char *buf, size_t size, bool create);
+
+#endif
+
@@ -0,0 +1,167 @@
+/* File: loader.c
+ * Date: 2026-10-17
+ *
+ * Background library loader.
+ *
+ * One thread does what songarr_init() does at startup, so the UI never
+ * waits on it. A usable library index is handed over in one piece. Without
+ * one, the scanner's batch callback collects what the workers found into a
+ * single pending SongArr and signals an eventfd; the UI takes everything
+ * pending at once and merges it in sorted, so a slow merge only means
+ * bigger batches rather than a queue building up.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "libindex.h"
+#include "loader.h"
+#include "scan.h"
+#include "songarr.h"
+
+static struct Loader {
+    pthread_t thread;
+    bool started;
+    const char *const *roots;
+    size_t n_roots;
+    SongArrOpts opts;
+    int efd;
+
+    /* Shared with the loader and scanner threads */
+    pthread_mutex_t lock;
+    SongArr *pending;
+    bool whole;
+    bool done;
+    bool ok;
+    bool stop;
+    bool signalled;  /* efd was written and not read yet */
+} ld = { .efd = -1 };
+
+static void notify(void)
+{
+    /* Called with the lock held */
+    if (!ld.signalled) {
+        uint64_t one = 1;
+        if (write(ld.efd, &one, sizeof(one)) == sizeof(one)) {
+            ld.signalled = true;
+        }
+    }
+}
+
+static bool take_batch(SongArr *songs, void *ctx)
+{
+    (void)ctx;
+    pthread_mutex_lock(&ld.lock);
+    bool ok = !ld.stop;
+    if (ok && ld.pending == NULL) {
+        ld.pending = songs;
+        songs = NULL;
+    } else if (ok) {
+        ok = songarr_merge(ld.pending, songs);
+    }
+    if (ok) {
+        notify();
+    }
+    pthread_mutex_unlock(&ld.lock);
+    if (songs != NULL) {
+        songarr_destroy(songs);
+    }
+    return ok;
+}
+
+static void finish(SongArr *whole, bool ok)
+{
+    pthread_mutex_lock(&ld.lock);
+    if (whole != NULL) {
+        ld.pending = whole;
+        ld.whole = true;
+    }
+    ld.done = true;
+    ld.ok = ok;
+    notify();
+    pthread_mutex_unlock(&ld.lock);
+}
+
+static void *loader_main(void *arg)
+{
+    (void)arg;
+    bool changed = false;
+    SongArr *songarr = NULL;
+    if (!ld.opts.rescan) {
+        songarr = libindex_load(ld.roots, ld.n_roots, ld.opts.n_threads,
+                                &changed);
+    }
+    if (songarr != NULL) {
+        if (changed) {
+            /* Best effort: a missing index only costs a rescan next time */
+            (void)libindex_save(ld.roots, ld.n_roots, songarr);
+        }
+        finish(songarr, true);
+        return NULL;
+    }
+
+    ScanOpts scan_opts = {
+        .n_threads = ld.opts.n_threads,
+        .batch = take_batch,
+    };
+    finish(NULL, scan_tree(ld.roots, ld.n_roots, &scan_opts, NULL));
+    return NULL;
+}
+
+int loader_start(const char *const *roots, size_t n_roots,
+                 const SongArrOpts *opts)
+{
+    ld.roots = roots;
+    ld.n_roots = n_roots;
+    ld.opts = *opts;
+    ld.pending = NULL;
+    ld.whole = ld.done = ld.ok = ld.stop = ld.signalled = false;
+    ld.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ld.efd == -1) {
+        return -1;
+    }
+    pthread_mutex_init(&ld.lock, NULL);
+    if (pthread_create(&ld.thread, NULL, loader_main, NULL) != 0) {
+        pthread_mutex_destroy(&ld.lock);
+        close(ld.efd);
+        ld.efd = -1;
+        return -1;
+    }
+    ld.started = true;
+    return ld.efd;
+}
+
+void loader_take(LoadBatch *batch)
+{
+    uint64_t n;
+    (void)!read(ld.efd, &n, sizeof(n));
+    pthread_mutex_lock(&ld.lock);
+    batch->add = ld.pending;
+    batch->whole = ld.whole;
+    batch->done = ld.done;
+    batch->ok = ld.ok;
+    ld.pending = NULL;
+    ld.signalled = false;
+    pthread_mutex_unlock(&ld.lock);
+}
+
+void loader_stop(void)
+{
+    if (!ld.started) {
+        return;
+    }
+    pthread_mutex_lock(&ld.lock);
+    ld.stop = true; /* The scanner gives up at its next batch */
+    pthread_mutex_unlock(&ld.lock);
+    pthread_join(ld.thread, NULL);
+    if (ld.pending != NULL) {
+        songarr_destroy(ld.pending);
+        ld.pending = NULL;
+    }
+    pthread_mutex_destroy(&ld.lock);
+    close(ld.efd);
+    ld.efd = -1;
+    ld.started = false;
+}
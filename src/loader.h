@@ -0,0 +1,29 @@
+/* File: loader.h
+ * Date: 2026-10-17
+ *
+ * Background library loader.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "songarr.h"
+
+typedef struct {
+    SongArr *add;  /* Found since the last call (caller owns it), or NULL */
+    bool whole;    /* add is the complete library, from the index */
+    bool done;     /* Nothing more will come */
+    bool ok;       /* With done: false if reading the library failed */
+} LoadBatch;
+
+/* Returns an eventfd that becomes readable when loader_take() has something
+ * new, or -1. */
+int loader_start(const char *const *roots, size_t n_roots,
+                 const SongArrOpts *opts);
+void loader_take(LoadBatch *batch);
+/* Stops a scan still running and waits for the thread */
+void loader_stop(void);
+
+#endif
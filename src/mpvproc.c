@@ -1,152 +1,639 @@
 /* File: mpvproc.c
  * Date: 2026-02-04
  *
- * MPV process forking and communication.
+ * MPV process spawning and communication.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
-#include <sys/stat.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#include "json.h"
+#include "mpvproc.h"
+#include "stats.h"
 
-#define UDS_PATH "/tmp/mpv.sock"
-
-/* Based on MPV JSON-based IPC protocol */
-#define STR_PROP_EOF "\"event\":\"end-file\""
-#define STR_PROP_EOF_REASON "\"reason\":\"eof\""
+#define CONNECT_TIMEOUT_MS 1500 /* Only for --mpv-socket */
 
-#define CMD_PAUSE "{ \"command\": " \
-    "[\"cycle\", \"pause\"] }\n"
-#define CMD_LOAD  "{ \"command\": " \
-    "[\"loadfile\", \"%s\", \"replace\"] }\n"
-#define CMD_SEEK  "{ \"command\": " \
-    "[\"seek\", %d, \"relative\"] }\n"
-#define CMD_VOL   "{ \"command\": " \
-    "[\"add\", \"volume\", %d] }\n"
+#define RX_SIZE 65536   /* Power of two; longer messages are dropped */
+#define TX_SIZE 65536   /* Queued command bytes; more is refused */
+#define CMD_MAX 32768   /* One command, room for an escaped PATH_MAX */
+#define MAX_PENDING 64  /* Commands awaiting a reply callback */
+#define MAX_TOKENS 128
 
 struct ProcMPV {
     pid_t pid;
     int fd;
 } pmpv;
 
-static bool wait_for_socket(void)
+/* Bytes received from mpv and not yet handed out as events. head and tail
+ * only grow; they are reduced modulo RX_SIZE on access. */
+struct RxRing {
+    char buf[RX_SIZE];
+    size_t head;
+    size_t tail;
+    size_t scanned;     /* Bytes past head known to hold no newline */
+    bool discarding;    /* Skipping the rest of an oversized message */
+    char line[RX_SIZE]; /* The current message, made contiguous */
+} rx;
+
+/* Commands not yet accepted by the socket, sent in batches by mpv_flush() */
+struct TxRing {
+    char buf[TX_SIZE];
+    size_t head;
+    size_t tail;
+    int64_t next_id;
+    char cmd[CMD_MAX];  /* Scratch for formatting one command */
+} tx = { .next_id = 1 };
+
+/* Reply callbacks, slot request_id % MAX_PENDING */
+struct Pending {
+    int64_t id;
+    MPVReplyFn fn;
+    void *ctx;
+    int64_t timed_id;  /* Command whose queue time is in sent_ns, or 0 */
+    uint64_t sent_ns;
+} pending[MAX_PENDING];
+
+static bool spawn_mpv(const char *ipc_arg)
 {
-    struct stat st;
-    int timed_out = 0;
-    while (stat(UDS_PATH, &st) == -1) {
-        if (timed_out > 15) {
-            /* Give up after 1.5 seconds */
-            fprintf(stderr, "Failed to detect UDS.\n");
-            return false;
-        }
-        usleep(100000);
-        timed_out++;
+    /* Searched in PATH; whatever the caller left inheritable is passed on */
+    char *const argv[] = {
+        "mpv",
+        (char *)ipc_arg,
+        "--idle",
+        "--no-terminal",
+        "--gapless-audio=yes",
+        "--prefetch-playlist=yes",
+        NULL
+    };
+    int err = posix_spawnp(&pmpv.pid, "mpv", NULL, NULL, argv, environ);
+    if (err != 0) {
+        fprintf(stderr, "Error, unable to start MPV: %s\n", strerror(err));
+        pmpv.pid = -1;
+        return false;
     }
+    return true;
+}
 
+static bool init_socketpair(void)
+{
+    /* mpv gets one end as an already connected IPC client: no socket file,
+     * nothing to wait for, and commands can be queued right away. */
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        return false;
+    }
+    char arg[48];
+    snprintf(arg, sizeof(arg), "--input-ipc-client=fd://%d", sv[1]);
+
+    bool ok = fcntl(sv[1], F_SETFD, 0) != -1 && spawn_mpv(arg);
+    close(sv[1]);
+    if (!ok) {
+        close(sv[0]);
+        return false;
+    }
+    pmpv.fd = sv[0];
     return true;
 }
 
-static bool connect_to_mpv(void)
+static bool try_connect(const struct sockaddr_un *addr)
 {
-    pmpv.fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, UDS_PATH);
+    if (pmpv.fd == -1) {
+        pmpv.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (pmpv.fd == -1) {
+            return false;
+        }
+    }
+    return connect(pmpv.fd, (const struct sockaddr *)addr,
+                   sizeof(*addr)) == 0;
+}
 
-    int timed_out = 0;
-    while (connect(pmpv.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-        // Sleep until MPV is listening on the socket
-        if (timed_out > 15) {
-            /* Give up after 1.5 seconds */
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool wait_for_socket(int in_fd, const struct sockaddr_un *addr)
+{
+    /* Connects again whenever the directory changes. mpv binds before it
+     * listens, so a refused connect is retried after 1 ms; the 100 ms cap
+     * only matters when mpv dies without ever creating the socket. */
+    int64_t deadline = now_ms() + CONNECT_TIMEOUT_MS;
+    while (!try_connect(addr)) {
+        int err = errno;
+        int64_t left = deadline - now_ms();
+        if (waitpid(pmpv.pid, NULL, WNOHANG) == pmpv.pid) {
+            pmpv.pid = -1; /* Reaped, nothing left to terminate */
+            left = 0;
+        }
+        if ((err != ENOENT && err != ECONNREFUSED) || left <= 0) {
             fprintf(stderr, "Failed to connect to MPV\n");
             return false;
         }
-        usleep(100000);
-        timed_out++;
+        struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+        int timeout = (left < 100) ? (int)left : 100;
+        if (err == ECONNREFUSED) {
+            timeout = 1;
+        }
+        if (poll(&pfd, 1, timeout) > 0) {
+            char buf[4096];
+            while (read(in_fd, buf, sizeof(buf)) > 0) {
+                /* Drained: which entry changed does not matter */
+            }
+        }
     }
+    return true;
+}
 
+static bool socket_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "MPV socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
     return true;
 }
 
-void mpv_terminate(void)
+static bool clear_path(const struct sockaddr_un *addr)
 {
-    kill(pmpv.pid, SIGTERM);
-    close(pmpv.fd);
-}
-
-int mpv_init(void)
-{
-    pmpv.pid = fork();
-    
-    if (pmpv.pid == 0) {
-        execl(
-            "/usr/bin/mpv",
-            "mpv",
-            "--input-ipc-server=/tmp/mpv.sock",
-            "--idle",
-            "--no-terminal",
-            (char *) NULL
-        );
-        fprintf(stderr, "Error, unable to start MPV\n");
-        _exit(127); /* 127: Command not found in PATH */
+    /* A leftover socket must not be mistaken for this instance's, but a
+     * live one or anything that is not a socket is left alone */
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s: path exists and is not a socket\n",
+                addr->sun_path);
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return false;
+    }
+    bool live = connect(fd, (const struct sockaddr *)addr,
+                        sizeof(*addr)) == 0;
+    close(fd);
+    if (live) {
+        fprintf(stderr, "Something is already listening on %s\n",
+                addr->sun_path);
+        return false;
+    }
+    unlink(addr->sun_path);
+    return true;
+}
+
+static bool init_named_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr) || !clear_path(&addr)) {
+        return false;
+    }
+
+    /* Watch the directory first so the socket cannot appear unnoticed */
+    char dir[sizeof(addr.sun_path)];
+    strcpy(dir, path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
     } else {
-        if (!wait_for_socket()) {
-            return -1;
-        }
-        if (!connect_to_mpv()) {
-            return -1;
+        slash[slash == dir ? 1 : 0] = '\0';
+    }
+    int in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (in_fd == -1 || inotify_add_watch(in_fd, dir,
+                                         IN_CREATE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "Unable to watch %s\n", dir);
+        if (in_fd != -1) {
+            close(in_fd);
         }
+        return false;
+    }
+
+    char arg[sizeof(addr.sun_path) + 32];
+    snprintf(arg, sizeof(arg), "--input-ipc-server=%s", path);
+    bool ok = spawn_mpv(arg) && wait_for_socket(in_fd, &addr);
+    close(in_fd);
+    return ok;
+}
+
+void mpv_terminate(void)
+{
+    if (pmpv.pid > 0) {
+        kill(pmpv.pid, SIGTERM);
+        waitpid(pmpv.pid, NULL, 0);
+    }
+    if (pmpv.fd != -1) {
+        close(pmpv.fd);
+    }
+}
+
+int mpv_init(const char *socket_path)
+{
+    /* socket_path: NULL for a private socketpair, otherwise mpv listens
+     * there as well (for scripts or other clients). */
+    pmpv.pid = -1;
+    pmpv.fd = -1;
+    bool ok = (socket_path == NULL) ? init_socketpair()
+                                    : init_named_socket(socket_path);
+    if (!ok) {
+        mpv_terminate();
+        return -1;
     }
+    return pmpv.fd;
+}
 
+int mpv_connect(const char *path)
+{
+    /* An IPC server started by someone else (an mpv, tools/mockmpv); it is
+     * left running on exit */
+    pmpv.pid = -1;
+    pmpv.fd = -1;
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr)) {
+        return -1;
+    }
+    if (!try_connect(&addr)) {
+        fprintf(stderr, "Failed to connect to MPV at %s: %s\n", path,
+                strerror(errno));
+        mpv_terminate();
+        return -1;
+    }
     return pmpv.fd;
 }
 
-void mpv_load_song(const char *path)
+int mpv_attach(int fd)
+{
+    /* Talks over a socket that is already connected to an mpv IPC server
+     * (or anything speaking its protocol); no process is started. */
+    pmpv.pid = -1;
+    pmpv.fd = fd;
+    return fd;
+}
+
+static int64_t queue_command(MPVReplyFn fn, void *ctx, bool named,
+                             const char *fmt, va_list ap)
+{
+    /* Queues { "command": [fmt...], "request_id": N }, or with named
+     * arguments { "command": {fmt...}, ... }. Returns N, or 0 if the
+     * command was refused because mpv is not keeping up. Nothing is
+     * written until mpv_flush(). */
+    int64_t id = tx.next_id;
+    struct Pending *p = &pending[id % MAX_PENDING];
+    if (fn != NULL && p->fn != NULL) {
+        return 0;
+    }
+
+    int len = snprintf(tx.cmd, sizeof(tx.cmd), "{ \"command\": %c",
+                       named ? '{' : '[');
+    len += vsnprintf(tx.cmd + len, sizeof(tx.cmd) - len, fmt, ap);
+    if (len < (int)sizeof(tx.cmd)) {
+        len += snprintf(tx.cmd + len, sizeof(tx.cmd) - len,
+                        "%c, \"request_id\": %lld }\n", named ? '}' : ']',
+                        (long long)id);
+    }
+    if (len >= (int)sizeof(tx.cmd) ||
+        (size_t)len > TX_SIZE - (tx.tail - tx.head)) {
+        return 0;
+    }
+
+    size_t at = tx.tail % TX_SIZE;
+    size_t first = (TX_SIZE - at < (size_t)len) ? TX_SIZE - at : (size_t)len;
+    memcpy(tx.buf + at, tx.cmd, first);
+    memcpy(tx.buf, tx.cmd + first, len - first);
+    tx.tail += len;
+    tx.next_id++;
+    if (fn != NULL) {
+        *p = (struct Pending){ id, fn, ctx, 0, 0 };
+    }
+    if (stats_enabled) {
+        p->timed_id = id;
+        p->sent_ns = stats_now();
+    }
+    return id;
+}
+
+int64_t mpv_command(MPVReplyFn fn, void *ctx, const char *fmt, ...)
 {
-    char buf[1024];
-    snprintf(buf, sizeof(buf), CMD_LOAD, path);
-    write(pmpv.fd, buf, strlen(buf));
+    va_list ap;
+    va_start(ap, fmt);
+    int64_t id = queue_command(fn, ctx, false, fmt, ap);
+    va_end(ap);
+    return id;
 }
 
-void mpv_cycle_pause(void)
+static int64_t mpv_command_named(MPVReplyFn fn, void *ctx, const char *fmt,
+                                 ...)
 {
-    write(pmpv.fd, CMD_PAUSE, strlen(CMD_PAUSE));
+    va_list ap;
+    va_start(ap, fmt);
+    int64_t id = queue_command(fn, ctx, true, fmt, ap);
+    va_end(ap);
+    return id;
 }
 
-void mpv_seek(int time)
+bool mpv_flush(void)
 {
-    char buf[1024];
-    snprintf(buf, sizeof(buf), CMD_SEEK, time);
-    write(pmpv.fd, buf, strlen(buf));
+    /* Hands every queued command to the socket, normally in one call.
+     * Returns false only when mpv has gone away. */
+    while (tx.head != tx.tail) {
+        size_t used = tx.tail - tx.head;
+        size_t at = tx.head % TX_SIZE;
+        size_t first = (TX_SIZE - at < used) ? TX_SIZE - at : used;
+        struct iovec iov[2] = {
+            { tx.buf + at, first },
+            { tx.buf, used - first },
+        };
+        struct msghdr msg = { .msg_iov = iov,
+                              .msg_iovlen = iov[1].iov_len ? 2 : 1 };
+
+        ssize_t n = sendmsg(pmpv.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        tx.head += (size_t)n;
+    }
+    return true;
+}
+
+bool mpv_write_pending(void)
+{
+    /* True while commands wait for the socket to become writable */
+    return tx.head != tx.tail;
 }
 
-void mpv_volume(int vol)
+int64_t mpv_load_song(const char *path, MPVReplyFn fn, void *ctx)
 {
-    char buf[1024];
-    snprintf(buf, sizeof(buf), CMD_VOL, vol);
-    write(pmpv.fd, buf, strlen(buf));
+    char esc[CMD_MAX - 64];
+    if (json_escape(path, esc, sizeof(esc)) >= sizeof(esc)) {
+        return 0;
+    }
+    return mpv_command(fn, ctx, "\"loadfile\", \"%s\", \"replace\"", esc);
 }
 
-typedef enum {
-    PROP_NONE,
-    PROP_EOF,
-} MPVProp;
+int64_t mpv_load_song_at(const char *path, double start, MPVReplyFn fn,
+                         void *ctx)
+{
+    /* Per-file options moved from the third to the fourth argument in mpv
+     * 0.38; by name they are found in every version */
+    if (start <= 0) {
+        return mpv_load_song(path, fn, ctx);
+    }
+    char esc[CMD_MAX - 128];
+    if (json_escape(path, esc, sizeof(esc)) >= sizeof(esc)) {
+        return 0;
+    }
+    return mpv_command_named(fn, ctx, "\"name\": \"loadfile\", "
+                             "\"url\": \"%s\", \"flags\": \"replace\", "
+                             "\"options\": \"start=%.3f\"", esc, start);
+}
+
+int64_t mpv_queue_song(const char *path)
+{
+    /* Appended after the current entry: with --prefetch-playlist mpv opens
+     * it ahead of time and moves on without a gap */
+    char esc[CMD_MAX - 64];
+    if (json_escape(path, esc, sizeof(esc)) >= sizeof(esc)) {
+        return 0;
+    }
+    return mpv_command(NULL, NULL, "\"loadfile\", \"%s\", \"append\"", esc);
+}
+
+int64_t mpv_playlist_clear(void)
+{
+    /* Drops every entry but the one playing */
+    return mpv_command(NULL, NULL, "\"playlist-clear\"");
+}
 
-MPVProp mpv_property(int fd)
+int64_t mpv_cycle_pause(void)
 {
-    char haystack[4096];
-    ssize_t n = read(fd, haystack, sizeof(haystack)-1);
-    if (n > 0) {
-        haystack[n] = '\0';
-        if (strstr(haystack, STR_PROP_EOF) &&
-            strstr(haystack, STR_PROP_EOF_REASON)) {
-            return PROP_EOF;
+    return mpv_command(NULL, NULL, "\"cycle\", \"pause\"");
+}
+
+int64_t mpv_seek(int time)
+{
+    return mpv_command(NULL, NULL, "\"seek\", %d, \"relative\"", time);
+}
+
+int64_t mpv_volume(int vol)
+{
+    return mpv_command(NULL, NULL, "\"add\", \"volume\", %d", vol);
+}
+
+int64_t mpv_observe(int id, const char *name)
+{
+    /* Changes arrive as MPV_EVENT_PROPERTY events carrying id */
+    return mpv_command(NULL, NULL, "\"observe_property\", %d, \"%s\"",
+                       id, name);
+}
+
+int mpv_read_events(void)
+{
+    /* Moves whatever the socket holds into the ring. Returns the number of
+     * bytes read, 0 if none were available, -1 once mpv has gone away. */
+    size_t used = rx.tail - rx.head;
+    if (used == RX_SIZE) {
+        /* A full ring without a newline is one oversized message, or more
+         * of the one being dropped. If there is a newline, the caller still
+         * has events to take first. */
+        if (rx.scanned < used) {
+            return 0;
         }
+        rx.discarding = true;
+        rx.head = rx.tail;
+        rx.scanned = 0;
+        used = 0;
+    }
+
+    size_t at = rx.tail % RX_SIZE;
+    size_t room = RX_SIZE - used;
+    size_t first = RX_SIZE - at;
+    if (first > room) {
+        first = room;
     }
-    return PROP_NONE;
+    struct iovec iov[2] = {
+        { rx.buf + at, first },
+        { rx.buf, room - first },
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iov[1].iov_len ? 2 : 1 };
+
+    ssize_t n = recvmsg(pmpv.fd, &msg, MSG_DONTWAIT);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+               ? 0 : -1;
+    }
+    rx.tail += (size_t)n;
+    return (int)n;
 }
 
+static bool next_line(size_t *len)
+{
+    /* Copies the next complete message into rx.line */
+    for (;;) {
+        size_t used = rx.tail - rx.head;
+        const char *nl = NULL;
+        while (rx.scanned < used && nl == NULL) {
+            size_t at = (rx.head + rx.scanned) % RX_SIZE;
+            size_t span = RX_SIZE - at;
+            if (span > used - rx.scanned) {
+                span = used - rx.scanned;
+            }
+            nl = memchr(rx.buf + at, '\n', span);
+            rx.scanned += (nl != NULL) ? (size_t)(nl - (rx.buf + at)) : span;
+        }
+        if (nl == NULL) {
+            return false;
+        }
+
+        size_t n = rx.scanned;
+        if (!rx.discarding) {
+            size_t at = rx.head % RX_SIZE;
+            size_t first = (RX_SIZE - at < n) ? RX_SIZE - at : n;
+            memcpy(rx.line, rx.buf + at, first);
+            memcpy(rx.line + first, rx.buf, n - first);
+        }
+        rx.head += n + 1;
+        rx.scanned = 0;
+        if (rx.discarding) {
+            rx.discarding = false;
+            continue;
+        }
+        *len = n;
+        return true;
+    }
+}
+
+static MPVEndReason end_reason(const char *js, const JsonTok *tok)
+{
+    static const char *const names[] = {
+        [END_EOF] = "eof",
+        [END_STOP] = "stop",
+        [END_QUIT] = "quit",
+        [END_ERROR] = "error",
+        [END_REDIRECT] = "redirect",
+    };
+    for (int i = 0; i < END_UNKNOWN; i++) {
+        if (json_eq(js, tok, names[i])) {
+            return (MPVEndReason)i;
+        }
+    }
+    return END_UNKNOWN;
+}
+
+static void read_data(const char *js, const JsonTok *tok, MPVEvent *ev)
+{
+    if (tok->type == JSON_STRING) {
+        /* Over-long strings are kept truncated */
+        json_string(js, tok, ev->str, sizeof(ev->str));
+        ev->data_type = MPV_DATA_STRING;
+    } else if (json_number(js, tok, &ev->num)) {
+        ev->data_type = MPV_DATA_NUMBER;
+    } else if (json_bool(js, tok, &ev->flag)) {
+        ev->data_type = MPV_DATA_FLAG;
+    } else if (tok->type != JSON_PRIMITIVE) {
+        ev->data_type = MPV_DATA_OTHER;
+    }
+}
+
+static bool parse_event(const char *js, size_t len, MPVEvent *ev)
+{
+    JsonTok toks[MAX_TOKENS];
+    int n = json_parse(js, len, toks, MAX_TOKENS);
+    if (n < 1 || toks[0].type != JSON_OBJECT) {
+        return false;
+    }
+
+    memset(ev, 0, offsetof(MPVEvent, str));
+    ev->str[0] = '\0';
+    double num;
+    int t;
+
+    if ((t = json_find(js, toks, n, 0, "event")) != -1) {
+        json_string(js, &toks[t], ev->name, sizeof(ev->name));
+        if (json_eq(js, &toks[t], "end-file")) {
+            ev->type = MPV_EVENT_END_FILE;
+            t = json_find(js, toks, n, 0, "reason");
+            ev->reason = (t != -1) ? end_reason(js, &toks[t]) : END_UNKNOWN;
+        } else if (json_eq(js, &toks[t], "property-change")) {
+            ev->type = MPV_EVENT_PROPERTY;
+            t = json_find(js, toks, n, 0, "name");
+            if (t == -1) {
+                return false;
+            }
+            json_string(js, &toks[t], ev->name, sizeof(ev->name));
+            if ((t = json_find(js, toks, n, 0, "id")) != -1 &&
+                json_number(js, &toks[t], &num)) {
+                ev->id = (int64_t)num;
+            }
+        } else {
+            ev->type = MPV_EVENT_OTHER;
+        }
+    } else if ((t = json_find(js, toks, n, 0, "error")) != -1) {
+        ev->type = MPV_EVENT_REPLY;
+        ev->ok = json_eq(js, &toks[t], "success");
+        if ((t = json_find(js, toks, n, 0, "request_id")) != -1 &&
+            json_number(js, &toks[t], &num)) {
+            ev->id = (int64_t)num;
+        }
+    } else {
+        return false;
+    }
+
+    if ((t = json_find(js, toks, n, 0, "data")) != -1) {
+        read_data(js, &toks[t], ev);
+    }
+    return true;
+}
+
+bool mpv_next_event(MPVEvent *ev)
+{
+    /* Takes the next buffered event; false when a read is needed */
+    size_t len;
+    while (next_line(&len)) {
+        if (!parse_event(rx.line, len, ev)) {
+            continue;
+        }
+        if (ev->type == MPV_EVENT_REPLY && ev->id > 0) {
+            /* Replies with a callback are delivered there, not returned */
+            struct Pending *p = &pending[ev->id % MAX_PENDING];
+            if (p->timed_id == ev->id) {
+                stats_since(STAT_IPC_REPLY, p->sent_ns);
+                p->timed_id = 0;
+            }
+            if (p->fn != NULL && p->id == ev->id) {
+                struct Pending done = *p;
+                p->fn = NULL;
+                done.fn(ev, done.ctx);
+                continue;
+            }
+        }
+        return true;
+    }
+    return false;
+}
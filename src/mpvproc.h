@@ -1,24 +1,76 @@
 /* File: mpvproc.h
  * Date: 2026-02-04
  *
- * MPV process forking and communication.
+ * MPV process spawning and communication.
  */
 
 #ifndef MPVPROC_H
 #define MPVPROC_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MPV_NAME_MAX 64
+#define MPV_STR_MAX 4096 /* Fits a PATH_MAX path */
+
+typedef enum {
+    MPV_EVENT_END_FILE,
+    MPV_EVENT_PROPERTY,   /* property-change from observe_property */
+    MPV_EVENT_REPLY,      /* Reply to a command */
+    MPV_EVENT_OTHER,      /* Any other event, by name */
+} MPVEventType;
+
 typedef enum {
-    PROP_NONE,
-    PROP_EOF,
-} MPVProp;
+    END_EOF,
+    END_STOP,
+    END_QUIT,
+    END_ERROR,
+    END_REDIRECT,
+    END_UNKNOWN,
+} MPVEndReason;
+
+typedef enum {
+    MPV_DATA_NONE,        /* Absent or null */
+    MPV_DATA_NUMBER,
+    MPV_DATA_FLAG,
+    MPV_DATA_STRING,
+    MPV_DATA_OTHER,       /* Object or array, not decoded */
+} MPVDataType;
+
+typedef struct {
+    MPVEventType type;
+    char name[MPV_NAME_MAX];  /* Event or property name */
+    MPVEndReason reason;      /* END_FILE */
+    int64_t id;               /* Observer id (PROPERTY), request_id (REPLY) */
+    bool ok;                  /* REPLY: error was "success" */
+    MPVDataType data_type;
+    double num;
+    bool flag;
+    char str[MPV_STR_MAX];
+} MPVEvent;
+
+typedef void (*MPVReplyFn)(const MPVEvent *reply, void *ctx);
 
-int mpv_init(void);
+int mpv_init(const char *socket_path);
+int mpv_connect(const char *path);
+int mpv_attach(int fd);
 void mpv_terminate(void);
-void mpv_load_song(const char *path);
-void mpv_cycle_pause(void);
-void mpv_seek(int time);
-void mpv_volume(int vol);
-MPVProp mpv_property(int fd);
+int64_t mpv_command(MPVReplyFn fn, void *ctx, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+bool mpv_flush(void);
+bool mpv_write_pending(void);
+int64_t mpv_load_song(const char *path, MPVReplyFn fn, void *ctx);
+/* Starts start seconds in, as when resuming a session */
+int64_t mpv_load_song_at(const char *path, double start, MPVReplyFn fn,
+                         void *ctx);
+int64_t mpv_queue_song(const char *path);
+int64_t mpv_playlist_clear(void);
+int64_t mpv_cycle_pause(void);
+int64_t mpv_seek(int time);
+int64_t mpv_volume(int vol);
+int64_t mpv_observe(int id, const char *name);
+int mpv_read_events(void);
+bool mpv_next_event(MPVEvent *ev);
 
 #endif
 
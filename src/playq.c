@@ -0,0 +1,126 @@
+/* File: playq.c
+ * Date: 2026-10-17
+ *
+ * Play queue: songs picked to play next, ahead of autoplay and shuffle.
+ *
+ * A ring buffer that doubles when full: pushing and popping at either end,
+ * indexing and swapping two entries are all O(1), so the queue stays as
+ * quick to edit with tens of thousands of entries as with a few.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "playq.h"
+
+#define MIN_CAP 16
+
+static inline size_t slot(const PlayQueue *q, size_t i)
+{
+    return (q->head + i) & (q->cap - 1);
+}
+
+static bool grow(PlayQueue *q)
+{
+    if (q->len < q->cap) {
+        return true;
+    }
+    size_t cap = q->cap > 0 ? q->cap * 2 : MIN_CAP;
+    uint32_t *items = malloc(cap * sizeof(*items));
+    if (items == NULL) {
+        return false;
+    }
+    /* Unwrap: the oldest entry moves to the start */
+    size_t first = q->cap - q->head;
+    if (first > q->len) {
+        first = q->len;
+    }
+    if (q->len > 0) {
+        memcpy(items, q->items + q->head, first * sizeof(*items));
+        memcpy(items + first, q->items, (q->len - first) * sizeof(*items));
+    }
+    free(q->items);
+    q->items = items;
+    q->head = 0;
+    q->cap = cap;
+    return true;
+}
+
+void playq_clear(PlayQueue *q)
+{
+    free(q->items);
+    *q = (PlayQueue){0};
+}
+
+bool playq_push_back(PlayQueue *q, size_t song)
+{
+    if (!grow(q)) {
+        return false;
+    }
+    q->items[slot(q, q->len)] = (uint32_t)song;
+    q->len++;
+    return true;
+}
+
+bool playq_push_front(PlayQueue *q, size_t song)
+{
+    if (!grow(q)) {
+        return false;
+    }
+    q->head = (q->head - 1) & (q->cap - 1);
+    q->items[q->head] = (uint32_t)song;
+    q->len++;
+    return true;
+}
+
+size_t playq_pop_front(PlayQueue *q)
+{
+    if (q->len == 0) {
+        return PLAYQ_NONE;
+    }
+    size_t song = q->items[q->head];
+    q->head = slot(q, 1);
+    q->len--;
+    return song;
+}
+
+void playq_swap(PlayQueue *q, size_t i, size_t j)
+{
+    if (i >= q->len || j >= q->len) {
+        return;
+    }
+    uint32_t tmp = q->items[slot(q, i)];
+    q->items[slot(q, i)] = q->items[slot(q, j)];
+    q->items[slot(q, j)] = tmp;
+}
+
+void playq_remove(PlayQueue *q, size_t i)
+{
+    if (i >= q->len) {
+        return;
+    }
+    if (i < q->len / 2) {
+        /* Entries before i step back, the head follows */
+        for (size_t k = i; k > 0; k--) {
+            q->items[slot(q, k)] = q->items[slot(q, k - 1)];
+        }
+        q->head = slot(q, 1);
+    } else {
+        for (size_t k = i; k + 1 < q->len; k++) {
+            q->items[slot(q, k)] = q->items[slot(q, k + 1)];
+        }
+    }
+    q->len--;
+}
+
+void playq_remap(PlayQueue *q, const size_t *remap)
+{
+    /* Compacted in place, order kept */
+    size_t k = 0;
+    for (size_t i = 0; i < q->len; i++) {
+        size_t to = remap[q->items[slot(q, i)]];
+        if (to != PLAYQ_NONE) {
+            q->items[slot(q, k++)] = (uint32_t)to;
+        }
+    }
+    q->len = k;
+}
@@ -0,0 +1,46 @@
+/* File: playq.h
+ * Date: 2026-10-17
+ *
+ * Play queue: songs picked to play next, ahead of autoplay and shuffle.
+ */
+
+#ifndef PLAYQ_H
+#define PLAYQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PLAYQ_NONE ((size_t)-1)
+
+/* Ring buffer of song indices; cap is zero or a power of two */
+typedef struct {
+    uint32_t *items;
+    size_t head;
+    size_t len;
+    size_t cap;
+} PlayQueue;
+
+static inline size_t playq_size(const PlayQueue *q)
+{
+    return q->len;
+}
+
+static inline size_t playq_at(const PlayQueue *q, size_t i)
+{
+    return i < q->len ? q->items[(q->head + i) & (q->cap - 1)] : PLAYQ_NONE;
+}
+
+void playq_clear(PlayQueue *q);
+/* False when out of memory */
+bool playq_push_back(PlayQueue *q, size_t song);
+bool playq_push_front(PlayQueue *q, size_t song);
+/* Song taken off the front, or PLAYQ_NONE */
+size_t playq_pop_front(PlayQueue *q);
+void playq_swap(PlayQueue *q, size_t i, size_t j);
+/* Moves the shorter side of the ring, so at most len/2 entries */
+void playq_remove(PlayQueue *q, size_t i);
+/* Songs were renumbered by remap (PLAYQ_NONE: removed) */
+void playq_remap(PlayQueue *q, const size_t *remap);
+
+#endif
@@ -4,17 +4,39 @@
  * TUI implementation with ncurses.
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <locale.h>
 #include <ncurses.h>
 #include <poll.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "collate.h"
+#include "ctl.h"
+#include "dupes.h"
+#include "json.h"
+#include "libindex.h"
+#include "loader.h"
 #include "mpvproc.h"
+#include "playq.h"
+#include "search.h"
+#include "session.h"
+#include "shuffle.h"
+#include "stats.h"
 #include "songarr.h"
+#include "tags.h"
+#include "tree.h"
+#include "watch.h"
 
 #define TITLE_MENU "> Songs <"
 #define SUBTITLE_MENU "> ('q' - quit) reed 0.5.0 <"
@@ -24,64 +46,300 @@
 #define LOOP_RUN 1
 #define LOOP_STOP 0
 
+enum {
+    FD_MPV,
+    FD_STDIN,
+    FD_WATCH,
+    FD_TIMER,
+    FD_TAGS,
+    FD_LOAD,
+    FD_CTL,
+    FD_DUPES,
+    N_FDS,
+};
+
+/* observe_property ids */
+enum {
+    OBS_TIME_POS = 1,
+    OBS_DURATION,
+    OBS_VOLUME,
+    OBS_PATH,
+};
+
 bool songarr_initialized = false;
+bool loader_initialized = false;
+bool watch_initialized = false;
+bool tags_initialized = false;
+bool tree_initialized = false;
 bool player_initialized = false;
 bool mpv_initialized = false;
+bool mpv_lost = false;
 bool ncurses_initialized = false;
 
+struct Options {
+    const char **roots;      /* Library roots, none inside another */
+    size_t n_roots;
+    SongArrOpts lib;
+    int fps;
+    bool render_stats;
+    const char *mpv_socket; /* NULL: private socketpair */
+    const char *mpv_connect; /* Use this running IPC server instead */
+    const char *stats_path;  /* Latency histograms are written here */
+    uint64_t seed;           /* Shuffle order, from --seed or the clock */
+    bool seeded;
+    bool daemon;             /* No terminal: clients of the socket only */
+    const char *control_path; /* NULL: $XDG_RUNTIME_DIR/reed.sock */
+    const char *attach;      /* Only relay the terminal to this socket */
+} opts = {
+    .roots = NULL,
+    .n_roots = 0,
+    .lib = { .n_threads = 0, .rescan = false },
+    .fps = 4,
+    .render_stats = false,
+    .mpv_socket = NULL,
+    .mpv_connect = NULL,
+    .stats_path = NULL,
+    .seeded = false,
+};
+
 volatile sig_atomic_t running = LOOP_RUN;
 SongArr *songarr;
-struct pollfd fds[2];
+struct pollfd fds[N_FDS];
 
 struct PlayerState {
     bool playing;
     bool paused;
     bool autoplay;
     bool shuffle;
-    int *order;
-    int shuffle_idx;
+    Shuffle order;    /* Drawn as the round goes */
+    int shuffle_idx;  /* Position of the current song in order */
     int curr_idx;
+    int list_idx;     /* Library row autoplay and ','/'.' go on from */
+    PlayQueue playq;  /* Songs picked to play next, before anything else */
+    int64_t load_id;  /* Request of the latest loadfile */
+    bool loading;     /* Its reply has not arrived yet */
+    int queued;       /* Song waiting after the current one in mpv, or -1 */
     char curr_track[MAX_SONGTITLE_LEN+1];
 } player = {
     .paused = false,
     .autoplay = false,
     .shuffle = false,
+    .list_idx = -1,
+    .queued = -1,
     .curr_track[0] = '\0'
 };
 
+/* Playback position, drawn at most once per frame from the timer */
+struct Progress {
+    int fd;
+    bool armed;
+    long long period_ns;
+    long long last_ns;  /* Last time the progress line was drawn */
+    double time_pos;
+    double duration;
+    double volume;      /* -1 until mpv reports it */
+} progress = { .fd = -1, .volume = -1 };
+
 typedef struct {
     int y, x;
 } RowCol;
 
+/* What the menu lists */
+typedef enum {
+    MENU_SONGS,
+    MENU_TREE,   /* Directories instead of songs */
+    MENU_QUEUE,  /* The play queue */
+    N_MENUS,
+} MenuMode;
+
+/* shown[] values besides song indices */
+#define ROW_BLANK -1
+#define ROW_STALE -2
+
 typedef struct {
     WINDOW *w;
     RowCol max;
     int offset_idx;
+    /* What is on screen: song per row and the footer text. Drawing only
+     * touches rows that no longer match. */
+    int *shown;
+    int n_shown;
+    bool stale;
+    char footer[MAX_SONGTITLE_LEN];
 } Menu;
 
 typedef struct {
     WINDOW *w;
     RowCol max;
+    /* What is on screen, field by field */
+    bool stale;
+    bool playing;
+    bool paused;
+    int mode;       /* 0 none, 1 autoplay, 2 shuffle */
+    char track[MAX_SONGTITLE_LEN+1];
+    char progress[MAX_SONGTITLE_LEN];
 } View;
 
 struct UI {
     Menu menu;
     View view;
+    WINDOW *input;   /* Keys are read here, so wgetch never refreshes */
     RowCol max;
     RowCol curs;
-} ui = { .curs = {1, 2}, .menu.offset_idx = 0 };
+    bool searching;  /* Keys go to the search query */
+    bool stats_shown; /* Latency overlay in the viewer */
+    MenuMode mode;
+    MenuMode back;   /* Where the queue view returns to */
+    RowCol place[N_MENUS]; /* Cursor row and offset of each list */
+} ui = {
+    .curs = {1, 2},
+    .menu = { .offset_idx = 0, .stale = true },
+    .view = { .stale = true },
+    .searching = false,
+    .mode = MENU_SONGS,
+    .place = { {1, 0}, {1, 0}, {1, 0} },
+};
 
-bool player_init(size_t n_songs)
+/* Bytes sent to the terminal, from the write counter of the main thread
+ * (curses writes straight to the tty, so only the kernel sees them all) */
+struct RenderStats {
+    int io_fd;
+    unsigned long long bytes;
+    unsigned long long frames;
+    unsigned long long max_frame;
+} render = { .io_fd = -1 };
+
+/* Latency bookkeeping for stats.h, untouched while it is disabled */
+struct WakeStats {
+    uint64_t key_ns;    /* Wakeup that brought keys, until they are drawn */
+    uint64_t events;    /* Handled since the last poll() returned */
+} wake;
+
+/* The library fills in while the loader runs */
+struct LoadState {
+    bool loading;
+    bool scanned;   /* Not from the index: write one once complete */
+    bool failed;
+} load;
+
+/* While a query is set the menu lists its matches instead of the library */
+Search search;
+
+#define RELABEL_SETTLE_NS (250 * 1000000LL)
+#define RELABEL_MAX_NS (2 * 1000000000LL)
+
+/* Tags arriving during a search change the labels it matched: the query
+ * runs again once they settle, not for every batch */
+struct RelabelState {
+    bool due;
+    long long first_ns;
+    long long last_ns;
+} relabel;
+
+#define SESSION_PERIOD_NS (15 * 1000000000LL)
+
+/* The session file: restored at start, saved on exit and while playing */
+struct SessionState {
+    bool ready;         /* Everything a save reads is set up */
+    Session saved;      /* Read at start, applied once the library is in */
+    bool pending;       /* saved is still waiting for the library */
+    bool resumed;       /* Its track plays, nothing else was picked since */
+    bool dirty;
+    long long saved_ns;
+    uint64_t lib_hash;
+    bool hash_stale;
+} sess = { .hash_stale = true };
+
+/* Songs with the same content as another: listed once unless shown */
+struct DupesState {
+    bool on;
+    bool show;
+    bool running;       /* A pass was started on the library as it is */
+    unsigned library;   /* The library generation it was started on */
+    SongArr *hidden;    /* Every duplicate, listed or not */
+} dupes;
+
+#define CONTROL_VERSION 1
+#define CONTROL_LINE_MAX 8192
+
+/* Player state as control clients see it */
+typedef struct {
+    size_t songs;
+    unsigned library;   /* Bumped whenever song indices move */
+    bool loading;
+    bool playing;
+    bool paused;
+    bool autoplay;
+    bool shuffle;
+    int song;           /* Library row, -1 for none */
+    long time;          /* Whole seconds */
+    long duration;
+    int volume;         /* -1 until mpv reports it */
+    size_t queue;
+    size_t dupes;       /* Duplicates found, listed or not */
+    bool dupes_shown;
+    char track[MAX_SONGTITLE_LEN+1];
+} Shared;
+
+/* The control socket: every client is sent what changed since told */
+struct ControlState {
+    bool on;
+    unsigned library;
+    Shared told;
+} control;
+
+size_t menu_size(void)
 {
-    player.order = malloc(n_songs * sizeof(int));
-    if (player.order == NULL) {
-        fprintf(stderr, "Failed to allocate player.order array\n");
-        return false;
+    if (ui.mode == MENU_TREE) {
+        return tree_size();
+    } else if (ui.mode == MENU_QUEUE) {
+        return playq_size(&player.playq);
+    }
+    return search.len > 0 ? search.n_ranked : songarr->size;
+}
+
+int menu_song(int row)
+{
+    /* Song index shown on a menu row (0-based, offset included) */
+    if (row < 0 || (size_t)row >= menu_size()) {
+        return -1;
     }
+    return search.len > 0 ? (int)search.ranked[row] : row;
+}
+
+int menu_item(int row)
+{
+    /* What a menu row shows: a song index, or a tree node in the tree view */
+    if (ui.mode == MENU_QUEUE) {
+        size_t song = row >= 0 ? playq_at(&player.playq, row) : PLAYQ_NONE;
+        return song != PLAYQ_NONE ? (int)song : -1;
+    } else if (ui.mode != MENU_TREE) {
+        return menu_song(row);
+    }
+    TreeRow tr;
+    if (row < 0 || !tree_row(row, &tr)) {
+        return -1;
+    }
+    return (int)tr.node;
+}
 
-    for (int i = 0; i < (int)n_songs; i++) {
-        player.order[i] = i;
+size_t tree_song(size_t row)
+{
+    /* Library index of the file on a tree row, or SONGARR_NONE */
+    TreeRow tr;
+    char dir[PATH_MAX];
+    if (!tree_row(row, &tr) || tr.is_dir ||
+        tree_dirpath(row, dir, sizeof(dir)) >= sizeof(dir)) {
+        return SONGARR_NONE;
     }
+    return songarr_find(songarr, dir, tr.name);
+}
+
+bool player_init(size_t n_songs)
+{
+    /* Nothing to allocate: the order grows as songs are drawn */
+    shuffle_init(&player.order, opts.seed);
+    shuffle_restart(&player.order, n_songs);
     return true;
 }
 
@@ -97,6 +355,7 @@ bool ui_init_core(void)
         return false;
     }
     (void) noecho();
+    set_escdelay(25); /* ESC leaves search mode, don't wait for a sequence */
     keypad(stdscr, TRUE);
     curs_set(1);
     return true;
@@ -118,10 +377,17 @@ bool ui_init_windows(void)
         delwin(ui.menu.w);
         return false;
     }
-    keypad(ui.menu.w, TRUE);
-    keypad(ui.view.w, TRUE);
-    nodelay(ui.menu.w, TRUE);
-    nodelay(ui.view.w, TRUE);
+    ui.input = newwin(1, 1, 0, 0);
+    if (ui.input == NULL) {
+        fprintf(stderr, "newwin failed to create input window\n");
+        delwin(ui.menu.w);
+        delwin(ui.view.w);
+        return false;
+    }
+    keypad(ui.input, TRUE);
+    nodelay(ui.input, TRUE);
+    ui.menu.stale = true;
+    ui.view.stale = true;
     return true;
 }
 
@@ -137,9 +403,13 @@ void ui_init_colors(void)
 
 void ui_destroy(void)
 {
+    delwin(ui.input);
     delwin(ui.menu.w);
     delwin(ui.view.w);
     endwin();
+    free(ui.menu.shown);
+    ui.menu.shown = NULL;
+    ui.menu.n_shown = 0;
 }
 
 void clear_window(WINDOW *w)
@@ -160,12 +430,16 @@ void resize_windows(void)
     mvwin(  ui.view.w, 0, (x/2)+(x%2));
 }
 
-void refresh_windows(void)
+unsigned long long render_wchar(void)
 {
-    /* More efficient than wrefresh on each window */
-    wnoutrefresh(ui.menu.w);
-    wnoutrefresh(ui.view.w);
-    doupdate();
+    char buf[512];
+    ssize_t n = pread(render.io_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    const char *p = strstr(buf, "wchar:");
+    return p != NULL ? strtoull(p + 6, NULL, 10) : 0;
 }
 
 void update_maxyx(void)
@@ -175,38 +449,251 @@ void update_maxyx(void)
     getmaxyx(ui.view.w, ui.view.max.y, ui.view.max.x);
 }
 
+void menu_forget_rows(void)
+{
+    /* Song indices moved: every row has to be looked at again */
+    for (int row = 0; row < ui.menu.n_shown; row++) {
+        ui.menu.shown[row] = ROW_STALE;
+    }
+}
+
+const char *song_label(size_t idx, char *buf, size_t size)
+{
+    /* "Artist - Title" once the tags are known, the file name until then */
+    SongTags tags;
+    if (!tags_get(songarr, idx, &tags) || tags.title == NULL) {
+        return songarr_name(songarr, idx);
+    }
+    if (tags.artist != NULL) {
+        snprintf(buf, size, "%s - %s", tags.artist, tags.title);
+    } else {
+        snprintf(buf, size, "%s", tags.title);
+    }
+    return buf;
+}
+
+void set_curr_track(size_t idx)
+{
+    char label[MAX_SONGTITLE_LEN+1];
+    snprintf(player.curr_track, sizeof(player.curr_track), "%s",
+             song_label(idx, label, sizeof(label)));
+}
+
+void draw_tree_row(int row)
+{
+    /* Directories are marked open (-) or closed (+) and indented by depth */
+    int x = ui.menu.max.x;
+    int max_cols = x - 5; /* -2 for border, -3 for " > " */
+    size_t idx = ui.menu.offset_idx + row;
+    TreeRow tr;
+    if (max_cols <= 0 || !tree_row(idx, &tr)) {
+        return;
+    }
+    char label[MAX_SONGTITLE_LEN+1];
+    const char *name = tr.name;
+    size_t song = tree_song(idx);
+    if (song != SONGARR_NONE) {
+        tags_want(songarr, song);
+        name = song_label(song, label, sizeof(label));
+    }
+    char mark = tr.is_dir ? (tr.open ? '-' : '+') : ' ';
+    char line[MAX_SONGTITLE_LEN+1];
+    snprintf(line, sizeof(line), "%*s%c %s%s", 2 * tr.depth, "", mark,
+             name, tr.is_dir ? "/" : "");
+    int color = COLOR_PAIR(tr.is_dir ? 2 : 1);
+    wattrset(ui.menu.w, color);
+    mvwprintw(ui.menu.w, row+1, 1, " > %.*s", max_cols, line);
+    wattroff(ui.menu.w, color);
+}
+
+void draw_menu_row(int row, int song)
+{
+    int x = ui.menu.max.x;
+    int max_cols = x - 5; /* -2 for border, -3 for " > " */
+    mvwhline(ui.menu.w, row+1, 1, ' ', x - 2);
+    /* A row exposed by wscrl() lost its border as well */
+    mvwaddch(ui.menu.w, row+1, 0, ACS_VLINE);
+    mvwaddch(ui.menu.w, row+1, x-1, ACS_VLINE);
+    if (song != ROW_BLANK && ui.mode == MENU_TREE) {
+        draw_tree_row(row);
+    } else if (song != ROW_BLANK && max_cols > 0) {
+        char label[MAX_SONGTITLE_LEN+1];
+        tags_want(songarr, song); /* Shown rows are read first */
+        wattrset(ui.menu.w, COLOR_PAIR(1));
+        mvwprintw(ui.menu.w, row+1, 1, " > %.*s", max_cols,
+                  song_label(song, label, sizeof(label)));
+        wattroff(ui.menu.w, COLOR_PAIR(1));
+    }
+    ui.menu.shown[row] = song;
+}
+
 void draw_menu(void)
 {
     int y = ui.menu.max.y;
     int x = ui.menu.max.x;
-    int offset;
-    int title_len = strlen(TITLE_MENU);
-    offset = (title_len/2) + (title_len%2);
-    int title_ctr_x = x/2 - offset;
-    int subtitle_len = strlen(SUBTITLE_MENU);
-    offset = (subtitle_len/2) + (subtitle_len%2);
-    int subtitle_ctr_x = x/2 - offset;
+    int max_rows = y > 2 ? y - 2 : 0; /* -2 for border */
+    bool full = ui.menu.stale;
 
-    mvwprintw(ui.menu.w, 0, title_ctr_x, "%s", TITLE_MENU);
-    mvwprintw(ui.menu.w, y-1, subtitle_ctr_x, "%s", SUBTITLE_MENU);
+    if (max_rows != ui.menu.n_shown) {
+        int *shown = realloc(ui.menu.shown, (max_rows + 1) * sizeof(int));
+        if (shown == NULL) {
+            running = LOOP_STOP;
+            return;
+        }
+        ui.menu.shown = shown;
+        ui.menu.n_shown = max_rows;
+        full = true;
+    }
+    if (full) {
+        int title_len = strlen(TITLE_MENU);
+        int offset = (title_len/2) + (title_len%2);
+        clear_window(ui.menu.w);
+        mvwprintw(ui.menu.w, 0, x/2 - offset, "%s", TITLE_MENU);
+        if (max_rows > 0) {
+            wsetscrreg(ui.menu.w, 1, max_rows);
+        }
+        menu_forget_rows();
+    }
 
-    /* Draw menu items */
-    int max_cols = x - 5; /* -2 for border, -3 for " > " */
-    int max_rows = y - 2; /* -2 for border */
-    int j = ui.menu.offset_idx;
-    wattrset(ui.menu.w, COLOR_PAIR(1));
-    for (int row = 0; row < max_rows && j < (int)songarr->size; row++, j++) {
-        const char *name = songarr->arr[j].name;
-        int str_len = strlen(name);
-        if (str_len > max_cols) {
-            char short_name[max_cols+1];
-            snprintf(short_name, max_cols+1, "%s", name);
-            mvwprintw(ui.menu.w, row+1, 1, " > %s", short_name);
+    char footer[sizeof(ui.menu.footer)];
+    bool query = ui.mode == MENU_SONGS && (ui.searching || search.len > 0);
+    if (query) {
+        /* The query replaces the subtitle */
+        snprintf(footer, sizeof(footer), "> /%s%s (%zu) <", search.query,
+                 ui.searching ? "_" : "", search.n_ranked);
+    } else if (ui.mode == MENU_QUEUE) {
+        snprintf(footer, sizeof(footer), "> Queue: %zu songs <",
+                 playq_size(&player.playq));
+    } else if (load.loading) {
+        snprintf(footer, sizeof(footer), "> Scanning... %zu songs <",
+                 songarr->size);
+    } else if (dupes.hidden != NULL && dupes.hidden->size > 0 &&
+               !dupes.show) {
+        snprintf(footer, sizeof(footer), "> %zu duplicates hidden <",
+                 dupes.hidden->size);
+    } else {
+        snprintf(footer, sizeof(footer), "%s", SUBTITLE_MENU);
+    }
+    if (full || strcmp(footer, ui.menu.footer) != 0) {
+        mvwhline(ui.menu.w, y-1, 1, ACS_HLINE, x - 2);
+        if (query) {
+            mvwprintw(ui.menu.w, y-1, 2, "%.*s", x > 4 ? x - 4 : 0, footer);
+        } else {
+            int subtitle_len = strlen(footer);
+            int offset = (subtitle_len/2) + (subtitle_len%2);
+            mvwprintw(ui.menu.w, y-1, x/2 - offset, "%s", footer);
+        }
+        memcpy(ui.menu.footer, footer, sizeof(footer));
+    }
+
+    /* Only rows showing another song than last frame are drawn */
+    for (int row = 0; row < max_rows; row++) {
+        int item = menu_item(ui.menu.offset_idx + row);
+        if (item != ui.menu.shown[row]) {
+            draw_menu_row(row, item);
+        }
+    }
+    ui.menu.stale = false;
+}
+
+void menu_scroll(int n)
+{
+    /* Shift what is already drawn; draw_menu() then fills the n rows that
+     * came into view */
+    int rows = ui.menu.n_shown;
+    ui.menu.offset_idx += n;
+    if (ui.menu.stale || n == 0) {
+        return;
+    }
+    if (abs(n) >= rows) {
+        menu_forget_rows();
+        return;
+    }
+    scrollok(ui.menu.w, TRUE);
+    wscrl(ui.menu.w, n);
+    scrollok(ui.menu.w, FALSE); /* Writing the bottom corner must not scroll */
+    if (n > 0) {
+        memmove(ui.menu.shown, ui.menu.shown + n, (rows - n) * sizeof(int));
+        for (int row = rows - n; row < rows; row++) {
+            ui.menu.shown[row] = ROW_STALE;
+        }
+    } else {
+        memmove(ui.menu.shown - n, ui.menu.shown, (rows + n) * sizeof(int));
+        for (int row = 0; row < -n; row++) {
+            ui.menu.shown[row] = ROW_STALE;
+        }
+    }
+}
+
+void format_time(double secs, char *buf, size_t size)
+{
+    int t = secs > 0 ? (int)secs : 0;
+    if (t >= 3600) {
+        snprintf(buf, size, "%d:%02d:%02d", t / 3600, t / 60 % 60, t % 60);
+    } else {
+        snprintf(buf, size, "%d:%02d", t / 60, t % 60);
+    }
+}
+
+void draw_progress(void)
+{
+    /* The line is composed first: an unchanged one is not drawn at all */
+    int y = ui.view.max.y / 2 + 2;
+    int x = ui.view.max.x;
+    if (y >= ui.view.max.y - 2 || x < 4) {
+        return;
+    }
+
+    char line[sizeof(ui.view.progress)];
+    int bar = 0;
+    line[0] = '\0';
+    if (player.playing) {
+        char elapsed[16];
+        char total[16];
+        char info[64];
+        format_time(progress.time_pos, elapsed, sizeof(elapsed));
+        format_time(progress.duration, total, sizeof(total));
+        int len = snprintf(info, sizeof(info), " %s / %s", elapsed, total);
+        if (progress.volume >= 0) {
+            len += snprintf(info + len, sizeof(info) - len, "  vol %d%%",
+                            (int)(progress.volume + 0.5));
+        }
+
+        bar = x - 4 - len; /* -2 for border, -2 for "[]" */
+        if (bar > (int)sizeof(line) - 3 - len) {
+            bar = (int)sizeof(line) - 3 - len;
+        }
+        if (bar >= 4) {
+            int fill = 0;
+            if (progress.duration > 0) {
+                fill = (int)(bar * progress.time_pos / progress.duration);
+                fill = fill < 0 ? 0 : (fill > bar ? bar : fill);
+            }
+            line[0] = '[';
+            memset(line + 1, '#', fill);
+            memset(line + 1 + fill, '-', bar - fill);
+            line[bar + 1] = ']';
+            memcpy(line + bar + 2, info, len + 1);
         } else {
-            mvwprintw(ui.menu.w, row+1, 1, " > %s", name);
+            bar = 0;
+            snprintf(line, sizeof(line), "%.*s", x - 2, info);
         }
     }
-    wattroff(ui.menu.w, COLOR_PAIR(1));
+    if (!ui.view.stale && strcmp(line, ui.view.progress) == 0) {
+        return;
+    }
+    memcpy(ui.view.progress, line, sizeof(line));
+
+    mvwhline(ui.view.w, y, 1, ' ', x - 2);
+    wmove(ui.view.w, y, 1);
+    if (bar > 0) {
+        wattrset(ui.view.w, COLOR_PAIR(1));
+        waddnstr(ui.view.w, line, bar + 2);
+        wattroff(ui.view.w, COLOR_PAIR(1));
+        waddstr(ui.view.w, line + bar + 2);
+    } else {
+        waddstr(ui.view.w, line);
+    }
 }
 
 void draw_viewer(void)
@@ -214,57 +701,74 @@ void draw_viewer(void)
     int y = ui.view.max.y;
     int x = ui.view.max.x;
     int offset;
+    bool full = ui.view.stale;
 
-    int title_len = strlen(TITLE_VIEW);
-    offset = (title_len/2) + (title_len%2);
-    int title_ctr_x = x/2 - offset;
-    mvwprintw(ui.view.w, 0, title_ctr_x, "%s", TITLE_VIEW);
+    if (full) {
+        int title_len = strlen(TITLE_VIEW);
+        offset = (title_len/2) + (title_len%2);
+        clear_window(ui.view.w);
+        mvwprintw(ui.view.w, 0, x/2 - offset, "%s", TITLE_VIEW);
+    }
 
-    if (player.playing) {
+    /* Each field is drawn only when its value changed */
+    const char *name = player.playing ? player.curr_track : "";
+    if (full || player.playing != ui.view.playing ||
+        strcmp(name, ui.view.track) != 0) {
+        mvwhline(ui.view.w, y/2, 1, ' ', x - 2);
         int max_cols = x - 2; /* -2 for border */
-        const char *name = player.curr_track;
         int track_len = strlen(name);
         wattrset(ui.view.w, COLOR_PAIR(1) | A_BOLD);
         if (track_len > max_cols) {
-            char short_name[max_cols+1];
-            snprintf(short_name, max_cols+1, "%s", name);
-            mvwprintw(ui.view.w, y/2, 1, "%s", short_name);
-        } else {
+            mvwprintw(ui.view.w, y/2, 1, "%.*s", max_cols, name);
+        } else if (track_len > 0) {
             offset = (track_len/2) + (track_len%2);
-            int track_ctr_x = x/2 - offset;
-            mvwprintw(ui.view.w, y/2, track_ctr_x, "%s", name);
+            mvwprintw(ui.view.w, y/2, x/2 - offset, "%s", name);
         }
         wattroff(ui.view.w, COLOR_PAIR(1) | A_BOLD);
+        snprintf(ui.view.track, sizeof(ui.view.track), "%s", name);
+    }
+    if (full || player.playing != ui.view.playing) {
+        /* Otherwise the line only changes on the progress timer */
+        draw_progress();
+        ui.view.playing = player.playing;
     }
 
-    if (player.shuffle) {
-        wattrset(ui.view.w, COLOR_PAIR(2));
-        int ctr_x = x/2 - 5; /* Centering for "[Shuffle]" */
-        mvwprintw(ui.view.w, y-2, ctr_x, "[Shuffle]");
-        wattroff(ui.view.w, COLOR_PAIR(2));
-    } else if (player.autoplay) {
+    int mode = player.shuffle ? 2 : (player.autoplay ? 1 : 0);
+    if (full || mode != ui.view.mode) {
+        mvwhline(ui.view.w, y-2, 1, ' ', x - 2);
         wattrset(ui.view.w, COLOR_PAIR(2));
-        int ctr_x = x/2 - 6; /* Centering for "[Autoplay]" */
-        mvwprintw(ui.view.w, y-2, ctr_x, "[Auto-Play]");
+        if (mode == 2) {
+            int ctr_x = x/2 - 5; /* Centering for "[Shuffle]" */
+            mvwprintw(ui.view.w, y-2, ctr_x, "[Shuffle]");
+        } else if (mode == 1) {
+            int ctr_x = x/2 - 6; /* Centering for "[Autoplay]" */
+            mvwprintw(ui.view.w, y-2, ctr_x, "[Auto-Play]");
+        }
         wattroff(ui.view.w, COLOR_PAIR(2));
+        ui.view.mode = mode;
     }
 
-    if (player.paused) {
-        int ctr_x = x/2 - 5; /* Centering for "> PAUSE <" */
-        mvwprintw(ui.view.w, y-1, ctr_x, "> PAUSE <");
+    if (full || player.paused != ui.view.paused) {
+        mvwhline(ui.view.w, y-1, 1, ACS_HLINE, x - 2);
+        if (player.paused) {
+            int ctr_x = x/2 - 5; /* Centering for "> PAUSE <" */
+            mvwprintw(ui.view.w, y-1, ctr_x, "> PAUSE <");
+        }
+        ui.view.paused = player.paused;
     }
+    ui.view.stale = false;
 }
 
 void resize_items(void)
 {
     if (ui.menu.offset_idx != 0) {
         int max_rows = ui.max.y - 2; /* -2 for border */
-        if (max_rows >= (int)songarr->size) {
+        if (max_rows >= (int)menu_size()) {
             /* Reset offset index if window is large enough */
             ui.menu.offset_idx = 0;
         } else {
             /* Show more items if window is large enough */
-            int diff = (int)songarr->size - max_rows;
+            int diff = (int)menu_size() - max_rows;
             if (diff < ui.menu.offset_idx) {
                 ui.menu.offset_idx = diff;
             }
@@ -274,38 +778,30 @@ void resize_items(void)
 
 void item_scroll_down(void)
 {
-    ui.menu.offset_idx++;
-    clear_window(ui.menu.w);
-    draw_menu();
+    menu_scroll(1);
 }
 
 void item_scroll_up(void)
 {
-    ui.menu.offset_idx--;
-    clear_window(ui.menu.w);
-    draw_menu();
+    menu_scroll(-1);
 }
 
 void item_scroll_bottom(void)
 {
     int max_rows = ui.max.y - 2; /* -2 for border */
-    int diff = (int)songarr->size - max_rows;
-    ui.menu.offset_idx = diff;
-    clear_window(ui.menu.w);
-    draw_menu();
+    int diff = (int)menu_size() - max_rows;
+    menu_scroll(diff - ui.menu.offset_idx);
 }
 
 void item_scroll_top(void)
 {
-    ui.menu.offset_idx = 0;
-    clear_window(ui.menu.w);
-    draw_menu();
+    menu_scroll(-ui.menu.offset_idx);
 }
 
 void cursor_scroll_down(void)
 {
     int max_rows = ui.max.y - 2; /* -2 for border */
-    int items = (int)songarr->size;
+    int items = (int)menu_size();
     int off_scr = items - max_rows;
 
     if (ui.curs.y >= max_rows) {
@@ -337,8 +833,8 @@ void cursor_scroll_up(void)
 void cursor_scroll_bottom(void)
 {
     int max_rows = ui.max.y - 2; /* -2 for border */
-    if (max_rows > (int)songarr->size) {
-        ui.curs.y = songarr->size;
+    if (max_rows > (int)menu_size()) {
+        ui.curs.y = menu_size();
     } else {
         ui.curs.y = max_rows;
         item_scroll_bottom();
@@ -353,6 +849,25 @@ void cursor_scroll_top(void)
     }
 }
 
+void cursor_clamp(void)
+{
+    /* The list shrank under the cursor: keep it on the last entry */
+    int last = (int)menu_size() - ui.menu.offset_idx;
+    if (ui.curs.y > last) {
+        ui.curs.y = last > 1 ? last : 1;
+    }
+}
+
+void queue_rows_changed(void)
+{
+    /* Queue entries moved: the queue view is drawn again */
+    if (ui.mode == MENU_QUEUE) {
+        resize_items();
+        cursor_clamp();
+        menu_forget_rows();
+    }
+}
+
 void cursor_move_pos(void)
 {
     int max_rows = ui.max.y - 2; /* -2 for border */
@@ -365,6 +880,82 @@ void cursor_move_pos(void)
     wmove(ui.menu.w, ui.curs.y, ui.curs.x);
 }
 
+void format_stat(uint64_t v, bool is_time, char *buf, size_t size)
+{
+    if (!is_time) {
+        snprintf(buf, size, "%llu", (unsigned long long)v);
+    } else if (v < 1000) {
+        snprintf(buf, size, "%lluns", (unsigned long long)v);
+    } else if (v < 1000000) {
+        snprintf(buf, size, "%.1fus", v / 1e3);
+    } else if (v < 1000000000) {
+        snprintf(buf, size, "%.1fms", v / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", v / 1e9);
+    }
+}
+
+void draw_stats(void)
+{
+    /* Upper half of the viewer, above the track; redrawn every frame, curses
+     * sends only the numbers that changed */
+    int width = ui.view.max.x - 2;
+    int last = ui.view.max.y / 2 - 2;
+    if (width < 1 || last < 1) {
+        return;
+    }
+    char line[MAX_SONGTITLE_LEN];
+    snprintf(line, sizeof(line), "%-12s %7s %8s %8s %8s", "latency", "n",
+             "p50", "p99", "max");
+    mvwprintw(ui.view.w, 1, 1, "%-*.*s", width, width, line);
+    for (int id = 0; id < N_STATS && id + 2 <= last; id++) {
+        StatSummary st;
+        stats_summary(id, &st);
+        char p50[16], p99[16], max[16];
+        format_stat(st.p50, st.is_time, p50, sizeof(p50));
+        format_stat(st.p99, st.is_time, p99, sizeof(p99));
+        format_stat(st.max, st.is_time, max, sizeof(max));
+        snprintf(line, sizeof(line), "%-12s %7llu %8s %8s %8s", st.name,
+                 (unsigned long long)st.n, p50, p99, max);
+        mvwprintw(ui.view.w, id + 2, 1, "%-*.*s", width, width, line);
+    }
+}
+
+void render_frame(void)
+{
+    /* The one place that updates the terminal: handlers only change state,
+     * and whatever changed since the last frame goes out in one doupdate */
+    uint64_t start = stats_start();
+    draw_menu();
+    stats_since(STAT_DRAW_MENU, start);
+    draw_viewer();
+    if (ui.stats_shown) {
+        draw_stats();
+    }
+    cursor_move_pos();
+    wnoutrefresh(ui.view.w);
+    wnoutrefresh(ui.menu.w); /* Last, so the terminal cursor stays here */
+
+    unsigned long long before = render.io_fd != -1 ? render_wchar() : 0;
+    start = stats_start();
+    doupdate();
+    stats_since(STAT_DOUPDATE, start);
+    if (wake.key_ns != 0) {
+        stats_since(STAT_KEY_FRAME, wake.key_ns);
+        wake.key_ns = 0;
+    }
+    if (render.io_fd != -1) {
+        unsigned long long sent = render_wchar() - before;
+        if (sent > 0) {
+            render.frames++;
+            render.bytes += sent;
+            if (sent > render.max_frame) {
+                render.max_frame = sent;
+            }
+        }
+    }
+}
+
 int validate_idx(int idx)
 {
     if (idx >= (int)songarr->size) {
@@ -373,35 +964,177 @@ int validate_idx(int idx)
         idx = 0;
     }
     if (player.shuffle) {
+        size_t song = shuffle_song(&player.order, idx);
+        if (song == SHUFFLE_NONE) {
+            return -1;
+        }
         player.shuffle_idx = idx;
-        idx = player.order[idx];
+        idx = (int)song;
     }
     player.curr_idx = idx;
+    player.list_idx = idx;
+    return idx;
+}
+
+void on_load_reply(const MPVEvent *reply, void *ctx)
+{
+    (void)ctx;
+    /* Only the latest load matters, earlier ones were replaced anyway */
+    if (reply->id != player.load_id) {
+        return;
+    }
+    player.loading = false;
+    if (!reply->ok) {
+        player.playing = false;
+    }
+}
+
+int next_song(void)
+{
+    /* Song that plays after the current one on its own, or -1. The queue
+     * comes first, so it is what mpv preloads. */
+    int idx = -1;
+    if (playq_size(&player.playq) > 0) {
+        idx = (int)playq_at(&player.playq, 0);
+    } else if (player.shuffle) {
+        if (player.shuffle_idx + 1 < (int)songarr->size) {
+            /* Drawn now, so it stays the next one */
+            size_t song = shuffle_song(&player.order, player.shuffle_idx + 1);
+            idx = song != SHUFFLE_NONE ? (int)song : -1;
+        }
+    } else if (player.autoplay && player.list_idx >= 0) {
+        if (player.list_idx + 1 < (int)songarr->size) {
+            idx = player.list_idx + 1;
+        }
+    }
     return idx;
 }
 
-void event_playsong(int idx) 
+void queue_next(void)
+{
+    /* Keep the next song appended to mpv's playlist, so it is opened
+     * before the current one ends and follows it without a gap */
+    if (player.queued != -1) {
+        mpv_playlist_clear();
+        player.queued = -1;
+    }
+    int idx = player.playing ? next_song() : -1;
+    if (idx == -1) {
+        return;
+    }
+    char path[PATH_MAX];
+    if (songarr_path(songarr, idx, path, sizeof(path)) >= sizeof(path)) {
+        return;
+    }
+    if (mpv_queue_song(path) != 0) {
+        player.queued = idx;
+    }
+}
+
+void follow_path(const MPVEvent *ev)
+{
+    /* mpv started another entry on its own: make it the current song.
+     * Playlist positions shift under our own clear/append, the path does
+     * not. */
+    if (player.loading || ev->data_type != MPV_DATA_STRING) {
+        return;
+    }
+    const char *slash = strrchr(ev->str, '/');
+    if (slash == NULL) {
+        return;
+    }
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - ev->str), ev->str);
+    size_t idx = songarr_find(songarr, dir, slash + 1);
+    if (idx == SONGARR_NONE ||
+        (player.playing && (int)idx == player.curr_idx)) {
+        return;
+    }
+
+    if (playq_size(&player.playq) > 0 && playq_at(&player.playq, 0) == idx) {
+        /* From the queue: shuffle and autoplay stay where they were */
+        playq_pop_front(&player.playq);
+        queue_rows_changed();
+    } else {
+        if (player.shuffle) {
+            size_t pos = shuffle_pos(&player.order, idx);
+            if (pos != SHUFFLE_NONE) {
+                player.shuffle_idx = (int)pos;
+            }
+        }
+        player.list_idx = (int)idx;
+    }
+    player.curr_idx = (int)idx;
+    player.playing = true;
+    set_curr_track(idx);
+    /* The finished entry is still first in mpv's playlist */
+    player.queued = (int)idx;
+    queue_next();
+}
+
+void play_song(int idx)
+{
+    sess.resumed = false;
+    /* Paths are only ever built here, when mpv needs one */
+    char path[PATH_MAX];
+    if (songarr_path(songarr, idx, path, sizeof(path)) >= sizeof(path)) {
+        return;
+    }
+    player.load_id = mpv_load_song(path, on_load_reply, NULL);
+    if (player.load_id == 0) {
+        return; /* mpv is not keeping up, drop the request */
+    }
+    player.loading = true;
+    player.playing = true;
+    player.curr_idx = idx;
+    set_curr_track(idx);
+    /* "replace" emptied mpv's playlist, including what was queued */
+    player.queued = -1;
+    queue_next();
+}
+
+void event_playsong(int idx)
 {
+    /* idx is a library row, or a position in the shuffle order */
     if ((idx = validate_idx(idx)) == -1) {
         return;
     }
-    mpv_load_song(songarr->arr[idx].path);
+    play_song(idx);
+}
+
+void event_playqueued(size_t i)
+{
+    /* Entry i of the queue plays now, and leaves it */
+    size_t song = playq_at(&player.playq, i);
+    if (song == PLAYQ_NONE) {
+        return;
+    }
+    playq_remove(&player.playq, i);
+    queue_rows_changed();
+    play_song((int)song);
+}
+
+void event_playpath(const char *path, const char *name, double start)
+{
+    /* A file the library does not list: it plays on its own */
+    sess.resumed = false;
+    player.load_id = mpv_load_song_at(path, start, on_load_reply, NULL);
+    if (player.load_id == 0) {
+        return;
+    }
+    player.loading = true;
     player.playing = true;
-    strncpy(
-        player.curr_track,
-        songarr->arr[idx].name,
-        (size_t)MAX_SONGTITLE_LEN
-    );
+    player.curr_idx = -1;
+    player.list_idx = -1;
+    snprintf(player.curr_track, sizeof(player.curr_track), "%s", name);
+    player.queued = -1;
 }
 
 void event_shuffle(void)
 {
-    for (int i = (int)songarr->size - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        int tmp = player.order[i];
-        player.order[i] = player.order[j];
-        player.order[j] = tmp;
-    }
+    /* A new round: songs are drawn as they are played, and the ones
+     * already drawn are what ',' steps back through */
+    shuffle_restart(&player.order, songarr->size);
     player.shuffle_idx = 0;
     player.shuffle = true;
 }
@@ -412,7 +1145,7 @@ int event_next(void)
     if (player.shuffle) {
         idx = player.shuffle_idx + 1;
     } else {
-        idx = player.curr_idx + 1;
+        idx = player.list_idx + 1;
     }
     return idx;
 }
@@ -423,55 +1156,1274 @@ int event_prev(void)
     if (player.shuffle) {
         idx = player.shuffle_idx - 1;
     } else {
-        idx = player.curr_idx - 1;
+        idx = player.list_idx - 1;
     }
     return idx;
 }
 
-void switch_keypress(int key)
+void skip_prev(void)
 {
-    switch (key) {
-        case KEY_RESIZE: {
-            update_maxyx();
-            resize_windows();
-            resize_items();
-            clear_window(ui.menu.w);
-            clear_window(ui.view.w);
-            draw_menu();
-            draw_viewer();
-            refresh_windows();
-            break;
-        }
-        case 'k':
-        case KEY_UP: {
-            cursor_scroll_up();
-            break;
-        }
-        case 'g': {
-            cursor_scroll_top();
-            break;
-        }
-        case 'j':
-        case KEY_DOWN: {
-            cursor_scroll_down();
-            break;
-        }
-        case 'G': {
-            cursor_scroll_bottom();
-            break;
-        }
-        case '\n':
-        case KEY_ENTER: {
-            if (player.shuffle) {
-                player.shuffle = false;
-            }
-            int idx = ui.menu.offset_idx + ui.curs.y - 1;
-            event_playsong(idx);
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
-            break;
-        }
+    if (player.playing) {
+        event_playsong(event_prev());
+    }
+}
+
+void skip_next(void)
+{
+    if (!player.playing) {
+        return;
+    }
+    if (playq_size(&player.playq) > 0) {
+        event_playqueued(0);
+        return;
+    }
+    int idx = event_next();
+    if (idx < (int)songarr->size) {
+        event_playsong(idx);
+    }
+}
+
+void event_pause(void)
+{
+    mpv_cycle_pause();
+    player.paused = !player.paused;
+}
+
+void event_autoplay(void)
+{
+    player.autoplay = !player.autoplay;
+    queue_next();
+}
+
+void search_rewind(void)
+{
+    /* The result set changed: start again from its best match */
+    ui.curs.y = 1;
+    ui.menu.offset_idx = 0;
+}
+
+void menu_select(int idx)
+{
+    /* Put the cursor on menu entry idx, scrolling only if it is off screen */
+    int max_rows = ui.max.y - 2; /* -2 for border */
+    int n = (int)menu_size();
+    int offset = ui.menu.offset_idx;
+    if (idx < offset) {
+        offset = idx;
+    } else if (idx >= offset + max_rows) {
+        offset = idx - max_rows + 1;
+    }
+    if (offset > n - max_rows) {
+        offset = n - max_rows;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+    menu_scroll(offset - ui.menu.offset_idx);
+    ui.curs.y = idx - offset + 1;
+}
+
+void menu_show(MenuMode mode)
+{
+    /* Each list keeps its own cursor; the tree is read on first use */
+    if (mode == ui.mode) {
+        return;
+    }
+    if (mode == MENU_TREE && !tree_initialized) {
+        tree_initialized = tree_init(opts.roots, opts.n_roots);
+        if (!tree_initialized) {
+            return;
+        }
+    }
+    ui.place[ui.mode] = (RowCol){ ui.curs.y, ui.menu.offset_idx };
+    ui.curs.y = ui.place[mode].y;
+    ui.menu.offset_idx = ui.place[mode].x;
+    ui.mode = mode;
+    ui.menu.stale = true;
+    resize_items();
+    cursor_clamp();
+}
+
+void tree_view_toggle(void)
+{
+    menu_show(ui.mode == MENU_TREE ? MENU_SONGS : MENU_TREE);
+}
+
+void queue_view_toggle(void)
+{
+    if (ui.mode == MENU_QUEUE) {
+        menu_show(ui.back);
+    } else {
+        ui.back = ui.mode;
+        menu_show(MENU_QUEUE);
+    }
+}
+
+int cursor_song(void)
+{
+    /* Library index of the song under the cursor, or -1 */
+    int row = ui.menu.offset_idx + ui.curs.y - 1;
+    if (ui.mode == MENU_TREE) {
+        size_t song = tree_song(row);
+        return song != SONGARR_NONE ? (int)song : -1;
+    }
+    return menu_item(row);
+}
+
+void queue_song(int song, bool next)
+{
+    bool ok = next ? playq_push_front(&player.playq, song)
+                   : playq_push_back(&player.playq, song);
+    if (!ok) {
+        running = LOOP_STOP;
+        return;
+    }
+    queue_rows_changed();
+    if (next_song() != player.queued) {
+        queue_next(); /* mpv preloads the new first entry */
+    }
+}
+
+void queue_add(bool next)
+{
+    /* 'n' puts the song under the cursor first in the queue, 'e' last.
+     * In the queue view they move the entry there instead. */
+    int song = cursor_song();
+    if (song == -1) {
+        return;
+    }
+    if (ui.mode == MENU_QUEUE) {
+        playq_remove(&player.playq, ui.menu.offset_idx + ui.curs.y - 1);
+    }
+    queue_song(song, next);
+}
+
+void queue_move(int step)
+{
+    /* Swap the entry under the cursor with its neighbour; the cursor
+     * follows it */
+    int row = ui.menu.offset_idx + ui.curs.y - 1;
+    int to = row + step;
+    if (ui.mode != MENU_QUEUE || to < 0 || to >= (int)menu_size()) {
+        return;
+    }
+    playq_swap(&player.playq, row, to);
+    menu_forget_rows();
+    menu_select(to);
+    if (next_song() != player.queued) {
+        queue_next();
+    }
+}
+
+void queue_remove(size_t i)
+{
+    playq_remove(&player.playq, i);
+    queue_rows_changed();
+    if (next_song() != player.queued) {
+        queue_next();
+    }
+}
+
+void queue_drop(void)
+{
+    if (ui.mode == MENU_QUEUE) {
+        queue_remove(ui.menu.offset_idx + ui.curs.y - 1);
+    }
+}
+
+void tree_open(size_t row)
+{
+    /* ENTER on a tree row: directories open and close, files play */
+    TreeRow tr;
+    if (!tree_row(row, &tr)) {
+        return;
+    }
+    if (tr.is_dir) {
+        if (!tree_toggle(row)) {
+            running = LOOP_STOP;
+        }
+        resize_items(); /* Closing may have left the end of the tree */
+        menu_forget_rows();
+        return;
+    }
+    player.shuffle = false;
+    size_t song = tree_song(row);
+    if (song != SONGARR_NONE) {
+        event_playsong((int)song);
+        return;
+    }
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    size_t len = tree_dirpath(row, dir, sizeof(dir));
+    if (len < sizeof(dir) &&
+        snprintf(path, sizeof(path), "%s/%s", dir, tr.name) < (int)sizeof(path)) {
+        event_playpath(path, tr.name, 0);
+    }
+}
+
+void tree_close_parent(size_t row)
+{
+    /* Back up to the directory holding row and close it */
+    size_t parent = tree_parent(row);
+    if (parent == TREE_NONE) {
+        return;
+    }
+    if (!tree_toggle(parent)) {
+        running = LOOP_STOP;
+    }
+    menu_forget_rows();
+    menu_select((int)parent);
+}
+
+void search_start(void)
+{
+    menu_show(MENU_SONGS); /* Matches are listed flat */
+    search_clear(&search);
+    ui.searching = true;
+    search_rewind();
+}
+
+void search_end(void)
+{
+    search_clear(&search);
+    ui.searching = false;
+    search_rewind();
+}
+
+bool switch_searchkey(int key)
+{
+    /* Keys typed into the query. Returns false for keys that keep their
+     * usual meaning (arrows, ENTER, resize...) */
+    switch (key) {
+        case 27: { /* ESC */
+            search_end();
+            return true;
+        }
+        case KEY_BACKSPACE:
+        case 127:
+        case '\b': {
+            if (search.len == 0) {
+                search_end();
+            } else {
+                search_pop(&search, songarr);
+                search_rewind();
+            }
+            return true;
+        }
+        case '\n':
+        case KEY_ENTER: {
+            /* Stop typing, keep the results, and play the selection */
+            ui.searching = false;
+            return false;
+        }
+        default: break;
+    }
+    if (key >= ' ' && key <= 0xFF && key != 127) {
+        /* Each key narrows the previous results */
+        search_push(&search, songarr, (char)key);
+        search_rewind();
+        return true;
+    }
+    return false;
+}
+
+void eof_event_shuffle(void)
+{
+    int idx = player.shuffle_idx + 1;
+    if (idx >= (int)songarr->size) {
+        player.playing = false;
+        player.shuffle = false;
+    } else {
+        event_playsong(player.shuffle_idx+1);
+    }
+}
+
+void eof_event_autoplay(void)
+{
+    int idx = player.list_idx + 1;
+    if (idx >= (int)songarr->size) {
+        player.playing = false;
+    } else {
+        event_playsong(player.list_idx+1);
+    }
+}
+
+void eof_event(void)
+{
+    /* End of song reached. A queued song is already playing, see
+     * follow_path(); this only runs when nothing could be queued. */
+    if (player.queued != -1) {
+        return;
+    }
+    if (playq_size(&player.playq) > 0) {
+        /* Picked songs go first, whatever the mode */
+        event_playqueued(0);
+    } else if (player.shuffle) {
+        eof_event_shuffle();
+    } else if (player.autoplay && player.list_idx >= 0) {
+        eof_event_autoplay();
+    } else {
+        player.playing = false;
+    }
+}
+
+long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void progress_schedule(void)
+{
+    /* One draw per frame however many updates arrive; idle costs nothing
+     * since the timer is only armed when something changed */
+    if (progress.armed) {
+        return;
+    }
+    long long due = progress.last_ns + progress.period_ns;
+    struct itimerspec its = {
+        .it_value = { due / 1000000000LL, due % 1000000000LL },
+    };
+    if (timerfd_settime(progress.fd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+        progress.armed = true;
+    }
+}
+
+void progress_tick(void)
+{
+    uint64_t expirations;
+    if (read(progress.fd, &expirations, sizeof(expirations)) == -1) {
+        return;
+    }
+    progress.armed = false;
+    progress.last_ns = now_ns();
+    draw_progress(); /* Goes out with the next frame */
+}
+
+void handle_property(const MPVEvent *ev)
+{
+    /* Unavailable (null) values arrive when nothing is playing */
+    bool known = (ev->data_type == MPV_DATA_NUMBER);
+    switch (ev->id) {
+        case OBS_TIME_POS: progress.time_pos = known ? ev->num : 0; break;
+        case OBS_DURATION: progress.duration = known ? ev->num : 0; break;
+        case OBS_VOLUME:   progress.volume = known ? ev->num : -1; break;
+        case OBS_PATH:     follow_path(ev); return;
+        default: return;
+    }
+    progress_schedule();
+}
+
+void handle_mpv_events(void)
+{
+    /* Drain the socket, then act on every complete message in order */
+    MPVEvent ev;
+    int n;
+    do {
+        n = mpv_read_events();
+        while (mpv_next_event(&ev)) {
+            wake.events++;
+            if (ev.type == MPV_EVENT_END_FILE && ev.reason == END_EOF) {
+                eof_event();
+            } else if (ev.type == MPV_EVENT_PROPERTY) {
+                handle_property(&ev);
+            }
+        }
+    } while (n > 0);
+
+    if (n == -1) {
+        /* mpv is gone, nothing left to play with */
+        mpv_lost = true;
+        running = LOOP_STOP;
+    }
+}
+
+size_t remap_survivor(const size_t *remap, size_t old_size, size_t idx)
+{
+    /* New index of idx, or of the first later entry that survived */
+    for (; idx < old_size; idx++) {
+        if (remap[idx] != SONGARR_NONE) {
+            return remap[idx];
+        }
+    }
+    return songarr->size;
+}
+
+bool remap_order(const size_t *remap)
+{
+    if (!player.shuffle || remap == NULL) {
+        shuffle_restart(&player.order, songarr->size);
+        return true;
+    }
+    /* Keep the songs played so far, minus removed ones. New songs join
+     * the part not drawn yet, so they come up at random spots. */
+    return shuffle_remap(&player.order, remap, songarr->size,
+                         &player.shuffle_idx);
+}
+
+int remap_row(const size_t *remap, size_t old_size, int idx)
+{
+    if (idx < 0 || (size_t)idx >= old_size) {
+        return idx;
+    }
+    size_t to = remap[idx];
+    if (to == SONGARR_NONE) {
+        /* Gone: point just before the next survivor so '.' plays it */
+        to = remap_survivor(remap, old_size, idx) - 1;
+    }
+    return (int)to;
+}
+
+void remap_player(const size_t *remap, size_t old_size)
+{
+    if (remap == NULL) {
+        /* Positions are unknown: fall back to a fresh, sequential state */
+        player.shuffle = false;
+        player.curr_idx = -1;
+        player.list_idx = -1;
+        playq_clear(&player.playq);
+    } else {
+        player.curr_idx = remap_row(remap, old_size, player.curr_idx);
+        player.list_idx = remap_row(remap, old_size, player.list_idx);
+        playq_remap(&player.playq, remap);
+    }
+    if (!remap_order(remap)) {
+        running = LOOP_STOP;
+    }
+}
+
+void remap_cursor(const size_t *remap, size_t old_size)
+{
+    int max_rows = ui.max.y - 2; /* -2 for border */
+    int n = (int)songarr->size;
+    size_t sel = ui.menu.offset_idx + ui.curs.y - 1;
+    int idx = 0;
+    if (remap != NULL && sel < old_size) {
+        idx = remap[sel] != SONGARR_NONE ? (int)remap[sel]
+              : (int)remap_survivor(remap, old_size, sel);
+    }
+
+    /* Keep the selected song on the same screen row where possible */
+    int offset = idx - (ui.curs.y - 1);
+    if (offset > n - max_rows) {
+        offset = n - max_rows;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+    ui.menu.offset_idx = offset;
+    ui.curs.y = idx - offset + 1;
+    if (ui.curs.y > n) {
+        ui.curs.y = n;
+    }
+    if (ui.curs.y < 1) {
+        ui.curs.y = 1;
+    }
+}
+
+void library_changed(const size_t *remap, size_t old_size)
+{
+    /* Entries were merged into songarr: follow them everywhere */
+    sess.hash_stale = true;
+    sess.dirty = true;
+    control.library++;
+    remap_player(remap, old_size);
+    queue_next(); /* The song after the current one may have changed */
+    uint32_t *old_names = songarr_compact(songarr);
+    if (old_names != NULL) {
+        /* Removals left enough dead strings behind: tags follow the names */
+        tags_rekey(songarr, old_names);
+        free(old_names);
+    }
+    tags_rescan();
+    tags_feed(songarr);
+    if (search.len > 0) {
+        /* Matches are song indices: run the query again */
+        search_refresh(&search, songarr);
+        relabel.due = false;
+    }
+    if (ui.mode != MENU_SONGS) {
+        /* Tree rows are directory entries, queue rows may have gone: only
+         * the flat cursor is lost */
+        ui.place[MENU_SONGS] = (RowCol){1, 0};
+        resize_items();
+        cursor_clamp();
+    } else if (search.len > 0) {
+        ui.curs.y = 1;
+        ui.menu.offset_idx = 0;
+    } else {
+        remap_cursor(remap, old_size);
+    }
+
+    /* Rows keep their text only if the same name landed there */
+    menu_forget_rows();
+}
+
+void dupes_rescan(void)
+{
+    /* The hidden songs are looked at again too: one may be the last copy */
+    if (dupes.on) {
+        dupes.library = control.library;
+        dupes.running = dupes_start(songarr, dupes.show ? NULL
+                                                        : dupes.hidden);
+    }
+}
+
+bool dupes_copy(SongArr *dst, const SongArr *src, size_t idx,
+                uint32_t *dir_map)
+{
+    /* dir_map: src directory to dst, UINT32_MAX until added */
+    struct timespec unknown = { 0, 0 };
+    uint32_t dir = src->arr[idx].dir;
+    if (dir_map[dir] == UINT32_MAX &&
+        !songarr_add_dir(dst, songarr_dirpath(src, dir), unknown,
+                         &dir_map[dir])) {
+        return false;
+    }
+    return songarr_append(dst, dir_map[dir], songarr_name(src, idx));
+}
+
+bool dupes_merge(SongArr *add, SongArr *del)
+{
+    /* Like a watched change: songarr_apply(), then follow the songs */
+    size_t old_size = songarr->size;
+    size_t *remap = malloc((old_size + 1) * sizeof(size_t));
+    SongArr *none = songarr_new();
+    SongArrDelta delta = {
+        .add = add != NULL ? add : none,
+        .del = del,
+    };
+    bool ok = remap != NULL && none != NULL &&
+              songarr_apply(songarr, &delta, remap);
+    if (ok) {
+        library_changed(remap, old_size);
+    }
+    if (none != NULL) {
+        songarr_destroy(none);
+    }
+    free(remap);
+    return ok;
+}
+
+bool dupes_collapse(const DupesResult *res)
+{
+    /* The copy starts with the listed songs, as they still are; the rest
+     * were hidden. Duplicates now go, hidden songs with no copy left (or
+     * none any more) come back. */
+    const SongArr *songs = res->songs;
+    size_t n_listed = songarr->size;
+    SongArr *hidden = songarr_new();
+    SongArr *del = songarr_new();
+    SongArr *back = songarr_new();
+    uint32_t *dir_map = malloc((3 * songs->n_dirs + 1) * sizeof(uint32_t));
+    bool ok = hidden != NULL && del != NULL && back != NULL &&
+              dir_map != NULL;
+    for (size_t i = 0; ok && i < 3 * songs->n_dirs; i++) {
+        dir_map[i] = UINT32_MAX;
+    }
+    for (size_t i = 0; ok && i < songs->size; i++) {
+        bool dup = res->keep[i] != i && res->keep[i] != DUPES_GONE;
+        if (dup) {
+            ok = dupes_copy(hidden, songs, i, dir_map);
+        }
+        if (ok && dup && !dupes.show && i < n_listed) {
+            ok = dupes_copy(del, songs, i, dir_map + songs->n_dirs);
+        } else if (ok && !dup && i >= n_listed && res->keep[i] == i) {
+            ok = dupes_copy(back, songs, i, dir_map + 2 * songs->n_dirs);
+        }
+    }
+    if (ok && (del->size > 0 || back->size > 0)) {
+        ok = dupes_merge(back, del);
+    }
+    if (ok) {
+        songarr_destroy(dupes.hidden);
+        dupes.hidden = hidden;
+        hidden = NULL;
+    }
+    SongArr *parts[] = { hidden, del, back };
+    for (int i = 0; i < 3; i++) {
+        if (parts[i] != NULL) {
+            songarr_destroy(parts[i]);
+        }
+    }
+    free(dir_map);
+    return ok;
+}
+
+void dupes_toggle(void)
+{
+    /* Shown or not, the next pass keeps them up to date */
+    if (!dupes.on) {
+        return;
+    }
+    dupes.show = !dupes.show;
+    if (dupes.hidden->size > 0) {
+        bool ok = dupes.show ? dupes_merge(dupes.hidden, NULL)
+                             : dupes_merge(NULL, dupes.hidden);
+        if (!ok) {
+            running = LOOP_STOP;
+            return;
+        }
+    }
+    if (dupes.running) {
+        dupes_rescan();
+    }
+    sess.dirty = true;
+}
+
+void library_refresh(void)
+{
+    size_t old_size = songarr->size;
+    size_t *remap = malloc((old_size + 1) * sizeof(size_t));
+    if (!watch_apply(songarr, remap) && remap != NULL) {
+        /* Nothing was merged, positions are unchanged */
+        free(remap);
+        return;
+    }
+    library_changed(remap, old_size);
+    free(remap);
+    dupes_rescan();
+}
+
+uint64_t library_hash(void)
+{
+    /* Hashing a large library takes a while: once per change at most */
+    if (sess.hash_stale) {
+        sess.lib_hash = session_lib_hash(songarr);
+        sess.hash_stale = false;
+    }
+    return sess.lib_hash;
+}
+
+void session_store(void)
+{
+    /* Until the saved session is applied, the file on disk is newer */
+    if (!sess.ready || sess.pending) {
+        return;
+    }
+    Session s = {
+        .flags = (player.shuffle ? SESSION_SHUFFLE : 0) |
+                 (player.autoplay ? SESSION_AUTOPLAY : 0) |
+                 (player.paused ? SESSION_PAUSED : 0) |
+                 (dupes.show ? SESSION_DUPES : 0),
+        .time_pos = progress.time_pos,
+        .lib_hash = library_hash(),
+        .list_idx = player.list_idx,
+        .shuffle_idx = player.shuffle ? player.shuffle_idx : -1,
+    };
+    /* The flat list's cursor, wherever the menu is */
+    RowCol place = ui.place[MENU_SONGS];
+    if (ui.mode == MENU_SONGS) {
+        place = (RowCol){ ui.curs.y, ui.menu.offset_idx };
+    }
+    if (search.len == 0) {
+        s.curs_y = place.y;
+        s.menu_offset = place.x;
+    }
+    char track[PATH_MAX];
+    if (player.playing && player.curr_idx >= 0 &&
+        songarr_path(songarr, player.curr_idx, track, sizeof(track)) <
+        sizeof(track)) {
+        s.track = track;
+    }
+    if (player.shuffle) {
+        s.n_order = player.order.drawn;
+        s.order = malloc((s.n_order + 1) * sizeof(*s.order));
+    }
+    s.n_queue = playq_size(&player.playq);
+    s.queue = malloc((s.n_queue + 1) * sizeof(*s.queue));
+    if ((player.shuffle && s.order == NULL) || s.queue == NULL) {
+        free(s.order);
+        free(s.queue);
+        return;
+    }
+    for (size_t i = 0; i < s.n_order; i++) {
+        s.order[i] = (uint32_t)shuffle_song(&player.order, i);
+    }
+    for (size_t i = 0; i < s.n_queue; i++) {
+        s.queue[i] = (uint32_t)playq_at(&player.playq, i);
+    }
+    /* Best effort, like the index: a lost session only costs the resume */
+    (void)session_save(opts.roots, opts.n_roots, &s);
+    free(s.order);
+    free(s.queue);
+    sess.dirty = false;
+    sess.saved_ns = now_ns();
+}
+
+void session_autosave(bool keyed)
+{
+    /* At most one write per period, and only when something moved */
+    sess.dirty = sess.dirty || keyed || (player.playing && !player.paused);
+    if (sess.dirty && now_ns() - sess.saved_ns >= SESSION_PERIOD_NS) {
+        session_store();
+    }
+}
+
+void session_resume(void)
+{
+    /* The track plays at once, by path; the rest waits for the library */
+    sess.pending = session_load(opts.roots, opts.n_roots, &sess.saved);
+    if (!sess.pending) {
+        return;
+    }
+    player.autoplay = (sess.saved.flags & SESSION_AUTOPLAY) != 0;
+    dupes.show = (sess.saved.flags & SESSION_DUPES) != 0;
+    const char *track = sess.saved.track;
+    if (track == NULL) {
+        return;
+    }
+    const char *slash = strrchr(track, '/');
+    event_playpath(track, slash != NULL ? slash + 1 : track,
+                   sess.saved.time_pos);
+    if (player.playing && (sess.saved.flags & SESSION_PAUSED)) {
+        mpv_cycle_pause();
+        player.paused = true;
+    }
+    sess.resumed = player.playing;
+}
+
+void session_apply(void)
+{
+    /* The library is in: find the track again and, if no song moved since
+     * the save, the shuffle order, queue and cursor too. Whatever was
+     * picked in the meantime wins. */
+    if (!sess.pending) {
+        return;
+    }
+    sess.pending = false;
+    Session *s = &sess.saved;
+    int n = (int)songarr->size;
+    bool same = s->lib_hash == library_hash();
+
+    int idx = -1;
+    if (sess.resumed && s->track != NULL) {
+        const char *slash = strrchr(s->track, '/');
+        char dir[PATH_MAX];
+        if (slash != NULL) {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - s->track),
+                     s->track);
+            size_t song = songarr_find(songarr, dir, slash + 1);
+            idx = song != SONGARR_NONE ? (int)song : -1;
+        }
+    }
+    if (idx >= 0) {
+        player.curr_idx = idx;
+        player.list_idx = (same && s->list_idx >= 0 && s->list_idx < n)
+                          ? s->list_idx : idx;
+        set_curr_track(idx);
+    }
+
+    if (idx >= 0 && (s->flags & SESSION_SHUFFLE)) {
+        /* The round so far comes back; if songs moved, a new one goes on
+         * from the track */
+        shuffle_restart(&player.order, n);
+        if (same && !shuffle_reserve(&player.order, s->n_order)) {
+            running = LOOP_STOP;
+            return;
+        }
+        for (size_t i = 0; same && i < s->n_order; i++) {
+            if (s->order[i] < (uint32_t)n &&
+                shuffle_pos(&player.order, s->order[i]) == SHUFFLE_NONE) {
+                break;
+            }
+        }
+        size_t pos = shuffle_pos(&player.order, idx);
+        if (same && s->shuffle_idx >= 0 &&
+            (size_t)s->shuffle_idx < player.order.drawn &&
+            shuffle_song(&player.order, s->shuffle_idx) == (size_t)idx) {
+            pos = s->shuffle_idx;
+        }
+        player.shuffle = pos != SHUFFLE_NONE;
+        player.shuffle_idx = (int)pos;
+    }
+    if (same && playq_size(&player.playq) == 0) {
+        for (size_t i = 0; i < s->n_queue; i++) {
+            if (s->queue[i] < (uint32_t)n &&
+                !playq_push_back(&player.playq, s->queue[i])) {
+                break;
+            }
+        }
+    }
+
+    /* The cursor goes back too, unless it was moved while loading */
+    bool untouched = ui.mode == MENU_SONGS && search.len == 0 &&
+                     ui.curs.y == 1 && ui.menu.offset_idx == 0;
+    if (untouched && same && s->curs_y >= 1 &&
+        s->menu_offset + s->curs_y - 1 < n) {
+        /* The same row under the cursor, scrolled into a smaller window */
+        ui.menu.offset_idx = s->menu_offset;
+        menu_forget_rows();
+        menu_select(s->menu_offset + s->curs_y - 1);
+    } else if (untouched && idx >= 0) {
+        menu_select(idx);
+    }
+    session_free(s);
+    ui.view.stale = true;
+    queue_next();
+}
+
+void load_finish(bool ok)
+{
+    load.loading = false;
+    fds[FD_LOAD].fd = -1;
+    if (!ok) {
+        load.failed = true;
+        running = LOOP_STOP;
+        return;
+    }
+    if (load.scanned) {
+        /* Best effort: a missing index only costs a rescan next time */
+        (void)libindex_save(opts.roots, opts.n_roots, songarr);
+    }
+    /* Watched from here on; the scan itself saw earlier changes */
+    int watch_fd = watch_init(opts.roots, opts.n_roots, songarr,
+                              opts.lib.n_threads);
+    watch_initialized = (watch_fd != -1);
+    fds[FD_WATCH].fd = watch_fd;
+    /* Song indices in the session count the duplicates out, unless they
+     * were shown: then it waits for the first pass */
+    dupes_rescan();
+    if (!dupes.running || dupes.show) {
+        session_apply();
+    }
+}
+
+void handle_load(void)
+{
+    LoadBatch batch;
+    loader_take(&batch);
+    if (batch.add != NULL) {
+        size_t old_size = songarr->size;
+        size_t *remap = malloc((old_size + 1) * sizeof(size_t));
+        bool ok = true;
+        if (batch.whole) {
+            /* The index: nothing else was listed before it */
+            songarr_destroy(songarr);
+            songarr = batch.add;
+        } else {
+            SongArrDelta delta = { .add = batch.add };
+            ok = songarr_apply(songarr, &delta, remap);
+            songarr_destroy(batch.add);
+            load.scanned = true;
+        }
+        if (ok) {
+            library_changed(remap, old_size);
+        }
+        free(remap);
+        if (!ok) {
+            load_finish(false);
+            return;
+        }
+    }
+    if (batch.done) {
+        load_finish(batch.ok);
+    }
+}
+
+int relabel_timeout(void)
+{
+    /* Milliseconds until the query is due to run again, -1 when it is not */
+    if (!relabel.due) {
+        return -1;
+    }
+    long long due = relabel.last_ns + RELABEL_SETTLE_NS;
+    if (relabel.first_ns + RELABEL_MAX_NS < due) {
+        due = relabel.first_ns + RELABEL_MAX_NS;
+    }
+    long long left = due - now_ns();
+    return left <= 0 ? 0 : (int)((left + 999999) / 1000000);
+}
+
+void search_relabel(void)
+{
+    /* The query is matched against labels: run it again, keeping the
+     * cursor on the song it was on if that one still matches */
+    relabel.due = false;
+    if (search.len == 0) {
+        return;
+    }
+    if (ui.mode != MENU_SONGS) {
+        search_refresh(&search, songarr);
+        ui.place[MENU_SONGS] = (RowCol){1, 0};
+        return;
+    }
+    int song = menu_song(ui.menu.offset_idx + ui.curs.y - 1);
+    search_refresh(&search, songarr);
+    for (size_t i = 0; i < search.n_ranked; i++) {
+        if ((int)search.ranked[i] == song) {
+            menu_select((int)i);
+            return;
+        }
+    }
+    search_rewind();
+}
+
+void handle_tags(void)
+{
+    if (tags_collect()) {
+        /* Labels may have changed on any row */
+        menu_forget_rows();
+        if (player.playing && player.curr_idx >= 0) {
+            set_curr_track(player.curr_idx);
+        }
+        if (search.len > 0) {
+            long long now = now_ns();
+            if (!relabel.due) {
+                relabel.due = true;
+                relabel.first_ns = now;
+            }
+            relabel.last_ns = now;
+        }
+    }
+    tags_feed(songarr);
+}
+
+void handle_dupes(void)
+{
+    DupesResult res;
+    if (!dupes_take(&res)) {
+        return;
+    }
+    dupes.running = false;
+    if (control.library != dupes.library) {
+        /* Songs moved meanwhile: the rows of the copy are not ours */
+        dupes_result_free(&res);
+        dupes_rescan();
+        return;
+    }
+    if (res.keep != NULL && !dupes_collapse(&res)) {
+        running = LOOP_STOP;
+    }
+    dupes_result_free(&res);
+    session_apply();
+}
+
+void shared_now(Shared *s)
+{
+    *s = (Shared){
+        .songs = songarr->size,
+        .library = control.library,
+        .loading = load.loading,
+        .playing = player.playing,
+        .paused = player.paused,
+        .autoplay = player.autoplay,
+        .shuffle = player.shuffle,
+        .song = player.playing ? player.curr_idx : -1,
+        .time = player.playing ? (long)progress.time_pos : 0,
+        .duration = player.playing ? (long)progress.duration : 0,
+        .volume = progress.volume >= 0 ? (int)(progress.volume + 0.5) : -1,
+        .queue = playq_size(&player.playq),
+        .dupes = dupes.hidden != NULL ? dupes.hidden->size : 0,
+        .dupes_shown = dupes.show,
+    };
+    snprintf(s->track, sizeof(s->track), "%s",
+             player.playing ? player.curr_track : "");
+}
+
+int state_add(char *buf, size_t size, int len, const char *fmt, ...)
+{
+    if (len >= (int)size) {
+        return len;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    len += vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+int state_json(const Shared *now, const Shared *was, char *buf, size_t size)
+{
+    /* The fields of now that differ from was, or all of them without was.
+     * Returns the line length, 0 when nothing changed. */
+    const char *b[2] = { "false", "true" };
+    int len = snprintf(buf, size, "{\"event\":\"state\"");
+    int bare = len;
+    if (was == NULL || now->songs != was->songs) {
+        len = state_add(buf, size, len, ",\"songs\":%zu", now->songs);
+    }
+    if (was == NULL || now->library != was->library) {
+        len = state_add(buf, size, len, ",\"library\":%u", now->library);
+    }
+    if (was == NULL || now->loading != was->loading) {
+        len = state_add(buf, size, len, ",\"loading\":%s", b[now->loading]);
+    }
+    if (was == NULL || now->playing != was->playing) {
+        len = state_add(buf, size, len, ",\"playing\":%s", b[now->playing]);
+    }
+    if (was == NULL || now->paused != was->paused) {
+        len = state_add(buf, size, len, ",\"paused\":%s", b[now->paused]);
+    }
+    if (was == NULL || now->autoplay != was->autoplay) {
+        len = state_add(buf, size, len, ",\"autoplay\":%s",
+                        b[now->autoplay]);
+    }
+    if (was == NULL || now->shuffle != was->shuffle) {
+        len = state_add(buf, size, len, ",\"shuffle\":%s", b[now->shuffle]);
+    }
+    if (was == NULL || now->song != was->song) {
+        len = state_add(buf, size, len, ",\"song\":%d", now->song);
+    }
+    if (was == NULL || strcmp(now->track, was->track) != 0) {
+        char esc[MAX_SONGTITLE_LEN * 6 + 1];
+        json_escape(now->track, esc, sizeof(esc));
+        len = state_add(buf, size, len, ",\"track\":\"%s\"", esc);
+    }
+    if (was == NULL || now->time != was->time) {
+        len = state_add(buf, size, len, ",\"time\":%ld", now->time);
+    }
+    if (was == NULL || now->duration != was->duration) {
+        len = state_add(buf, size, len, ",\"duration\":%ld", now->duration);
+    }
+    if (was == NULL || now->volume != was->volume) {
+        len = state_add(buf, size, len, ",\"volume\":%d", now->volume);
+    }
+    if (was == NULL || now->queue != was->queue) {
+        len = state_add(buf, size, len, ",\"queue\":%zu", now->queue);
+    }
+    if (was == NULL || now->dupes != was->dupes) {
+        len = state_add(buf, size, len, ",\"duplicates\":%zu", now->dupes);
+    }
+    if (was == NULL || now->dupes_shown != was->dupes_shown) {
+        len = state_add(buf, size, len, ",\"duplicates_shown\":%s",
+                        b[now->dupes_shown]);
+    }
+    if (len == bare) {
+        return 0;
+    }
+    len = state_add(buf, size, len, "}\n");
+    return len < (int)size ? len : 0;
+}
+
+void control_publish(void)
+{
+    /* Once per loop pass: whatever changed goes to every client in one
+     * line. Positions are whole seconds, so playback costs a line a
+     * second, and nothing at all while idle. */
+    if (!control.on) {
+        return;
+    } else if (ctl_clients() == 0) {
+        shared_now(&control.told); /* A new client starts from here */
+        return;
+    }
+    Shared now;
+    char line[CONTROL_LINE_MAX];
+    shared_now(&now);
+    int len = state_json(&now, &control.told, line, sizeof(line));
+    if (len > 0) {
+        ctl_broadcast(line, len);
+        control.told = now;
+    }
+}
+
+void control_reply(CtlClient *c, const char *fmt, ...)
+{
+    /* {"reply":"ok"} or "error", with the fields in fmt added */
+    char line[CONTROL_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0 && len < (int)sizeof(line)) {
+        ctl_send(c, line, len);
+    }
+}
+
+void control_state(CtlClient *c)
+{
+    /* What the others were told last: deltas carry on from there */
+    char line[CONTROL_LINE_MAX];
+    int len = state_json(&control.told, NULL, line, sizeof(line));
+    if (len > 0) {
+        ctl_send(c, line, len);
+    }
+}
+
+void control_hello(CtlClient *c)
+{
+    char line[CONTROL_LINE_MAX];
+    int len = snprintf(line, sizeof(line),
+                       "{\"event\":\"hello\",\"version\":%d,\"roots\":[",
+                       CONTROL_VERSION);
+    for (size_t i = 0; i < opts.n_roots; i++) {
+        char root[PATH_MAX * 6 + 1];
+        json_escape(opts.roots[i], root, sizeof(root));
+        len += snprintf(line + len, sizeof(line) - len, "%s\"%s\"",
+                        i > 0 ? "," : "", root);
+        if (len >= (int)sizeof(line) - 3) {
+            return; /* Not worth a partial greeting */
+        }
+    }
+    len += snprintf(line + len, sizeof(line) - len, "]}\n");
+    ctl_send(c, line, len);
+    control_state(c);
+}
+
+bool control_arg(const char *arg, long min, long max, long *out)
+{
+    char *end;
+    if (arg == NULL) {
+        return false;
+    }
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || n < min || n > max) {
+        return false;
+    }
+    *out = n;
+    return true;
+}
+
+void control_song(CtlClient *c, long idx)
+{
+    char path[PATH_MAX];
+    char label[MAX_SONGTITLE_LEN+1];
+    char esc_path[PATH_MAX * 6 + 1];
+    char esc_label[MAX_SONGTITLE_LEN * 6 + 1];
+    if (songarr_path(songarr, idx, path, sizeof(path)) >= sizeof(path)) {
+        control_reply(c, "{\"reply\":\"error\",\"error\":\"path\"}\n");
+        return;
+    }
+    json_escape(path, esc_path, sizeof(esc_path));
+    json_escape(song_label(idx, label, sizeof(label)), esc_label,
+                sizeof(esc_label));
+    control_reply(c, "{\"reply\":\"ok\",\"song\":%ld,\"path\":\"%s\","
+                     "\"track\":\"%s\"}\n", idx, esc_path, esc_label);
+}
+
+void control_command(CtlClient *c, char *line)
+{
+    /* "name [argument]", the same actions as the keys. Songs are library
+     * rows, valid for the "library" generation they were read in. */
+    char *save;
+    char *cmd = strtok_r(line, " \t", &save);
+    char *arg = strtok_r(NULL, " \t", &save);
+    long songs = (long)songarr->size - 1;
+    long n = 0;
+    if (cmd == NULL) {
+        return;
+    } else if (strcmp(cmd, "play") == 0 && control_arg(arg, 0, songs, &n)) {
+        player.shuffle = false;
+        event_playsong((int)n);
+    } else if (strcmp(cmd, "next") == 0) {
+        skip_next();
+    } else if (strcmp(cmd, "prev") == 0) {
+        skip_prev();
+    } else if (strcmp(cmd, "pause") == 0) {
+        event_pause();
+    } else if (strcmp(cmd, "autoplay") == 0) {
+        event_autoplay();
+    } else if (strcmp(cmd, "shuffle") == 0) {
+        event_shuffle();
+        event_playsong(player.shuffle_idx);
+    } else if (strcmp(cmd, "seek") == 0 &&
+               control_arg(arg, -86400, 86400, &n)) {
+        if (player.playing) {
+            mpv_seek((int)n);
+        }
+    } else if (strcmp(cmd, "volume") == 0 && control_arg(arg, -100, 100, &n)) {
+        mpv_volume((int)n);
+    } else if ((strcmp(cmd, "queue") == 0 || strcmp(cmd, "queue-next") == 0)
+               && control_arg(arg, 0, songs, &n)) {
+        queue_song((int)n, strcmp(cmd, "queue-next") == 0);
+    } else if (strcmp(cmd, "unqueue") == 0 &&
+               control_arg(arg, 0, (long)playq_size(&player.playq) - 1, &n)) {
+        queue_remove(n);
+    } else if (strcmp(cmd, "song") == 0 && control_arg(arg, 0, songs, &n)) {
+        control_song(c, n);
+        return;
+    } else if (strcmp(cmd, "duplicates") == 0) {
+        dupes_toggle();
+    } else if (strcmp(cmd, "state") == 0) {
+        control_state(c);
+        return;
+    } else if (strcmp(cmd, "quit") == 0) {
+        running = LOOP_STOP;
+    } else {
+        control_reply(c, "{\"reply\":\"error\",\"error\":"
+                         "\"unknown command or bad argument\"}\n");
+        return;
+    }
+    sess.dirty = true;
+    control_reply(c, "{\"reply\":\"ok\"}\n");
+}
+
+bool control_init(void)
+{
+    char path[PATH_MAX];
+    const char *at = opts.control_path;
+    if (at == NULL) {
+        if (!ctl_default_path(path, sizeof(path))) {
+            fprintf(stderr, "XDG_RUNTIME_DIR is not set, "
+                            "give the socket with --control PATH\n");
+            return false;
+        }
+        at = path;
+    }
+    int fd = ctl_init(at, control_command, control_hello);
+    if (fd == -1) {
+        return false;
+    }
+    fds[FD_CTL].fd = fd;
+    shared_now(&control.told);
+    control.on = true;
+    return true;
+}
+
+void switch_keypress(int key)
+{
+    if (ui.searching && switch_searchkey(key)) {
+        return;
+    }
+    switch (key) {
+        case KEY_RESIZE: {
+            update_maxyx();
+            resize_windows();
+            update_maxyx(); /* Again, for the new window sizes */
+            resize_items();
+            ui.menu.stale = true;
+            ui.view.stale = true;
+            break;
+        }
+        case 'k':
+        case KEY_UP: {
+            cursor_scroll_up();
+            break;
+        }
+        case 'g': {
+            cursor_scroll_top();
+            break;
+        }
+        case 'j':
+        case KEY_DOWN: {
+            cursor_scroll_down();
+            break;
+        }
+        case 'G': {
+            cursor_scroll_bottom();
+            break;
+        }
+        case '\n':
+        case KEY_ENTER: {
+            if (ui.mode == MENU_TREE) {
+                tree_open(ui.menu.offset_idx + ui.curs.y - 1);
+                break;
+            } else if (ui.mode == MENU_QUEUE) {
+                event_playqueued(ui.menu.offset_idx + ui.curs.y - 1);
+                break;
+            }
+            if (player.shuffle) {
+                player.shuffle = false;
+            }
+            int idx = menu_song(ui.menu.offset_idx + ui.curs.y - 1);
+            if (idx == -1) {
+                break;
+            }
+            event_playsong(idx);
+            break;
+        }
         case KEY_LEFT: {
             if (player.playing) {
                 mpv_seek(-5);
@@ -494,52 +2446,77 @@ void switch_keypress(int key)
             break;
         }
         case ',': {
-            if (!player.playing) {
-                break;
-            }
-            int idx = event_prev();
-            event_playsong(idx);
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
+            skip_prev();
             break;
         }
         case '.': {
-            if (!player.playing) {
-                break;
-            }
-            int idx = event_next();
-            if (idx >= (int)songarr->size) {
-                break;
-            }
-            event_playsong(idx);
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
+            skip_next();
             break;
         }
         case ' ':
         case 'p': {
-            mpv_cycle_pause();
-            player.paused = !player.paused;
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
+            event_pause();
             break;
         }
         case 'a': {
-            player.autoplay = !player.autoplay;
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
+            event_autoplay();
             break;
         }
         case 's': {
             event_shuffle();
             event_playsong(player.shuffle_idx);
-            clear_window(ui.view.w);
-            draw_viewer();
-            wrefresh(ui.view.w);
+            break;
+        }
+        case '/': {
+            search_start();
+            break;
+        }
+        case 27: { /* ESC */
+            if (search.len > 0) {
+                search_end();
+            }
+            break;
+        }
+        case 't': {
+            tree_view_toggle();
+            break;
+        }
+        case 'u': {
+            queue_view_toggle();
+            break;
+        }
+        case 'e':
+        case 'n': {
+            queue_add(key == 'n');
+            break;
+        }
+        case 'K': {
+            queue_move(-1);
+            break;
+        }
+        case 'J': {
+            queue_move(1);
+            break;
+        }
+        case 'x': {
+            queue_drop();
+            break;
+        }
+        case 'h': {
+            if (ui.mode == MENU_TREE) {
+                tree_close_parent(ui.menu.offset_idx + ui.curs.y - 1);
+            }
+            break;
+        }
+        case 'D': {
+            dupes_toggle();
+            break;
+        }
+        case 'i': {
+            /* Collecting starts with the overlay, unless --stats is on */
+            ui.stats_shown = !ui.stats_shown;
+            stats_enabled = ui.stats_shown || opts.stats_path != NULL;
+            ui.view.stale = true;
             break;
         }
         case 'q': {
@@ -550,83 +2527,150 @@ void switch_keypress(int key)
     }
 }
 
-void eof_event_shuffle(void)
-{
-    int idx = player.shuffle_idx + 1;
-    if (idx >= (int)songarr->size) {
-        player.playing = false;
-        player.shuffle = false;
-    } else {
-        event_playsong(player.shuffle_idx+1);
-    }
-}
-
-void eof_event_autoplay(void)
-{
-    int idx = player.curr_idx + 1;
-    if (idx >= (int)songarr->size) {
-        player.playing = false;
-    } else {
-        event_playsong(player.curr_idx+1);
-    }
-}
-
-void handle_mpv_properties(void)
+int loop_timeout(void)
 {
-    MPVProp p = mpv_property(fds[0].fd);
-    if (p == PROP_EOF) {
-        /* End of song reached */
-        if (player.shuffle) {
-            eof_event_shuffle();
-        } else if (player.autoplay) {
-            eof_event_autoplay();
-        } else {
-            player.playing = false;
-        }
-        clear_window(ui.view.w);
-        draw_viewer();
-        wrefresh(ui.view.w);
+    /* The nearer of the settled library changes and tag relabeling */
+    int watch = watch_timeout();
+    int tags = relabel_timeout();
+    if (watch < 0 || (tags >= 0 && tags < watch)) {
+        return tags;
     }
+    return watch;
 }
 
 void event_loop(void)
 {
-    /* Draw initial screen */
-    update_maxyx();
-    box(ui.menu.w, 0, 0);
-    box(ui.view.w, 0, 0);
-    draw_menu();
-    draw_viewer();
-    refresh_windows();
+    if (ncurses_initialized) {
+        update_maxyx();
+    }
 
     /* Enter event loop */
     int ch;
     while (running) {
-        cursor_move_pos();
-        wrefresh(ui.menu.w);
-        poll(fds, 2, -1); /* Blocking */
-        if (fds[0].revents & POLLIN) {
-            handle_mpv_properties();
-        } else {
-            ch = wgetch(ui.menu.w); /* Non-Blocking */
-            if (ch != ERR) {
+        if (ncurses_initialized) {
+            render_frame();
+        }
+        /* Blocking, unless library changes or tags are waiting to settle */
+        int ready = poll(fds, N_FDS, loop_timeout());
+        uint64_t woke = stats_start();
+        wake.events = 0;
+        if (fds[FD_WATCH].revents & POLLIN) {
+            watch_read();
+            wake.events++;
+        }
+        if (fds[FD_MPV].revents & (POLLIN | POLLHUP)) {
+            handle_mpv_events();
+        }
+        if (fds[FD_TIMER].revents & POLLIN) {
+            progress_tick();
+            wake.events++;
+        }
+        if (fds[FD_TAGS].revents & POLLIN) {
+            handle_tags();
+            wake.events++;
+        }
+        if (fds[FD_CTL].revents & POLLIN) {
+            ctl_handle();
+            wake.events++;
+        }
+        bool keyed = false;
+        if (ready != 0 && ncurses_initialized) {
+            /* Non-Blocking: take the whole burst of keys at once */
+            while (running) {
+                /* Untouched, so wgetch has nothing to paint over the menu */
+                untouchwin(ui.input);
+                if ((ch = wgetch(ui.input)) == ERR) {
+                    break;
+                }
+                if (wake.key_ns == 0) {
+                    wake.key_ns = woke;
+                }
+                wake.events++;
+                keyed = true;
                 switch_keypress(ch);
             }
         }
+        /* Keys are drawn before a merge; the eventfd stays readable */
+        if (!keyed && (fds[FD_LOAD].revents & POLLIN)) {
+            handle_load();
+            wake.events++;
+        }
+        if (!keyed && (fds[FD_DUPES].revents & POLLIN)) {
+            handle_dupes();
+            wake.events++;
+        }
+        if (watch_timeout() == 0) {
+            library_refresh();
+        }
+        if (relabel_timeout() == 0) {
+            search_relabel();
+        }
+        session_autosave(keyed);
+        control_publish();
+        /* Commands queued above go out together; the rest on POLLOUT */
+        if (!mpv_flush()) {
+            running = LOOP_STOP;
+        }
+        fds[FD_MPV].events = POLLIN | (mpv_write_pending() ? POLLOUT : 0);
+        if (woke != 0) {
+            stats_record(STAT_WAKE_EVENTS, wake.events);
+        }
     }
 }
 
+void print_render_stats(void)
+{
+    unsigned long long avg = render.frames > 0
+                             ? render.bytes / render.frames : 0;
+    fprintf(stderr, "render: %llu frames, %llu bytes, %llu bytes/frame "
+                    "(max %llu)\n", render.frames, render.bytes, avg,
+                    render.max_frame);
+}
+
 void cleanup(void)
 {
     if (ncurses_initialized) {
         ui_destroy();
     }
+    if (control.on) {
+        ctl_destroy();
+    }
+    if (loader_initialized) {
+        loader_stop();
+    }
+    session_store();
+    session_free(&sess.saved);
+    if (render.io_fd != -1) {
+        print_render_stats();
+        close(render.io_fd);
+    }
+    if (opts.stats_path != NULL && !stats_dump(opts.stats_path)) {
+        fprintf(stderr, "Error writing %s\n", opts.stats_path);
+    }
     if (mpv_initialized) {
         mpv_terminate();
     }
+    if (tags_initialized) {
+        tags_destroy();
+    }
+    dupes_destroy();
+    if (dupes.hidden != NULL) {
+        songarr_destroy(dupes.hidden);
+    }
+    if (tree_initialized) {
+        tree_destroy();
+    }
+    if (watch_initialized) {
+        watch_destroy();
+    }
+    if (progress.fd != -1) {
+        close(progress.fd);
+    }
     if (player_initialized) {
-        free(player.order);
+        shuffle_destroy(&player.order);
+        playq_clear(&player.playq);
     }
+    search_clear(&search);
     if (songarr_initialized) {
         songarr_destroy(songarr);
     }
@@ -638,31 +2682,262 @@ void handle_sigint(int sig)
     running = LOOP_STOP;
 }
 
+void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] <music-dirname>...\n", prog);
+    fprintf(stderr, "  -j, --jobs N   directory scanner threads "
+                    "(default: one per CPU)\n");
+    fprintf(stderr, "  -r, --rescan   ignore the cached library index\n");
+    fprintf(stderr, "  -f, --fps N    progress redraws per second "
+                    "(default: 4)\n");
+    fprintf(stderr, "  --render-stats print bytes sent to the terminal "
+                    "on exit\n");
+    fprintf(stderr, "  --mpv-socket PATH\n"
+                    "                 let MPV listen on PATH too, for other "
+                    "clients\n");
+    fprintf(stderr, "  --stats FILE   record latency histograms, written to "
+                    "FILE on exit\n");
+    fprintf(stderr, "  --seed N       shuffle seed, for orders that repeat "
+                    "(default: the clock)\n");
+    fprintf(stderr, "  --mpv-connect PATH\n"
+                    "                 use the MPV (or tools/mockmpv) already "
+                    "listening on PATH\n");
+    fprintf(stderr, "  --daemon       play without a terminal, for clients "
+                    "of the control socket\n");
+    fprintf(stderr, "  --control PATH serve the control socket on PATH "
+                    "(--daemon default:\n"
+                    "                 $XDG_RUNTIME_DIR/reed.sock)\n");
+    fprintf(stderr, "  Or: %s --attach PATH\n"
+                    "                 talk to the control socket at PATH "
+                    "from this terminal\n", prog);
+}
+
+bool parse_args(int argc, char *argv[])
+{
+    static const struct option long_opts[] = {
+        { "jobs",   required_argument, NULL, 'j' },
+        { "rescan", no_argument,       NULL, 'r' },
+        { "fps",    required_argument, NULL, 'f' },
+        { "render-stats", no_argument, NULL, 'S' },
+        { "mpv-socket", required_argument, NULL, 'M' },
+        { "mpv-connect", required_argument, NULL, 'C' },
+        { "stats", required_argument, NULL, 'H' },
+        { "seed", required_argument, NULL, 'R' },
+        { "daemon", no_argument,       NULL, 'D' },
+        { "control", required_argument, NULL, 'L' },
+        { "attach", required_argument, NULL, 'A' },
+        { NULL,     0,                 NULL, 0   },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "j:rf:", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'j': {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (*end != '\0' || n < 1) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    return false;
+                }
+                opts.lib.n_threads = (int)n;
+                break;
+            }
+            case 'r': {
+                opts.lib.rescan = true;
+                break;
+            }
+            case 'f': {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (*end != '\0' || n < 1 || n > 1000) {
+                    fprintf(stderr, "Invalid frame rate: %s\n", optarg);
+                    return false;
+                }
+                opts.fps = (int)n;
+                break;
+            }
+            case 'S': {
+                opts.render_stats = true;
+                break;
+            }
+            case 'M': {
+                opts.mpv_socket = optarg;
+                break;
+            }
+            case 'C': {
+                opts.mpv_connect = optarg;
+                break;
+            }
+            case 'H': {
+                opts.stats_path = optarg;
+                stats_enabled = true;
+                break;
+            }
+            case 'R': {
+                char *end;
+                errno = 0;
+                unsigned long long n = strtoull(optarg, &end, 0);
+                if (*end != '\0' || end == optarg || errno != 0) {
+                    fprintf(stderr, "Invalid seed: %s\n", optarg);
+                    return false;
+                }
+                opts.seed = n;
+                opts.seeded = true;
+                break;
+            }
+            case 'D': {
+                opts.daemon = true;
+                break;
+            }
+            case 'L': {
+                opts.control_path = optarg;
+                break;
+            }
+            case 'A': {
+                opts.attach = optarg;
+                break;
+            }
+            default: return false;
+        }
+    }
+    if (opts.attach != NULL) {
+        return optind == argc; /* No library of its own */
+    }
+    if (optind == argc) {
+        return false;
+    }
+    opts.roots = (const char **)&argv[optind];
+    opts.n_roots = (size_t)(argc - optind);
+    return true;
+}
+
+bool path_within(const char *path, const char *dir)
+{
+    /* Both resolved: no trailing '/' but for "/" itself */
+    size_t len = strlen(dir);
+    return strncmp(path, dir, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/' || len == 1);
+}
+
+bool roots_check(void)
+{
+    /* A root inside another (or the same one twice) would list its songs
+     * twice over: only the outermost is kept */
+    char (*real)[PATH_MAX] = malloc(opts.n_roots * sizeof(*real));
+    if (real == NULL) {
+        return false;
+    }
+    size_t n = 0;
+    bool ok = true;
+    for (size_t i = 0; i < opts.n_roots && ok; i++) {
+        DIR *dir = opendir(opts.roots[i]);
+        if (dir == NULL || realpath(opts.roots[i], real[n]) == NULL) {
+            fprintf(stderr, "Error reading from directory: %s\n",
+                    opts.roots[i]);
+            ok = false;
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        bool nested = false;
+        for (size_t j = 0; j < n && ok && !nested; j++) {
+            nested = path_within(real[n], real[j]);
+        }
+        if (!ok || nested) {
+            continue;
+        }
+        /* It takes the place of the first root it holds: that order is
+         * the one duplicates are kept in */
+        size_t at = n;
+        size_t kept = 0;
+        for (size_t j = 0; j < n; j++) {
+            if (!path_within(real[j], real[n])) {
+                memmove(real[kept], real[j], sizeof(real[j]));
+                opts.roots[kept++] = opts.roots[j];
+            } else if (at == n) {
+                at = kept++;
+            }
+        }
+        if (at < n) {
+            memmove(real[at], real[n], sizeof(real[n]));
+        } else {
+            kept = n + 1;
+        }
+        opts.roots[at] = opts.roots[i];
+        n = kept;
+    }
+    free(real);
+    opts.n_roots = n;
+    return ok;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <music-dirname>\n", argv[0]);
+    if (!parse_args(argc, argv)) {
+        print_usage(argv[0]);
         return 1;
     }
-    srand((unsigned) time(NULL));
+    if (opts.attach != NULL) {
+        return ctl_attach(opts.attach) ? 0 : 1;
+    }
+    if (!opts.seeded) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        opts.seed = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    }
+
+    /* Only collation follows the locale: the mpv protocol needs '.' decimals */
+    setlocale(LC_COLLATE, "");
+    collate_init();
+    search_init(&search, song_label);
 
-    /* Setup SIGINT handler */
+    /* Setup SIGINT handler, and SIGTERM for a service manager */
     struct sigaction sa;
     sa.sa_handler = handle_sigint;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+        sigaction(SIGTERM, &sa, NULL) == -1) {
         fprintf(stderr, "Error, sigaction failed\n");
         return 1;
     }
 
-    /* Build song playlist */
-    songarr = songarr_init(argv[1]);
+    /* Start MPV first: it loads while the library is read, and the
+     * observe commands wait in the socket until it gets to them. */
+    int mpv_fd = opts.mpv_connect != NULL ? mpv_connect(opts.mpv_connect)
+                                          : mpv_init(opts.mpv_socket);
+    if (mpv_fd == -1) {
+        fprintf(stderr, "Error initializing MPV\n");
+        cleanup();
+        return 1;
+    }
+    mpv_initialized = true;
+    mpv_observe(OBS_TIME_POS, "time-pos");
+    mpv_observe(OBS_DURATION, "duration");
+    mpv_observe(OBS_VOLUME, "volume");
+    mpv_observe(OBS_PATH, "path");
+
+    /* Build song playlist: empty at first, the loader fills it in while
+     * the UI runs. Only an unreadable root is worth waiting for. */
+    if (!roots_check()) {
+        cleanup();
+        return 1;
+    }
+    songarr = songarr_new();
     if (songarr == NULL) {
-        fprintf(stderr, "Error reading from directory: %s\n", argv[1]);
+        fprintf(stderr, "Error allocating song playlist\n");
+        cleanup();
         return 1;
     }
     songarr_initialized = true;
+    int load_fd = loader_start(opts.roots, opts.n_roots, &opts.lib);
+    if (load_fd == -1) {
+        fprintf(stderr, "Error starting library loader\n");
+        cleanup();
+        return 1;
+    }
+    loader_initialized = true;
+    load.loading = true;
 
     /* Setup player struct */
     if (!player_init(songarr->size)) {
@@ -672,39 +2947,92 @@ int main(int argc, char *argv[])
     }
     player_initialized = true;
 
-    /* Initialize MPV */
-    int mpv_fd = mpv_init();
-    if (mpv_fd == -1) {
-        fprintf(stderr, "Error initializing MPV\n");
+    /* Progress redraws are paced by a timer */
+    progress.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (progress.fd == -1) {
+        fprintf(stderr, "Error creating progress timer\n");
         cleanup();
         return 1;
     }
-    mpv_initialized = true;
+    progress.period_ns = 1000000000LL / opts.fps;
+
+    if (opts.render_stats) {
+        render.io_fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+        if (render.io_fd == -1) {
+            fprintf(stderr, "Error opening /proc/thread-self/io\n");
+            cleanup();
+            return 1;
+        }
+    }
 
-    /* Setup polling. */
-    fds[0].fd = mpv_fd;
-    fds[0].events = POLLIN;
-    fds[1].fd = STDIN_FILENO;
-    fds[1].events = POLLIN;
+    /* Read tags in the background (optional as well) */
+    int tags_fd = tags_init(opts.roots, opts.n_roots, opts.lib.n_threads);
+    tags_initialized = (tags_fd != -1);
+    if (tags_initialized) {
+        tags_feed(songarr);
+    }
 
-    /* Initialize ncurses */
-    if (!ui_init_core()) {
-        fprintf(stderr, "Error initializing MPV\n");
+    /* Duplicates are looked for once the library is in (optional too) */
+    int dupes_fd = dupes_init(opts.roots, opts.n_roots, opts.lib.n_threads);
+    dupes.hidden = songarr_new();
+    dupes.on = (dupes_fd != -1 && dupes.hidden != NULL);
+
+    /* Setup polling. */
+    fds[FD_MPV].fd = mpv_fd;
+    fds[FD_MPV].events = POLLIN;
+    fds[FD_STDIN].fd = opts.daemon ? -1 : STDIN_FILENO;
+    fds[FD_STDIN].events = POLLIN;
+    /* Watching the library (optional) starts once it is loaded */
+    fds[FD_WATCH].fd = -1;
+    fds[FD_WATCH].events = POLLIN;
+    fds[FD_TIMER].fd = progress.fd;
+    fds[FD_TIMER].events = POLLIN;
+    fds[FD_TAGS].fd = tags_fd;
+    fds[FD_TAGS].events = POLLIN;
+    fds[FD_LOAD].fd = load_fd;
+    fds[FD_LOAD].events = POLLIN;
+    fds[FD_CTL].fd = -1;
+    fds[FD_CTL].events = POLLIN;
+    fds[FD_DUPES].fd = dupes.on ? dupes_fd : -1;
+    fds[FD_DUPES].events = POLLIN;
+
+    /* Scripts and remote front-ends drive the same player as the keys */
+    if ((opts.daemon || opts.control_path != NULL) && !control_init()) {
+        fprintf(stderr, "Error opening the control socket\n");
         cleanup();
         return 1;
     }
-    if (!ui_init_windows()) {
-        fprintf(stderr, "Error initializing MPV\n");
-        endwin();
-        cleanup();
-        return 1;
+
+    /* Initialize ncurses */
+    if (!opts.daemon) {
+        if (!ui_init_core()) {
+            fprintf(stderr, "Error initializing MPV\n");
+            cleanup();
+            return 1;
+        }
+        if (!ui_init_windows()) {
+            fprintf(stderr, "Error initializing MPV\n");
+            endwin();
+            cleanup();
+            return 1;
+        }
+        ui_init_colors();
+        ncurses_initialized = true;
     }
-    ui_init_colors();
-    ncurses_initialized = true;
 
+    session_resume();
+    sess.ready = true;
     event_loop();
 
     cleanup();
+    if (load.failed) {
+        fprintf(stderr, "Error reading from the library\n");
+        return 1;
+    }
+    if (mpv_lost) {
+        fprintf(stderr, "MPV exited unexpectedly\n");
+        return 1;
+    }
     return 0;
 }
 
@@ -0,0 +1,412 @@
+/* File: scan.c
+ * Date: 2026-10-17
+ *
+ * Parallel directory walker.
+ *
+ * Each worker owns a deque of directories still to be read. A worker pops
+ * from the tail of its own deque (depth-first, keeps the dentry cache warm)
+ * and steals from the head of another worker's deque when it runs dry.
+ * Files and directories are appended to a per-worker SongArr and merged
+ * into the caller's SongArr once every worker has finished, so the hot path
+ * takes no shared locks besides the owner's deque lock. Regular files that
+ * are not audio (see filetype.c) are dropped before they reach a SongArr.
+ *
+ * With a batch callback, a worker instead hands over its SongArr whenever
+ * it holds SCAN_BATCH files, and whatever is left once the scan is over, so
+ * the caller sees the library while it grows. A directory split across
+ * batches is listed in each of them.
+ */
+
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "filetype.h"
+#include "scan.h"
+#include "songarr.h"
+
+#define DEQUE_INIT_CAP 64
+#define MAX_THREADS 64
+#define SCAN_BATCH 4096
+
+typedef struct {
+    pthread_mutex_t lock;
+    char **jobs; /* Directory paths, owned by the deque */
+    size_t head;
+    size_t tail;
+    size_t cap;
+} JobDeque;
+
+struct Scanner;
+
+typedef struct {
+    pthread_t tid;
+    struct Scanner *sc;
+    int id;
+    JobDeque dq;
+    SongArr *songs;
+} Worker;
+
+typedef struct Scanner {
+    const ScanOpts *opts;
+    Worker *workers;
+    int n_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t queued;  /* Jobs sitting in a deque */
+    size_t pending; /* Jobs queued or being processed */
+    bool failed;
+} Scanner;
+
+static char *join_path(const char *root, const char *branch)
+{
+    size_t root_len = strlen(root);
+    size_t branch_len = strlen(branch);
+    char *full_path = malloc(root_len + branch_len + 2);
+    if (full_path == NULL) {
+        return NULL;
+    }
+
+    memcpy(full_path, root, root_len);
+    full_path[root_len] = '/';
+    memcpy(full_path + root_len + 1, branch, branch_len + 1);
+
+    return full_path;
+}
+
+static bool deque_init(JobDeque *dq)
+{
+    dq->jobs = malloc(DEQUE_INIT_CAP * sizeof(char *));
+    if (dq->jobs == NULL) {
+        return false;
+    }
+    dq->head = 0;
+    dq->tail = 0;
+    dq->cap = DEQUE_INIT_CAP;
+    pthread_mutex_init(&dq->lock, NULL);
+    return true;
+}
+
+static void deque_destroy(JobDeque *dq)
+{
+    for (size_t i = dq->head; i < dq->tail; i++) {
+        free(dq->jobs[i]);
+    }
+    free(dq->jobs);
+    pthread_mutex_destroy(&dq->lock);
+}
+
+static bool deque_push(JobDeque *dq, char *path)
+{
+    bool ok = true;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        if (dq->head > 0) {
+            /* Reclaim the space freed by thieves before growing */
+            size_t n = dq->tail - dq->head;
+            memmove(dq->jobs, dq->jobs + dq->head, n * sizeof(char *));
+            dq->head = 0;
+            dq->tail = n;
+        }
+        if (dq->tail == dq->cap) {
+            char **tmp = realloc(dq->jobs, 2 * dq->cap * sizeof(char *));
+            if (tmp == NULL) {
+                ok = false;
+                goto out;
+            }
+            dq->jobs = tmp;
+            dq->cap *= 2;
+        }
+    }
+    dq->jobs[dq->tail++] = path;
+
+    out:
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static char *deque_pop(JobDeque *dq)
+{
+    char *path = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        path = dq->jobs[--dq->tail];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return path;
+}
+
+static char *deque_steal(JobDeque *dq)
+{
+    char *path = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        path = dq->jobs[dq->head++];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return path;
+}
+
+static void scanner_fail(Scanner *sc)
+{
+    pthread_mutex_lock(&sc->lock);
+    sc->failed = true;
+    pthread_mutex_unlock(&sc->lock);
+}
+
+static bool submit_job(Worker *w, char *path)
+{
+    Scanner *sc = w->sc;
+    if (!deque_push(&w->dq, path)) {
+        free(path);
+        return false;
+    }
+    pthread_mutex_lock(&sc->lock);
+    sc->queued++;
+    sc->pending++;
+    pthread_cond_signal(&sc->cond);
+    pthread_mutex_unlock(&sc->lock);
+    return true;
+}
+
+static char *take_job(Worker *w)
+{
+    Scanner *sc = w->sc;
+    char *path = deque_pop(&w->dq);
+    for (int i = 1; path == NULL && i < sc->n_workers; i++) {
+        path = deque_steal(&sc->workers[(w->id + i) % sc->n_workers].dq);
+    }
+    if (path != NULL) {
+        pthread_mutex_lock(&sc->lock);
+        sc->queued--;
+        pthread_mutex_unlock(&sc->lock);
+    }
+    return path;
+}
+
+static void finish_job(Scanner *sc)
+{
+    pthread_mutex_lock(&sc->lock);
+    if (--sc->pending == 0) {
+        pthread_cond_broadcast(&sc->cond);
+    }
+    pthread_mutex_unlock(&sc->lock);
+}
+
+static bool hand_over(Worker *w, const char *dirname, struct timespec mtime,
+                      uint32_t *dir)
+{
+    /* dirname, if any, is being read: the next batch lists it again */
+    const ScanOpts *opts = w->sc->opts;
+    SongArr *next = songarr_new();
+    if (next == NULL) {
+        return false;
+    }
+    if (dirname != NULL && !songarr_add_dir(next, dirname, mtime, dir)) {
+        songarr_destroy(next);
+        return false;
+    }
+    SongArr *songs = w->songs;
+    w->songs = next;
+    return opts->batch(songs, opts->ctx);
+}
+
+static bool scan_one(Worker *w, const char *dirname)
+{
+    int fd = openat(AT_FDCWD, dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    DIR *pdir = fdopendir(fd);
+    if (pdir == NULL) {
+        close(fd);
+        return false;
+    }
+
+    bool exit_status = false;
+    struct stat st;
+    uint32_t dir;
+    /* Take the mtime before reading, so a racing change forces a rescan */
+    if (fstat(fd, &st) == -1 ||
+        !songarr_add_dir(w->songs, dirname, st.st_mtim, &dir)) {
+        goto out;
+    }
+
+    const ScanOpts *opts = w->sc->opts;
+    struct dirent *entry;
+    while ((entry = readdir(pdir)) != NULL) {
+        switch (entry->d_type) {
+            case DT_DIR: {
+                if (entry->d_name[0] == '.') {
+                    break;
+                }
+                char *full_path = join_path(dirname, entry->d_name);
+                if (full_path == NULL) {
+                    goto out;
+                }
+                if (opts->skip_dir != NULL &&
+                    opts->skip_dir(full_path, opts->ctx)) {
+                    free(full_path);
+                    break;
+                }
+                if (!submit_job(w, full_path)) {
+                    goto out;
+                }
+                break;
+            }
+            case DT_REG: {
+                if (!filetype_is_audio(fd, entry->d_name)) {
+                    break;
+                }
+                if (!songarr_append(w->songs, dir, entry->d_name)) {
+                    goto out;
+                }
+                if (opts->batch != NULL && w->songs->size >= SCAN_BATCH &&
+                    !hand_over(w, dirname, st.st_mtim, &dir)) {
+                    goto out;
+                }
+                break;
+            }
+            default: break;
+        }
+    }
+    exit_status = true;
+
+    out:
+    closedir(pdir);
+    return exit_status;
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *w = arg;
+    Scanner *sc = w->sc;
+
+    for (;;) {
+        char *path = take_job(w);
+        if (path != NULL) {
+            bool failed;
+            pthread_mutex_lock(&sc->lock);
+            failed = sc->failed;
+            pthread_mutex_unlock(&sc->lock);
+            /* After a failure, keep draining so pending reaches zero */
+            if (!failed && !scan_one(w, path)) {
+                scanner_fail(sc);
+            }
+            free(path);
+            finish_job(sc);
+            continue;
+        }
+
+        pthread_mutex_lock(&sc->lock);
+        while (sc->queued == 0 && sc->pending > 0) {
+            pthread_cond_wait(&sc->cond, &sc->lock);
+        }
+        bool done = (sc->pending == 0);
+        pthread_mutex_unlock(&sc->lock);
+        if (done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int scan_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) {
+        n = 1;
+    }
+    return (int)n;
+}
+
+bool scan_tree(const char *const *roots, size_t n_roots,
+               const ScanOpts *opts, SongArr *songarr)
+{
+    int n_threads = opts->n_threads;
+    if (n_threads <= 0) {
+        n_threads = scan_default_threads();
+    }
+    if (n_threads > MAX_THREADS) {
+        n_threads = MAX_THREADS;
+    }
+
+    Scanner sc = { .opts = opts, .n_workers = 0, .queued = 0, .pending = 0 };
+    bool exit_status = false;
+    pthread_mutex_init(&sc.lock, NULL);
+    pthread_cond_init(&sc.cond, NULL);
+    sc.workers = calloc(n_threads, sizeof(Worker));
+    if (sc.workers == NULL) {
+        goto out;
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        Worker *w = &sc.workers[i];
+        w->sc = &sc;
+        w->id = i;
+        w->songs = songarr_new();
+        if (w->songs == NULL) {
+            goto out;
+        }
+        if (!deque_init(&w->dq)) {
+            songarr_destroy(w->songs);
+            goto out;
+        }
+        sc.n_workers++;
+    }
+
+    for (size_t i = 0; i < n_roots; i++) {
+        char *root_path = strdup(roots[i]);
+        Worker *w = &sc.workers[i % sc.n_workers];
+        if (root_path == NULL || !submit_job(w, root_path)) {
+            goto out;
+        }
+    }
+
+    /* The calling thread doubles as worker 0 */
+    int started = 1;
+    for (int i = 1; i < sc.n_workers; i++, started++) {
+        Worker *w = &sc.workers[i];
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0) {
+            break;
+        }
+    }
+    worker_main(&sc.workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(sc.workers[i].tid, NULL);
+    }
+    if (sc.failed) {
+        goto out;
+    }
+
+    for (int i = 0; i < sc.n_workers; i++) {
+        Worker *w = &sc.workers[i];
+        if (opts->batch != NULL) {
+            bool empty = (w->songs->size == 0 && w->songs->n_dirs == 0);
+            struct timespec none = { 0, 0 };
+            if (!empty && !hand_over(w, NULL, none, NULL)) {
+                goto out;
+            }
+        } else if (!songarr_merge(songarr, w->songs)) {
+            goto out;
+        }
+    }
+    exit_status = true;
+
+    out:
+    for (int i = 0; i < sc.n_workers; i++) {
+        deque_destroy(&sc.workers[i].dq);
+        songarr_destroy(sc.workers[i].songs);
+    }
+    free(sc.workers);
+    pthread_cond_destroy(&sc.cond);
+    pthread_mutex_destroy(&sc.lock);
+    return exit_status;
+}
@@ -0,0 +1,30 @@
+/* File: scan.h
+ * Date: 2026-10-17
+ *
+ * Parallel directory walker.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include "songarr.h"
+
+typedef struct {
+    int n_threads; /* <= 0 selects one worker per online CPU */
+    /* Optional: return true to leave a subdirectory unread */
+    bool (*skip_dir)(const char *path, void *ctx);
+    /* Optional: takes ownership of each worker's files (and directories)
+     * as they pile up, instead of them being merged into the caller's
+     * SongArr at the end. Called from worker threads; return false to stop
+     * the scan. */
+    bool (*batch)(SongArr *songs, void *ctx);
+    void *ctx;
+} ScanOpts;
+
+bool scan_tree(const char *const *roots, size_t n_roots,
+               const ScanOpts *opts, SongArr *songarr);
+int scan_default_threads(void);
+
+#endif
+
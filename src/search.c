@@ -0,0 +1,303 @@
+/* File: search.c
+ * Date: 2026-10-17
+ *
+ * Incremental fuzzy search over song labels.
+ *
+ * A song matches when the query is a case-insensitive subsequence of its
+ * label, the text its menu row shows. Every keystroke only tests the songs
+ * that matched the previous query, and the result of each query length is
+ * kept so backspace costs a re-rank instead of a rescan. Candidates are
+ * rejected with an SSE2 scan; only the survivors are scored.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+#include "songarr.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SCORE_MAX 255
+
+static char fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static char upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+#ifdef __SSE2__
+/* Loads are 16-byte aligned so they never cross into an unmapped page,
+ * but they may read a few bytes past the string's terminator. */
+__attribute__((no_sanitize_address))
+static bool has_subseq(const char *s, const char *q, size_t qlen)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uintptr_t addr = (uintptr_t)s;
+    const char *chunk = (const char *)(addr & ~(uintptr_t)15);
+    unsigned skip = (unsigned)(addr & 15);
+    size_t k = 0;
+    __m128i lo = _mm_set1_epi8(q[0]);
+    __m128i up = _mm_set1_epi8(upper(q[0]));
+
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i *)chunk);
+        unsigned live = (0xFFFFu >> skip) << skip;
+        unsigned end = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))
+                       & live;
+        if (end != 0) {
+            live &= (end & -end) - 1; /* Bytes before the terminator */
+        }
+        unsigned hit = (unsigned)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, lo), _mm_cmpeq_epi8(v, up))) & live;
+        while (hit != 0) {
+            /* Several query characters may match within one chunk */
+            unsigned pos = (unsigned)__builtin_ctz(hit);
+            if (++k == qlen) {
+                return true;
+            }
+            lo = _mm_set1_epi8(q[k]);
+            up = _mm_set1_epi8(upper(q[k]));
+            live &= ~((2u << pos) - 1);
+            hit = (unsigned)_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, lo), _mm_cmpeq_epi8(v, up)))
+                & live;
+        }
+        if (end != 0) {
+            return false;
+        }
+        chunk += 16;
+        skip = 0;
+    }
+}
+#else
+static bool has_subseq(const char *s, const char *q, size_t qlen)
+{
+    size_t k = 0;
+    for (; *s != '\0'; s++) {
+        if (fold(*s) == q[k] && ++k == qlen) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+static bool is_word_start(const char *name, size_t i)
+{
+    if (i == 0) {
+        return true;
+    }
+    char p = name[i - 1];
+    return p == ' ' || p == '_' || p == '-' || p == '.' || p == '(' ||
+           p == '[';
+}
+
+static int walk(const char *name, size_t start, const char *q, size_t qlen,
+                size_t *end)
+{
+    /* Greedy match from start: consecutive and word-start matches score
+     * higher, a late first match a little lower */
+    int score = -(int)(start < 16 ? start : 16);
+    int run = 0;
+    size_t k = 0;
+    size_t i;
+    for (i = start; name[i] != '\0' && k < qlen; i++) {
+        if (fold(name[i]) != q[k]) {
+            run = 0;
+            continue;
+        }
+        score += 2 + 3 * (run < 4 ? run : 4);
+        if (is_word_start(name, i)) {
+            score += 6;
+        }
+        run++;
+        k++;
+    }
+    *end = i;
+    return (k == qlen) ? score : -1;
+}
+
+static int score_name(const char *name, const char *q, size_t qlen)
+{
+    /* Best greedy walk over the first few places the query could start,
+     * so a later contiguous match is not hidden by an early scattered one */
+    int best = 0;
+    size_t end = 0;
+    int tries = 0;
+    for (size_t i = 0; name[i] != '\0' && tries < 4; i++) {
+        if (fold(name[i]) != q[0]) {
+            continue;
+        }
+        size_t stop;
+        int score = walk(name, i, q, qlen, &stop);
+        if (score < 0) {
+            break; /* Later starts cannot match either */
+        }
+        if (tries == 0 || score > best) {
+            best = score;
+        }
+        end = stop;
+        tries++;
+    }
+    while (name[end] != '\0') {
+        end++;
+    }
+    best -= (int)(end / 32); /* Prefer shorter names */
+    return best < 0 ? 0 : (best > SCORE_MAX ? SCORE_MAX : best);
+}
+
+static const char *label_of(const Search *search, const SongArr *songarr,
+                            uint32_t song, char *buf)
+{
+    if (search->label == NULL) {
+        return songarr_name(songarr, song);
+    }
+    return search->label(song, buf, SEARCH_LABEL_MAX);
+}
+
+static bool rank(Search *search, const SongArr *songarr, bool rescore)
+{
+    /* Counting sort on the score: linear, and stable so equal scores
+     * stay in library order */
+    const SearchLevel *lv = &search->levels[search->len];
+    search->n_ranked = 0;
+    if (search->len == 0) {
+        return true;
+    }
+    uint32_t *ranked = realloc(search->ranked, (lv->n + 1) * sizeof(uint32_t));
+    if (ranked == NULL) {
+        return false;
+    }
+    search->ranked = ranked;
+    uint8_t *scores = search->scores;
+    if (rescore) {
+        /* Back on a shorter query: its level may hold more songs than the
+         * last filter() sized the scores for */
+        scores = realloc(search->scores, lv->n + 1);
+        if (scores == NULL) {
+            return false;
+        }
+        search->scores = scores;
+        char buf[SEARCH_LABEL_MAX];
+        for (size_t i = 0; i < lv->n; i++) {
+            const char *name = label_of(search, songarr, lv->idx[i], buf);
+            scores[i] = (uint8_t)score_name(name, search->query, search->len);
+        }
+    }
+
+    size_t count[SCORE_MAX + 2] = {0};
+    for (size_t i = 0; i < lv->n; i++) {
+        count[SCORE_MAX - scores[i] + 1]++;
+    }
+    for (int s = 1; s <= SCORE_MAX + 1; s++) {
+        count[s] += count[s - 1];
+    }
+    for (size_t i = 0; i < lv->n; i++) {
+        ranked[count[SCORE_MAX - scores[i]]++] = lv->idx[i];
+    }
+    search->n_ranked = lv->n;
+    return true;
+}
+
+static bool filter(Search *search, const SongArr *songarr)
+{
+    /* Builds levels[len] from levels[len - 1], scoring each survivor
+     * while its name is still in cache */
+    size_t k = search->len;
+    const SearchLevel *prev = &search->levels[k - 1];
+    size_t n_cand = (k == 1) ? songarr->size : prev->n;
+    uint32_t *idx = malloc((n_cand + 1) * sizeof(uint32_t));
+    uint8_t *scores = realloc(search->scores, n_cand + 1);
+    if (idx == NULL || scores == NULL) {
+        free(idx);
+        search->scores = (scores != NULL) ? scores : search->scores;
+        return false;
+    }
+    search->scores = scores;
+
+    char buf[SEARCH_LABEL_MAX];
+    size_t n = 0;
+    for (size_t i = 0; i < n_cand; i++) {
+        uint32_t song = (k == 1) ? (uint32_t)i : prev->idx[i];
+        const char *name = label_of(search, songarr, song, buf);
+        if (has_subseq(name, search->query, k)) {
+            idx[n] = song;
+            scores[n++] = (uint8_t)score_name(name, search->query, k);
+        }
+    }
+    uint32_t *fit = realloc(idx, (n + 1) * sizeof(uint32_t));
+    search->levels[k].idx = (fit != NULL) ? fit : idx;
+    search->levels[k].n = n;
+    return true;
+}
+
+void search_init(Search *search, SearchLabel label)
+{
+    memset(search, 0, sizeof(*search));
+    search->label = label;
+}
+
+bool search_push(Search *search, const SongArr *songarr, char c)
+{
+    if (search->len == SEARCH_MAX) {
+        return false;
+    }
+    search->query[search->len++] = fold(c);
+    search->query[search->len] = '\0';
+    if (!filter(search, songarr)) {
+        search->query[--search->len] = '\0';
+        return false;
+    }
+    return rank(search, songarr, false);
+}
+
+bool search_pop(Search *search, const SongArr *songarr)
+{
+    if (search->len == 0) {
+        return false;
+    }
+    free(search->levels[search->len].idx);
+    search->levels[search->len].idx = NULL;
+    search->query[--search->len] = '\0';
+    return rank(search, songarr, true);
+}
+
+bool search_refresh(Search *search, const SongArr *songarr)
+{
+    /* Song indices or labels changed: run the current query again */
+    char query[SEARCH_MAX + 1];
+    size_t len = search->len;
+    memcpy(query, search->query, len);
+    while (search->len > 0) {
+        free(search->levels[search->len].idx);
+        search->levels[search->len].idx = NULL;
+        search->len--;
+    }
+    for (size_t i = 0; i < len; i++) {
+        search->query[search->len++] = query[i];
+        search->query[search->len] = '\0';
+        if (!filter(search, songarr)) {
+            search->query[--search->len] = '\0';
+            return false;
+        }
+    }
+    return rank(search, songarr, false);
+}
+
+void search_clear(Search *search)
+{
+    for (size_t k = 1; k <= search->len; k++) {
+        free(search->levels[k].idx);
+    }
+    free(search->ranked);
+    free(search->scores);
+    search_init(search, search->label);
+}
@@ -0,0 +1,44 @@
+/* File: search.h
+ * Date: 2026-10-17
+ *
+ * Incremental fuzzy search over song labels.
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "songarr.h"
+
+#define SEARCH_MAX 64
+#define SEARCH_LABEL_MAX 512
+
+/* Text a song is matched against: a string in buf or one that outlives the
+ * search call */
+typedef const char *(*SearchLabel)(size_t idx, char *buf, size_t size);
+
+typedef struct {
+    uint32_t *idx;  /* Matching songs, in library order */
+    size_t n;
+} SearchLevel;
+
+typedef struct {
+    char query[SEARCH_MAX + 1];  /* Lower-cased */
+    size_t len;
+    SearchLevel levels[SEARCH_MAX + 1]; /* levels[k] matches query[0..k) */
+    uint32_t *ranked;  /* levels[len], best match first */
+    uint8_t *scores;
+    size_t n_ranked;
+    SearchLabel label;  /* NULL matches file names */
+} Search;
+
+void search_init(Search *search, SearchLabel label);
+bool search_push(Search *search, const SongArr *songarr, char c);
+bool search_pop(Search *search, const SongArr *songarr);
+bool search_refresh(Search *search, const SongArr *songarr);
+void search_clear(Search *search);
+
+#endif
+
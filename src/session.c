@@ -0,0 +1,250 @@
+/* File: session.c
+ * Date: 2026-10-17
+ *
+ * Playback session saved on exit, and now and then while playing.
+ *
+ * Written next to the library index, as $XDG_CACHE_HOME/reed/<hash>.session:
+ *
+ *   SessionHeader | body
+ *
+ * The body is a run of LEB128 varints (the track path goes in as a length
+ * and its bytes), so the shuffle order takes one to three bytes per song
+ * rather than eight. The file is built in memory and written in one go,
+ * then read back with a single read() and decoded in one pass; a body
+ * hash catches a torn or foreign file, which is then ignored.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "libindex.h"
+#include "session.h"
+
+#define SESSION_MAGIC "REEDSES"
+#define SESSION_VERSION 1
+#define VARINT_MAX 10
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t lib_hash;
+    double time_pos;
+    uint64_t body_len;
+    uint64_t body_hash;
+} SessionHeader;
+
+static uint64_t fnv1a(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t session_lib_hash(const SongArr *songarr)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < songarr->n_dirs; i++) {
+        h = fnv1a(h, songarr_dirpath(songarr, (uint32_t)i),
+                  songarr->dirs[i].len + 1);
+    }
+    for (size_t i = 0; i < songarr->size; i++) {
+        const char *name = songarr_name(songarr, i);
+        h = fnv1a(h, &songarr->arr[i].dir, sizeof(songarr->arr[i].dir));
+        h = fnv1a(h, name, strlen(name) + 1);
+    }
+    return h;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok;
+} Reader;
+
+static uint64_t get_varint(Reader *r)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) {
+            break;
+        }
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            return v;
+        }
+    }
+    r->ok = false;
+    return 0;
+}
+
+static uint32_t *get_list(Reader *r, size_t *n)
+{
+    /* Every entry takes a byte at least, which bounds the count */
+    uint64_t len = get_varint(r);
+    *n = 0;
+    if (!r->ok || len > (uint64_t)(r->end - r->p)) {
+        r->ok = false;
+        return NULL;
+    }
+    uint32_t *list = malloc((len + 1) * sizeof(*list));
+    if (list == NULL) {
+        r->ok = false;
+        return NULL;
+    }
+    for (uint64_t i = 0; i < len && r->ok; i++) {
+        uint64_t v = get_varint(r);
+        r->ok = r->ok && v <= UINT32_MAX;
+        list[i] = (uint32_t)v;
+    }
+    *n = len;
+    return list;
+}
+
+bool session_save(const char *const *roots, size_t n_roots, const Session *s)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 32];
+    if (!libindex_cache_path(roots, n_roots, "session", path, sizeof(path),
+                             true)) {
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    size_t track_len = s->track != NULL ? strlen(s->track) : 0;
+    size_t cap = sizeof(SessionHeader) + track_len +
+                 (7 + s->n_order + s->n_queue) * VARINT_MAX;
+    uint8_t *buf = malloc(cap);
+    if (buf == NULL) {
+        return false;
+    }
+    uint8_t *body = buf + sizeof(SessionHeader);
+    uint8_t *p = put_varint(body, track_len);
+    memcpy(p, s->track != NULL ? s->track : "", track_len);
+    p += track_len;
+    /* +1: none (-1) is stored as 0 */
+    p = put_varint(p, (uint64_t)((int64_t)s->list_idx + 1));
+    p = put_varint(p, (uint64_t)((int64_t)s->shuffle_idx + 1));
+    p = put_varint(p, (uint64_t)(s->menu_offset > 0 ? s->menu_offset : 0));
+    p = put_varint(p, (uint64_t)(s->curs_y > 0 ? s->curs_y : 0));
+    p = put_varint(p, s->n_order);
+    for (size_t i = 0; i < s->n_order; i++) {
+        p = put_varint(p, s->order[i]);
+    }
+    p = put_varint(p, s->n_queue);
+    for (size_t i = 0; i < s->n_queue; i++) {
+        p = put_varint(p, s->queue[i]);
+    }
+
+    SessionHeader hdr = {
+        .magic = SESSION_MAGIC,
+        .version = SESSION_VERSION,
+        .flags = s->flags,
+        .lib_hash = s->lib_hash,
+        .time_pos = s->time_pos,
+        .body_len = (uint64_t)(p - body),
+    };
+    hdr.body_hash = fnv1a(0xcbf29ce484222325ULL, body, hdr.body_len);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    bool ok = false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd != -1) {
+        size_t len = (size_t)(p - buf);
+        ok = write(fd, buf, len) == (ssize_t)len;
+        ok = (close(fd) == 0) && ok;
+    }
+    free(buf);
+    if (!ok || rename(tmp, path) == -1) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+bool session_load(const char *const *roots, size_t n_roots, Session *s)
+{
+    char path[PATH_MAX];
+    *s = (Session){ .list_idx = -1, .shuffle_idx = -1 };
+    if (!libindex_cache_path(roots, n_roots, "session", path, sizeof(path),
+                             false)) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    uint8_t *buf = NULL;
+    bool ok = fstat(fd, &st) == 0 &&
+              (size_t)st.st_size >= sizeof(SessionHeader) &&
+              (buf = malloc(st.st_size)) != NULL &&
+              read(fd, buf, st.st_size) == st.st_size;
+    close(fd);
+
+    SessionHeader hdr;
+    if (ok) {
+        memcpy(&hdr, buf, sizeof(hdr));
+        ok = memcmp(hdr.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) == 0 &&
+             hdr.version == SESSION_VERSION &&
+             hdr.body_len == (uint64_t)st.st_size - sizeof(hdr) &&
+             hdr.body_hash == fnv1a(0xcbf29ce484222325ULL,
+                                    buf + sizeof(hdr), hdr.body_len);
+    }
+    if (!ok) {
+        free(buf);
+        return false;
+    }
+
+    Reader r = { buf + sizeof(hdr), buf + st.st_size, true };
+    s->flags = hdr.flags;
+    s->time_pos = hdr.time_pos;
+    s->lib_hash = hdr.lib_hash;
+    uint64_t track_len = get_varint(&r);
+    if (r.ok && track_len > 0 && track_len < PATH_MAX &&
+        track_len <= (uint64_t)(r.end - r.p)) {
+        s->track = strndup((const char *)r.p, track_len);
+        r.p += track_len;
+        r.ok = s->track != NULL;
+    } else if (track_len != 0) {
+        r.ok = false;
+    }
+    s->list_idx = (int32_t)get_varint(&r) - 1;
+    s->shuffle_idx = (int32_t)get_varint(&r) - 1;
+    s->menu_offset = (int32_t)get_varint(&r);
+    s->curs_y = (int32_t)get_varint(&r);
+    s->order = get_list(&r, &s->n_order);
+    s->queue = get_list(&r, &s->n_queue);
+    free(buf);
+    if (!r.ok) {
+        session_free(s);
+        return false;
+    }
+    return true;
+}
+
+void session_free(Session *s)
+{
+    free(s->track);
+    free(s->order);
+    free(s->queue);
+    *s = (Session){ .list_idx = -1, .shuffle_idx = -1 };
+}
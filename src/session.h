@@ -0,0 +1,44 @@
+/* File: session.h
+ * Date: 2026-10-17
+ *
+ * Playback session saved on exit, and now and then while playing.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "songarr.h"
+
+#define SESSION_SHUFFLE  (1u << 0)
+#define SESSION_AUTOPLAY (1u << 1)
+#define SESSION_PAUSED   (1u << 2)
+#define SESSION_DUPES    (1u << 3) /* Duplicates were listed */
+
+/* Song indices below only mean something for the library lib_hash was
+ * taken from; the track is kept by path, so it survives any change. */
+typedef struct {
+    uint32_t flags;
+    double time_pos;
+    char *track;          /* Full path, NULL when nothing was playing */
+    uint64_t lib_hash;
+    int32_t list_idx;     /* Rows and positions, -1 for none */
+    int32_t shuffle_idx;
+    int32_t menu_offset;
+    int32_t curs_y;
+    uint32_t *order;      /* Drawn part of the shuffle order */
+    size_t n_order;
+    uint32_t *queue;
+    size_t n_queue;
+} Session;
+
+/* Names every song in order: songs moving changes it */
+uint64_t session_lib_hash(const SongArr *songarr);
+bool session_save(const char *const *roots, size_t n_roots, const Session *s);
+/* False when there is no usable session; s then needs no session_free() */
+bool session_load(const char *const *roots, size_t n_roots, Session *s);
+void session_free(Session *s);
+
+#endif
@@ -0,0 +1,269 @@
+/* File: shuffle.c
+ * Date: 2026-10-17
+ *
+ * Seeded random numbers and a shuffle order drawn one song at a time.
+ *
+ * The order is a Fisher-Yates shuffle run lazily: drawing position k swaps
+ * it with a uniform pick from [k, n), so every order is equally likely, but
+ * only when a song is actually needed. Untouched positions hold their own
+ * index, and just the swapped ones are kept, in two small hash maps (both
+ * directions, so a song played from elsewhere finds its position too).
+ * Starting a round costs nothing and memory grows with the songs played,
+ * not with the library. A round long enough for a map to outgrow a plain
+ * array of the whole library switches that map to one.
+ */
+
+#include <stdlib.h>
+#include "shuffle.h"
+
+#define EMPTY_KEY UINT32_MAX
+#define MIN_CAP 64
+
+/* ---- xoshiro256**, seeded through splitmix64 ---- */
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(Rng *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+}
+
+uint64_t rng_next(Rng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+uint64_t rng_below(Rng *rng, uint64_t n)
+{
+    /* Plain % favours small values unless n divides 2^64: reject the
+     * 2^64 mod n lowest outputs, which is rarely more than none */
+    uint64_t min = -n % n;
+    uint64_t x;
+    do {
+        x = rng_next(rng);
+    } while (x < min);
+    return x % n;
+}
+
+/* ---- position maps ---- */
+
+static inline size_t slot_of(const PosMap *map, uint32_t key)
+{
+    size_t i = (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (map->cap - 1);
+    while (map->slots[i].key != key && map->slots[i].key != EMPTY_KEY) {
+        i = (i + 1) & (map->cap - 1);
+    }
+    return i;
+}
+
+static uint32_t map_get(const PosMap *map, uint32_t key)
+{
+    /* Anything never moved is still in its own spot */
+    if (map->dense != NULL) {
+        return map->dense[key];
+    } else if (map->used == 0) {
+        return key;
+    }
+    size_t i = slot_of(map, key);
+    return map->slots[i].key == key ? map->slots[i].val : key;
+}
+
+static void map_put(PosMap *map, uint32_t key, uint32_t val)
+{
+    /* Room was made by map_reserve() */
+    if (map->dense != NULL) {
+        map->dense[key] = val;
+        return;
+    }
+    size_t i = slot_of(map, key);
+    if (map->slots[i].key == EMPTY_KEY) {
+        map->slots[i].key = key;
+        map->used++;
+    }
+    map->slots[i].val = val;
+}
+
+static bool map_densify(PosMap *map, size_t n)
+{
+    uint32_t *dense = malloc((n + 1) * sizeof(*dense));
+    if (dense == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        dense[i] = (uint32_t)i;
+    }
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->slots[i].key != EMPTY_KEY) {
+            dense[map->slots[i].key] = map->slots[i].val;
+        }
+    }
+    free(map->slots);
+    *map = (PosMap){ .dense = dense };
+    return true;
+}
+
+static bool map_reserve(PosMap *map, size_t extra, size_t n)
+{
+    /* Keep the load at most one half, so probes stay short */
+    if (map->dense != NULL || (map->used + extra) * 2 <= map->cap) {
+        return true;
+    }
+    size_t cap = map->cap > 0 ? map->cap * 2 : MIN_CAP;
+    while ((map->used + extra) * 2 > cap) {
+        cap *= 2;
+    }
+    if (cap * sizeof(struct Slot) >= n * sizeof(uint32_t)) {
+        return map_densify(map, n);
+    }
+    struct Slot *slots = malloc(cap * sizeof(*slots));
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        slots[i].key = EMPTY_KEY;
+    }
+
+    PosMap old = *map;
+    map->slots = slots;
+    map->cap = cap;
+    map->used = 0;
+    for (size_t i = 0; i < old.cap; i++) {
+        if (old.slots[i].key != EMPTY_KEY) {
+            map_put(map, old.slots[i].key, old.slots[i].val);
+        }
+    }
+    free(old.slots);
+    return true;
+}
+
+static void map_clear(PosMap *map)
+{
+    free(map->slots);
+    free(map->dense);
+    *map = (PosMap){0};
+}
+
+/* ---- shuffle ---- */
+
+static bool swap_pos(Shuffle *sh, size_t a, size_t b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (!map_reserve(&sh->song_at, 2, sh->n) ||
+        !map_reserve(&sh->pos_of, 2, sh->n)) {
+        return false;
+    }
+    uint32_t song_a = map_get(&sh->song_at, (uint32_t)a);
+    uint32_t song_b = map_get(&sh->song_at, (uint32_t)b);
+    map_put(&sh->song_at, (uint32_t)a, song_b);
+    map_put(&sh->song_at, (uint32_t)b, song_a);
+    map_put(&sh->pos_of, song_b, (uint32_t)a);
+    map_put(&sh->pos_of, song_a, (uint32_t)b);
+    return true;
+}
+
+void shuffle_init(Shuffle *sh, uint64_t seed)
+{
+    *sh = (Shuffle){0};
+    rng_seed(&sh->rng, seed);
+}
+
+void shuffle_destroy(Shuffle *sh)
+{
+    map_clear(&sh->song_at);
+    map_clear(&sh->pos_of);
+}
+
+void shuffle_restart(Shuffle *sh, size_t n)
+{
+    /* The generator carries on: one seed gives the same rounds in turn */
+    map_clear(&sh->song_at);
+    map_clear(&sh->pos_of);
+    sh->n = n;
+    sh->drawn = 0;
+}
+
+bool shuffle_reserve(Shuffle *sh, size_t draws)
+{
+    /* Each draw moves two entries in either map */
+    return map_reserve(&sh->song_at, 2 * draws, sh->n) &&
+           map_reserve(&sh->pos_of, 2 * draws, sh->n);
+}
+
+size_t shuffle_song(Shuffle *sh, size_t pos)
+{
+    while (sh->drawn <= pos) {
+        size_t k = sh->drawn;
+        size_t j = k + (size_t)rng_below(&sh->rng, sh->n - k);
+        if (!swap_pos(sh, k, j)) {
+            return SHUFFLE_NONE;
+        }
+        sh->drawn++;
+    }
+    return map_get(&sh->song_at, (uint32_t)pos);
+}
+
+size_t shuffle_pos(Shuffle *sh, size_t song)
+{
+    size_t pos = map_get(&sh->pos_of, (uint32_t)song);
+    if (pos < sh->drawn) {
+        return pos;
+    }
+    /* Picked by hand: it is as good a draw as any for the next spot */
+    if (!swap_pos(sh, sh->drawn, pos)) {
+        return SHUFFLE_NONE;
+    }
+    return sh->drawn++;
+}
+
+bool shuffle_remap(Shuffle *sh, const size_t *remap, size_t n_new, int *pos)
+{
+    uint32_t *kept = malloc((sh->drawn + 1) * sizeof(*kept));
+    if (kept == NULL) {
+        return false;
+    }
+    size_t n_kept = 0;
+    int new_pos = -1;
+    for (size_t i = 0; i < sh->drawn; i++) {
+        size_t to = remap[map_get(&sh->song_at, (uint32_t)i)];
+        if (to != SHUFFLE_NONE) {
+            kept[n_kept++] = (uint32_t)to;
+        }
+        if ((int)i == *pos) {
+            new_pos = (int)n_kept - 1;
+        }
+    }
+
+    /* Draw the survivors again, in the same order, from a fresh round */
+    shuffle_restart(sh, n_new);
+    bool ok = shuffle_reserve(sh, n_kept);
+    for (size_t i = 0; i < n_kept && ok; i++) {
+        ok = shuffle_pos(sh, kept[i]) != SHUFFLE_NONE;
+    }
+    free(kept);
+    *pos = new_pos;
+    return ok;
+}
@@ -0,0 +1,63 @@
+/* File: shuffle.h
+ * Date: 2026-10-17
+ *
+ * Seeded random numbers and a shuffle order drawn one song at a time.
+ */
+
+#ifndef SHUFFLE_H
+#define SHUFFLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHUFFLE_NONE ((size_t)-1)
+
+/* xoshiro256** state */
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+void rng_seed(Rng *rng, uint64_t seed);
+uint64_t rng_next(Rng *rng);
+/* Uniform in [0, n), n > 0 */
+uint64_t rng_below(Rng *rng, uint64_t n);
+
+/* Open addressing map of the entries that left their identity spot, or
+ * a plain array of all of them once that takes less room */
+typedef struct {
+    struct Slot { uint32_t key, val; } *slots;
+    size_t cap;
+    size_t used;
+    uint32_t *dense;
+} PosMap;
+
+/* A permutation of n songs, where only positions [0, drawn) are decided.
+ * Those form the history of the round: they stay put until it restarts. */
+typedef struct {
+    size_t n;
+    size_t drawn;
+    PosMap song_at;  /* Position -> song */
+    PosMap pos_of;   /* Song -> position */
+    Rng rng;
+} Shuffle;
+
+void shuffle_init(Shuffle *sh, uint64_t seed);
+void shuffle_destroy(Shuffle *sh);
+/* New round over n songs, without touching them: O(1) */
+void shuffle_restart(Shuffle *sh, size_t n);
+/* Room for draws more songs to be drawn or placed, made at once rather
+ * than along the way; false when out of memory */
+bool shuffle_reserve(Shuffle *sh, size_t draws);
+/* Song at pos (< n), drawing the positions up to it first.
+ * SHUFFLE_NONE when out of memory, as for shuffle_pos(). */
+size_t shuffle_song(Shuffle *sh, size_t pos);
+/* Position of song, which is drawn next if it is still undecided */
+size_t shuffle_pos(Shuffle *sh, size_t song);
+/* Songs were renumbered by remap (SHUFFLE_NONE: removed) into n_new.
+ * The history keeps its order minus removed songs, new songs join the
+ * undecided rest. *pos follows the song on it, or the one before it if
+ * it was removed (-1 for none). False when out of memory. */
+bool shuffle_remap(Shuffle *sh, const size_t *remap, size_t n_new, int *pos);
+
+#endif
@@ -4,154 +4,890 @@
  * SongArr ADT.
  */
 
-#define _DEFAULT_SOURCE
-#include <dirent.h>
+#define _GNU_SOURCE /* qsort_r */
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include "collate.h"
+#include "libindex.h"
+#include "scan.h"
 #include "songarr.h"
 
 #define FILEARR_INIT_CAP 32
+#define DIRARR_INIT_CAP 8
+#define SORT_MIN_RUN 16384   /* Smaller arrays are sorted by one thread */
+#define SORT_MAX_THREADS 64
 
-int compare_songnames(const void *p, const void *q)
+typedef struct {
+    uint64_t prefix;  /* First 8 sort key bytes, big-endian */
+    uint32_t key;     /* Offset of the full sort key */
+    uint32_t idx;     /* Entry this item stands for */
+} SortItem;
+
+typedef struct {
+    const SongArr *songarr;
+    const StrPool *keys;
+} SortCtx;
+
+typedef struct {
+    const SongArr *songarr;
+    SortItem *items;
+    size_t lo, hi;
+    StrPool keys;
+    bool ok;
+} SortRun;
+
+typedef struct {
+    const SortCtx *ctx;
+    const SortItem *src;
+    SortItem *dst;
+    size_t lo, mid, hi;
+} SortMerge;
+
+static int compare_entries(const SongArr *sa1, const SFile *f1,
+                           const SongArr *sa2, const SFile *f2)
+{
+    int cmp = collate_compare(strpool_str(&sa1->pool, f1->name),
+                              strpool_str(&sa2->pool, f2->name));
+    if (cmp == 0) {
+        /* Tie-break on directory so the order never depends on scan order */
+        cmp = strcmp(songarr_dirpath(sa1, f1->dir),
+                     songarr_dirpath(sa2, f2->dir));
+    }
+    return cmp;
+}
+
+static int compare_items(const void *p, const void *q, void *arg)
 {
-    SFile *song1 = (SFile *)p;
-    SFile *song2 = (SFile *)q;
+    /* Same order as compare_entries(), mostly decided by the prefix.
+     * Directories are sorted by path first, so their ids break ties. */
+    const SortCtx *ctx = arg;
+    const SortItem *a = p;
+    const SortItem *b = q;
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    int cmp = strcmp(strpool_str(ctx->keys, a->key),
+                     strpool_str(ctx->keys, b->key));
+    if (cmp == 0) {
+        cmp = strcmp(songarr_name(ctx->songarr, a->idx),
+                     songarr_name(ctx->songarr, b->idx));
+    }
+    if (cmp == 0) {
+        uint32_t d1 = ctx->songarr->arr[a->idx].dir;
+        uint32_t d2 = ctx->songarr->arr[b->idx].dir;
+        cmp = (d1 > d2) - (d1 < d2);
+    }
+    return cmp;
+}
+
+static int compare_dirids(const void *p, const void *q, void *ctx)
+{
+    const SongArr *songarr = ctx;
+    return strcmp(songarr_dirpath(songarr, *(const uint32_t *)p),
+                  songarr_dirpath(songarr, *(const uint32_t *)q));
+}
 
-    if (strcmp(song1->name, song2->name) < 0) {
-        return -1;
-    } else if (strcmp(song1->name, song2->name) > 0) {
-        return 1;
+static void *grow_array(void *arr, size_t *cap, size_t size, size_t need,
+                        size_t elem, size_t init_cap)
+{
+    /* cap == 0 means arr is borrowed (or NULL): copy instead of realloc */
+    size_t new_cap = *cap > 0 ? *cap : init_cap;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    void *tmp;
+    if (*cap > 0) {
+        tmp = realloc(arr, new_cap * elem);
     } else {
-        return 0;
+        tmp = malloc(new_cap * elem);
+        if (tmp != NULL && size > 0) {
+            memcpy(tmp, arr, size * elem);
+        }
+    }
+    if (tmp != NULL) {
+        *cap = new_cap;
     }
+    return tmp;
 }
 
-static char *cat_path(const char *root, const char *branch)
+static bool songarr_realloc_check(SongArr *songarr, size_t n)
 {
-    size_t size = strlen(root) + strlen(branch) + 2;
-    char *full_path = malloc(size);
-    if (full_path == NULL) {
-        return NULL;
+    if (songarr->size + n <= songarr->cap) {
+        return true;
+    }
+    SFile *tmp = grow_array(songarr->arr, &songarr->cap, songarr->size,
+                            songarr->size + n, sizeof(SFile),
+                            FILEARR_INIT_CAP);
+    if (tmp == NULL) {
+        return false;
     }
+    songarr->arr = tmp;
+    return true;
+}
 
-    strcpy(full_path, root);
-    strcat(full_path, "/");
-    strcat(full_path, branch);
+static bool songarr_dirs_check(SongArr *songarr, size_t n)
+{
+    if (songarr->n_dirs + n > UINT32_MAX) {
+        return false;
+    }
+    if (songarr->n_dirs + n <= songarr->dirs_cap) {
+        return true;
+    }
+    SDir *tmp = grow_array(songarr->dirs, &songarr->dirs_cap, songarr->n_dirs,
+                           songarr->n_dirs + n, sizeof(SDir),
+                           DIRARR_INIT_CAP);
+    if (tmp == NULL) {
+        return false;
+    }
+    songarr->dirs = tmp;
+    return true;
+}
 
-    return full_path;
+bool songarr_add_dir(SongArr *songarr, const char *path, struct timespec mtime,
+                     uint32_t *dir)
+{
+    uint32_t off;
+    size_t len = strlen(path);
+    if (!songarr_dirs_check(songarr, 1) ||
+        !strpool_add(&songarr->pool, path, len, &off)) {
+        return false;
+    }
+    songarr->dirs[songarr->n_dirs] = (SDir){
+        off, (uint32_t)len, mtime.tv_sec, mtime.tv_nsec
+    };
+    if (dir != NULL) {
+        *dir = (uint32_t)songarr->n_dirs;
+    }
+    songarr->n_dirs++;
+    return true;
 }
 
-static bool create_sfile(SFile *sf, const char *entry, const char *dirname)
+bool songarr_append(SongArr *songarr, uint32_t dir, const char *entry)
 {
-    sf->name = malloc(strlen(entry)+1);
-    if (sf->name == NULL) {
+    uint32_t off;
+    if (!songarr_realloc_check(songarr, 1) ||
+        !strpool_add(&songarr->pool, entry, strlen(entry), &off)) {
         return false;
     }
+    songarr->arr[songarr->size++] = (SFile){ dir, off };
+    return true;
+}
 
-    strcpy(sf->name, entry);
-    sf->path = cat_path(dirname, entry);
-    if (sf->path == NULL) {
-        free(sf->name);
+static bool append_all(SongArr *dst, const SongArr *src)
+{
+    uint32_t base;
+    if (!songarr_realloc_check(dst, src->size) ||
+        !songarr_dirs_check(dst, src->n_dirs) ||
+        !strpool_append(&dst->pool, &src->pool, &base)) {
         return false;
     }
 
+    uint32_t dir_base = (uint32_t)dst->n_dirs;
+    for (size_t i = 0; i < src->n_dirs; i++) {
+        SDir d = src->dirs[i];
+        d.path += base;
+        dst->dirs[dst->n_dirs++] = d;
+    }
+    for (size_t i = 0; i < src->size; i++) {
+        SFile sf = src->arr[i];
+        dst->arr[dst->size++] = (SFile){ sf.dir + dir_base, sf.name + base };
+    }
+    dst->pool_dead += src->pool_dead;
+    return true;
+}
+
+bool songarr_merge(SongArr *dst, SongArr *src)
+{
+    /* Moves every SFile and SDir of src into dst; src is left empty. */
+    if (!append_all(dst, src)) {
+        return false;
+    }
+    src->size = 0;
+    src->n_dirs = 0;
+    strpool_destroy(&src->pool);
     return true;
 }
 
-static bool songarr_realloc_check(SongArr *songarr)
+SongArr *songarr_copy(const SongArr *songarr)
+{
+    /* A private copy, for a reader on another thread */
+    SongArr *copy = songarr_new();
+    if (copy != NULL && !append_all(copy, songarr)) {
+        songarr_destroy(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+static bool sort_dirs(SongArr *songarr, const bool *dead)
 {
-    if (songarr->size >= songarr->cap) {
-        songarr->cap *= 2;
-        SFile *tmp = realloc(songarr->arr, songarr->cap * sizeof(SFile));
-        if (tmp == NULL) {
-            return false;
+    /* Sort directories by path, dropping dead ones, and renumber entries */
+    size_t n = songarr->n_dirs;
+    uint32_t *perm = malloc((n + 1) * sizeof(uint32_t));
+    uint32_t *to = malloc((n + 1) * sizeof(uint32_t));
+    SDir *dirs = malloc((n + 1) * sizeof(SDir));
+    if (perm == NULL || to == NULL || dirs == NULL) {
+        free(perm);
+        free(to);
+        free(dirs);
+        return false;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (dead == NULL || !dead[i]) {
+            perm[k++] = (uint32_t)i;
         }
-        songarr->arr = tmp;
     }
+    qsort_r(perm, k, sizeof(uint32_t), compare_dirids, songarr);
+    for (size_t i = 0; i < k; i++) {
+        dirs[i] = songarr->dirs[perm[i]];
+        to[perm[i]] = (uint32_t)i;
+    }
+    for (size_t i = 0; i < songarr->size; i++) {
+        songarr->arr[i].dir = to[songarr->arr[i].dir];
+    }
+
+    if (songarr->dirs_cap > 0) {
+        free(songarr->dirs);
+    }
+    songarr->dirs = dirs;
+    songarr->n_dirs = k;
+    songarr->dirs_cap = n + 1;
+    free(perm);
+    free(to);
     return true;
 }
 
-static bool scan_dir(const char *dirname, SongArr *songarr)
+static uint64_t key_prefix(const char *key)
 {
-    DIR *pdir;
-    struct dirent *entry;
-    bool exit_status = false;
+    /* The next 8 key bytes, big-endian and zero-padded past the end */
+    uint64_t prefix = 0;
+    size_t i = 0;
+    for (; i < 8 && key[i] != '\0'; i++) {
+        prefix = (prefix << 8) | (unsigned char)key[i];
+    }
+    return i == 0 ? 0 : prefix << (8 * (8 - i));
+}
 
-    if ((pdir = opendir(dirname)) == NULL) {
-        goto out;
+static int compare_ties(const void *p, const void *q, void *arg)
+{
+    /* Items whose keys are equal */
+    const SortCtx *ctx = arg;
+    const SortItem *a = p;
+    const SortItem *b = q;
+    int cmp = strcmp(songarr_name(ctx->songarr, a->idx),
+                     songarr_name(ctx->songarr, b->idx));
+    if (cmp == 0) {
+        uint32_t d1 = ctx->songarr->arr[a->idx].dir;
+        uint32_t d2 = ctx->songarr->arr[b->idx].dir;
+        cmp = (d1 > d2) - (d1 < d2);
     }
+    return cmp;
+}
 
-    while ((entry = readdir(pdir)) != NULL) {
-        switch (entry->d_type) {
-            case DT_DIR: {
-                if (entry->d_name[0] == '.') {
-                    break;
-                }
-                char *full_path = cat_path(dirname, entry->d_name);
-                if (full_path == NULL) {
-                    goto out;
-                }
-                if (!scan_dir(full_path, songarr)) {
-                    free(full_path);
-                    goto out;
-                }
-                free(full_path);
+static void sort_prefixes(SortItem *a, SortItem *tmp, size_t n)
+{
+    /* Stable merge sort on the prefix alone: no calls, no string access */
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            SortItem x = a[i];
+            size_t j = i;
+            for (; j > 0 && a[j - 1].prefix > x.prefix; j--) {
+                a[j] = a[j - 1];
+            }
+            a[j] = x;
+        }
+        return;
+    }
+    size_t half = n / 2;
+    sort_prefixes(a, tmp, half);
+    sort_prefixes(a + half, tmp, n - half);
+    if (a[half - 1].prefix <= a[half].prefix) {
+        return;
+    }
+    memcpy(tmp, a, half * sizeof(SortItem));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n) {
+        a[k++] = (a[j].prefix < tmp[i].prefix) ? a[j++] : tmp[i++];
+    }
+    memcpy(a + k, tmp + i, (half - i) * sizeof(SortItem));
+}
+
+static void sort_by_key(SortItem *a, SortItem *tmp, size_t n, size_t depth,
+                        const SortCtx *ctx)
+{
+    /* Sort on 8 key bytes at a time: only items that tie on this chunk
+     * load the next one, so long shared prefixes are read once rather
+     * than once per comparison */
+    sort_prefixes(a, tmp, n);
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && a[j].prefix == a[i].prefix) {
+            j++;
+        }
+        uint64_t prefix = a[i].prefix;
+        if (j - i > 1 && (prefix & 0xFF) != 0) {
+            for (size_t k = i; k < j; k++) {
+                const char *key = strpool_str(ctx->keys, a[k].key);
+                a[k].prefix = key_prefix(key + depth + 8);
+            }
+            sort_by_key(a + i, tmp, j - i, depth + 8, ctx);
+            for (size_t k = i; k < j; k++) {
+                a[k].prefix = prefix;
+            }
+        } else if (j - i > 1) {
+            /* The keys ended together */
+            qsort_r(a + i, j - i, sizeof(SortItem), compare_ties,
+                    (void *)ctx);
+        }
+        i = j;
+    }
+}
+
+static void *sort_run_main(void *arg)
+{
+    /* Build the sort keys of one run and sort it */
+    SortRun *run = arg;
+    size_t cap = 256;
+    char *buf = malloc(cap);
+    SortItem *tmp = malloc(((run->hi - run->lo) / 2 + 1) * sizeof(SortItem));
+    run->ok = (buf != NULL && tmp != NULL);
+
+    for (size_t i = run->lo; run->ok && i < run->hi; i++) {
+        const char *name = songarr_name(run->songarr, i);
+        size_t len = collate_key(name, buf, cap);
+        if (len >= cap) {
+            char *grown = realloc(buf, len + 1);
+            if (grown == NULL) {
+                run->ok = false;
                 break;
             }
-            case DT_REG: {
-                if (!songarr_realloc_check(songarr)) {
-                    goto out;
-                }
-                SFile sf;
-                if (!create_sfile(&sf, entry->d_name, dirname)) {
-                    goto out;
+            buf = grown;
+            cap = len + 1;
+            collate_key(name, buf, cap);
+        }
+        uint32_t off;
+        run->ok = strpool_add(&run->keys, buf, len, &off);
+        run->items[i] = (SortItem){ key_prefix(buf), off, (uint32_t)i };
+    }
+    if (run->ok) {
+        SortCtx ctx = { run->songarr, &run->keys };
+        sort_by_key(run->items + run->lo, tmp, run->hi - run->lo, 0, &ctx);
+    }
+    free(buf);
+    free(tmp);
+    return NULL;
+}
+
+static void *sort_merge_main(void *arg)
+{
+    SortMerge *m = arg;
+    size_t i = m->lo, j = m->mid, k = m->lo;
+    while (i < m->mid && j < m->hi) {
+        if (compare_items(&m->src[j], &m->src[i], (void *)m->ctx) < 0) {
+            m->dst[k++] = m->src[j++];
+        } else {
+            m->dst[k++] = m->src[i++];
+        }
+    }
+    memcpy(m->dst + k, m->src + i, (m->mid - i) * sizeof(SortItem));
+    k += m->mid - i;
+    memcpy(m->dst + k, m->src + j, (m->hi - j) * sizeof(SortItem));
+    return NULL;
+}
+
+static void run_parallel(void *(*fn)(void *), void *args, size_t stride, int n)
+{
+    /* The calling thread takes the first job, and any job whose thread
+     * could not be started */
+    pthread_t tids[SORT_MAX_THREADS];
+    bool started[SORT_MAX_THREADS] = {false};
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&tids[i], NULL, fn,
+                                    (char *)args + i * stride) == 0;
+    }
+    fn(args);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        } else {
+            fn((char *)args + i * stride);
+        }
+    }
+}
+
+static bool sort_items(const SongArr *songarr, SortItem *items, int n_threads,
+                       StrPool *keys)
+{
+    /* Sorted runs in parallel, then rounds of pairwise parallel merges */
+    size_t n = songarr->size;
+    int n_runs = (int)(n / SORT_MIN_RUN);
+    n_runs = n_runs < 1 ? 1 : (n_runs > n_threads ? n_threads : n_runs);
+
+    SortRun runs[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    for (int r = 0; r < n_runs; r++) {
+        runs[r] = (SortRun){ songarr, items, n * r / n_runs,
+                             n * (r + 1) / n_runs, { NULL, 0, 0 }, false };
+        strpool_init(&runs[r].keys);
+        bounds[r] = runs[r].lo;
+    }
+    bounds[n_runs] = n;
+    run_parallel(sort_run_main, runs, sizeof(SortRun), n_runs);
+
+    bool ok = true;
+    for (int r = 0; r < n_runs; r++) {
+        uint32_t base = 0;
+        ok = ok && runs[r].ok && strpool_append(keys, &runs[r].keys, &base);
+        for (size_t i = runs[r].lo; ok && i < runs[r].hi; i++) {
+            items[i].key += base;
+        }
+        strpool_destroy(&runs[r].keys);
+    }
+    if (!ok || n_runs == 1) {
+        return ok;
+    }
+
+    SortItem *tmp = malloc(n * sizeof(SortItem));
+    if (tmp == NULL) {
+        return false;
+    }
+    SortCtx ctx = { songarr, keys };
+    SortItem *src = items;
+    SortItem *dst = tmp;
+    while (n_runs > 1) {
+        SortMerge merges[SORT_MAX_THREADS];
+        int n_merges = 0;
+        for (int r = 0; r < n_runs; r += 2) {
+            /* A trailing odd run is merged with nothing, i.e. copied */
+            size_t hi = (r + 1 < n_runs) ? bounds[r + 2] : bounds[r + 1];
+            merges[n_merges++] = (SortMerge){ &ctx, src, dst, bounds[r],
+                                              bounds[r + 1], hi };
+            bounds[r / 2] = bounds[r];
+        }
+        run_parallel(sort_merge_main, merges, sizeof(SortMerge), n_merges);
+        n_runs = n_merges;
+        bounds[n_runs] = n;
+        SortItem *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != items) {
+        memcpy(items, src, n * sizeof(SortItem));
+    }
+    free(tmp);
+    return true;
+}
+
+bool songarr_sort(SongArr *songarr, int n_threads)
+{
+    /* Entries are renumbered, so a borrowed array must be copied first */
+    if (!songarr_realloc_check(songarr, 1) || !sort_dirs(songarr, NULL)) {
+        return false;
+    }
+    size_t n = songarr->size;
+    if (n_threads <= 0) {
+        n_threads = scan_default_threads();
+    }
+    if (n_threads > SORT_MAX_THREADS) {
+        n_threads = SORT_MAX_THREADS;
+    }
+
+    /* Sort keys are built once per entry instead of once per comparison */
+    StrPool keys;
+    strpool_init(&keys);
+    SortItem *items = malloc((n + 1) * sizeof(SortItem));
+    SFile *arr = malloc((n + 1) * sizeof(SFile));
+    bool ok = (items != NULL && arr != NULL) &&
+              sort_items(songarr, items, n_threads, &keys);
+    if (ok) {
+        for (size_t i = 0; i < n; i++) {
+            arr[i] = songarr->arr[items[i].idx];
+        }
+        free(songarr->arr);
+        songarr->arr = arr;
+        songarr->cap = n + 1;
+        arr = NULL;
+    }
+    strpool_destroy(&keys);
+    free(items);
+    free(arr);
+    return ok;
+}
+
+static size_t find_dir(const SongArr *songarr, size_t n, const char *path)
+{
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(songarr_dirpath(songarr, (uint32_t)mid), path);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            return mid;
+        }
+    }
+    return SONGARR_NONE;
+}
+
+size_t songarr_find_dir(const SongArr *songarr, const char *path)
+{
+    return find_dir(songarr, songarr->n_dirs, path);
+}
+
+size_t songarr_find(const SongArr *songarr, const char *dirname,
+                    const char *name)
+{
+    size_t lo = 0;
+    size_t hi = songarr->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = collate_compare(songarr_name(songarr, mid), name);
+        if (cmp == 0) {
+            cmp = strcmp(songarr_dirpath(songarr, songarr->arr[mid].dir),
+                         dirname);
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            return mid;
+        }
+    }
+    return SONGARR_NONE;
+}
+
+size_t songarr_path(const SongArr *songarr, size_t idx, char *buf, size_t size)
+{
+    /* Like snprintf(): returns the full length even when truncated */
+    const SFile *sf = &songarr->arr[idx];
+    int n = snprintf(buf, size, "%s/%s", songarr_dirpath(songarr, sf->dir),
+                     strpool_str(&songarr->pool, sf->name));
+    return n < 0 ? 0 : (size_t)n;
+}
+
+static void mark_purged(const SongArr *songarr, const SongArr *purged,
+                        bool *purge)
+{
+    for (size_t i = 0; purged != NULL && i < purged->n_dirs; i++) {
+        size_t id = songarr_find_dir(songarr,
+                                     songarr_dirpath(purged, (uint32_t)i));
+        if (id != SONGARR_NONE) {
+            purge[id] = true;
+        }
+    }
+}
+
+static size_t gallop(const SongArr *songarr, size_t lo, size_t n,
+                     const SongArr *sa, const SFile *key)
+{
+    /* First entry in [lo, n) not ordered before key. Probes lo, lo+1,
+     * lo+3... then bisects the last step, so walking a sorted batch of m
+     * through n entries costs O(m log(n/m)) comparisons: one binary search
+     * each for a few files, close to a linear merge for a large batch. */
+    size_t hi = lo;
+    size_t step = 1;
+    while (hi < n &&
+           compare_entries(songarr, &songarr->arr[hi], sa, key) < 0) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n) {
+        hi = n;
+    }
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_entries(songarr, &songarr->arr[mid], sa, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool map_add_dirs(SongArr *songarr, const SongArr *add, bool *dead,
+                         uint32_t *dir_map)
+{
+    /* Map add's directories onto ours; new ones are appended unsorted */
+    size_t old_dirs = songarr->n_dirs;
+    if (!songarr_dirs_check(songarr, add->n_dirs)) {
+        return false;
+    }
+    for (size_t i = 0; i < add->n_dirs; i++) {
+        const char *path = songarr_dirpath(add, (uint32_t)i);
+        const SDir *d = &add->dirs[i];
+        if (i > 0 && strcmp(path, songarr_dirpath(add, (uint32_t)i-1)) == 0) {
+            dir_map[i] = dir_map[i-1];
+            continue;
+        }
+        size_t id = find_dir(songarr, old_dirs, path);
+        if (id == SONGARR_NONE) {
+            uint32_t off;
+            if (!strpool_add(&songarr->pool, path, d->len, &off)) {
+                return false;
+            }
+            id = songarr->n_dirs++;
+            songarr->dirs[id].path = off;
+            songarr->dirs[id].len = d->len;
+        }
+        /* Listed in add: the directory stays even if it was purged */
+        songarr->dirs[id].mtime_sec = d->mtime_sec;
+        songarr->dirs[id].mtime_nsec = d->mtime_nsec;
+        dead[id] = false;
+        dir_map[i] = (uint32_t)id;
+    }
+    return true;
+}
+
+bool songarr_apply(SongArr *songarr, const SongArrDelta *delta, size_t *remap)
+{
+    /* One merge pass, so a burst of changes costs O(n) rather than a
+     * memmove per file. Files of purged directories that add lists again
+     * keep their index. remap[old index] receives the new index, or
+     * SONGARR_NONE for removed entries. */
+    SongArr *add = delta->add;
+    const SongArr *del = delta->del;
+    size_t old_size = songarr->size;
+    size_t old_dirs = songarr->n_dirs;
+    bool ok = false;
+
+    if (!songarr_sort(add, 0)) {
+        return false;
+    }
+    bool *gone = calloc(old_size + 1, sizeof(bool));
+    bool *purge = calloc(old_dirs + 1, sizeof(bool));
+    bool *dead = calloc(old_dirs + add->n_dirs + 1, sizeof(bool));
+    uint32_t *dir_map = malloc((add->n_dirs + 1) * sizeof(uint32_t));
+    SFile *fresh = malloc((add->size + 1) * sizeof(SFile));
+    size_t *fresh_at = malloc((add->size + 1) * sizeof(size_t));
+    SFile *arr = NULL;
+    if (gone == NULL || purge == NULL || dead == NULL || dir_map == NULL ||
+        fresh == NULL || fresh_at == NULL) {
+        goto out;
+    }
+
+    mark_purged(songarr, delta->purge, purge);
+    for (size_t i = 0; i < old_size; i++) {
+        gone[i] = purge[songarr->arr[i].dir];
+    }
+    memcpy(dead, purge, old_dirs * sizeof(bool));
+    if (!map_add_dirs(songarr, add, dead, dir_map)) {
+        goto out;
+    }
+    for (size_t i = 0; del != NULL && i < del->size; i++) {
+        size_t idx = songarr_find(songarr,
+                                  songarr_dirpath(del, del->arr[i].dir),
+                                  songarr_name(del, i));
+        if (idx != SONGARR_NONE) {
+            gone[idx] = true;
+        }
+    }
+
+    /* Additions: revive listed files, copy the rest into our pool. Both
+     * lists are sorted, so one cursor walks the old entries, and where it
+     * stops is where a fresh entry goes. */
+    size_t n_fresh = 0;
+    size_t at = 0;
+    for (size_t i = 0; i < add->size; i++) {
+        const SFile *sf = &add->arr[i];
+        if (i > 0 && compare_entries(add, sf, add, sf - 1) == 0) {
+            continue;
+        }
+        at = gallop(songarr, at, old_size, add, sf);
+        if (at < old_size &&
+            compare_entries(songarr, &songarr->arr[at], add, sf) == 0) {
+            gone[at] = false;
+            continue;
+        }
+        const char *name = songarr_name(add, i);
+        uint32_t off;
+        if (!strpool_add(&songarr->pool, name, strlen(name), &off)) {
+            goto out;
+        }
+        fresh_at[n_fresh] = at;
+        fresh[n_fresh++] = (SFile){ dir_map[sf->dir], off };
+    }
+
+    size_t n_gone = 0;
+    for (size_t i = 0; i < old_size; i++) {
+        n_gone += gone[i];
+    }
+    size_t new_size = old_size - n_gone + n_fresh;
+    arr = malloc((new_size + 1) * sizeof(SFile));
+    if (arr == NULL) {
+        goto out;
+    }
+    size_t i = 0, j = 0, k = 0;
+    while (i < old_size || j < n_fresh) {
+        size_t pos = j < n_fresh ? fresh_at[j] : old_size;
+        for (; i < pos; i++) {
+            if (gone[i]) {
+                if (remap != NULL) {
+                    remap[i] = SONGARR_NONE;
                 }
-                songarr->arr[songarr->size++] = sf;
-                break;
+                songarr->pool_dead += strlen(songarr_name(songarr, i)) + 1;
+                continue;
             }
-            default: break;
+            if (remap != NULL) {
+                remap[i] = k;
+            }
+            arr[k++] = songarr->arr[i];
+        }
+        if (j < n_fresh) {
+            arr[k++] = fresh[j++];
         }
     }
-    exit_status = true;
+    if (songarr->cap > 0) {
+        free(songarr->arr);
+    }
+    songarr->arr = arr;
+    songarr->size = new_size;
+    songarr->cap = new_size + 1;
+    arr = NULL;
+
+    /* Purged directories go, the rest get sorted. Removed strings stay in
+     * the pool until songarr_compact() or the index rewrites it. */
+    for (size_t d = 0; d < songarr->n_dirs; d++) {
+        if (dead[d]) {
+            songarr->pool_dead += songarr->dirs[d].len + 1;
+        }
+    }
+    ok = sort_dirs(songarr, dead);
 
     out:
-    if (pdir != NULL) {
-        closedir(pdir);
+    free(gone);
+    free(purge);
+    free(dead);
+    free(dir_map);
+    free(fresh);
+    free(fresh_at);
+    free(arr);
+    return ok;
+}
+
+uint32_t *songarr_compact(SongArr *songarr)
+{
+    /* Same layout as the library index: directories, then names in table
+     * order */
+    if (songarr->pool_dead <= songarr->pool.used / 4) {
+        return NULL;
+    }
+    uint32_t *old_names = malloc((songarr->size + 1) * sizeof(uint32_t));
+    SDir *dirs = malloc((songarr->n_dirs + 1) * sizeof(SDir));
+    StrPool pool;
+    strpool_init(&pool);
+    size_t n_names = 0;
+    /* The arrays are rewritten in place: take them off the mapping */
+    if (old_names == NULL || dirs == NULL ||
+        !songarr_realloc_check(songarr, 0) || !songarr_dirs_check(songarr, 0)) {
+        goto fail;
+    }
+    for (size_t i = 0; i < songarr->n_dirs; i++) {
+        dirs[i] = songarr->dirs[i];
+        if (!strpool_add(&pool, songarr_dirpath(songarr, (uint32_t)i),
+                         dirs[i].len, &dirs[i].path)) {
+            goto fail;
+        }
+    }
+    for (; n_names < songarr->size; n_names++) {
+        SFile *sf = &songarr->arr[n_names];
+        const char *name = strpool_str(&songarr->pool, sf->name);
+        old_names[n_names] = sf->name;
+        if (!strpool_add(&pool, name, strlen(name), &sf->name)) {
+            goto fail;
+        }
+    }
+
+    memcpy(songarr->dirs, dirs, songarr->n_dirs * sizeof(SDir));
+    free(dirs);
+    strpool_destroy(&songarr->pool);
+    songarr->pool = pool;
+    songarr->pool_dead = 0;
+    return old_names;
+
+    fail:
+    for (size_t i = 0; i < n_names; i++) {
+        songarr->arr[i].name = old_names[i];
     }
-    return exit_status;
+    strpool_destroy(&pool);
+    free(dirs);
+    free(old_names);
+    return NULL;
 }
 
 void songarr_destroy(SongArr *songarr)
 {
-    for (size_t i = 0; i < songarr->size; i++) {
-        free(songarr->arr[i].name);
-        free(songarr->arr[i].path);
+    /* Borrowed arrays and strings live in the library index mapping */
+    if (songarr->cap > 0) {
+        free(songarr->arr);
+    }
+    if (songarr->dirs_cap > 0) {
+        free(songarr->dirs);
+    }
+    strpool_destroy(&songarr->pool);
+    if (songarr->map != NULL) {
+        munmap(songarr->map, songarr->map_len);
     }
-    free(songarr->arr);
     free(songarr);
 }
 
-SongArr *songarr_init(const char *dirname)
+SongArr *songarr_new(void)
 {
     SongArr *songarr = malloc(sizeof(SongArr));
     if (songarr == NULL) {
         return NULL;
     }
-    songarr->arr = malloc(FILEARR_INIT_CAP * sizeof(SFile));
-    if (songarr->arr == NULL) {
-        free(songarr);
-        return NULL;
-    }
 
-    songarr->cap = FILEARR_INIT_CAP;
+    songarr->arr = NULL;
+    songarr->cap = 0;
     songarr->size = 0;
-    if (!scan_dir(dirname, songarr)) {
-        songarr_destroy(songarr);
-        return NULL;
+    songarr->dirs = NULL;
+    songarr->dirs_cap = 0;
+    songarr->n_dirs = 0;
+    songarr->map = NULL;
+    songarr->map_len = 0;
+    strpool_init(&songarr->pool);
+    songarr->pool_dead = 0;
+    return songarr;
+}
+
+SongArr *songarr_init(const char *dirname, const SongArrOpts *opts)
+{
+    SongArr *songarr = NULL;
+    bool changed = true;
+
+    if (!opts->rescan) {
+        songarr = libindex_load(&dirname, 1, opts->n_threads, &changed);
+    }
+    if (songarr == NULL) {
+        songarr = songarr_new();
+        if (songarr == NULL) {
+            return NULL;
+        }
+        ScanOpts scan_opts = { .n_threads = opts->n_threads };
+        if (!scan_tree(&dirname, 1, &scan_opts, songarr) ||
+            !songarr_sort(songarr, opts->n_threads)) {
+            songarr_destroy(songarr);
+            return NULL;
+        }
+        changed = true;
+    }
+    if (changed) {
+        /* Best effort: a missing index only costs a rescan next time */
+        (void)libindex_save(&dirname, 1, songarr);
     }
-    qsort(songarr->arr, songarr->size, sizeof(SFile), compare_songnames);
 
     return songarr;
 }
-
@@ -7,20 +7,84 @@
 #ifndef SONGARR_H
 #define SONGARR_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
+#include "strpool.h"
 
+/* 8 bytes per song: the path is rebuilt from dir + name on demand */
 typedef struct {
-    char *name;
-    char *path;
+    uint32_t dir;  /* Index into SongArr.dirs */
+    uint32_t name; /* Pool offset of the file name */
 } SFile;
 
 typedef struct {
+    uint32_t path; /* Pool offset */
+    uint32_t len;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} SDir;
+
+/* arr and dirs may point into the library index mapping (cap == 0); they
+ * are copied to the heap before the first modification. */
+typedef struct SongArr {
     size_t size;
     size_t cap;
     SFile *arr;
+    size_t n_dirs;
+    size_t dirs_cap;
+    SDir *dirs;    /* Interned directories, sorted by path after a sort */
+    StrPool pool;  /* Names and directory paths */
+    size_t pool_dead; /* Pool bytes no entry refers to any more */
+    void *map;     /* Library index mapping, or NULL */
+    size_t map_len;
 } SongArr;
 
-SongArr *songarr_init(const char *dirname);
+/* remap value for entries removed by songarr_apply() */
+#define SONGARR_NONE ((size_t)-1)
+
+/* One batch of library changes for songarr_apply() */
+typedef struct {
+    struct SongArr *add;   /* Files to list, with their directories */
+    struct SongArr *del;   /* Files to drop; only its entries are used */
+    struct SongArr *purge; /* Directories to drop together with their files */
+} SongArrDelta;
+
+typedef struct {
+    int n_threads; /* Scanner and sort threads, <= 0 for one per CPU */
+    bool rescan;   /* Ignore the library index and scan everything */
+} SongArrOpts;
+
+SongArr *songarr_new(void);
+bool songarr_add_dir(SongArr *songarr, const char *path, struct timespec mtime,
+                     uint32_t *dir);
+bool songarr_append(SongArr *songarr, uint32_t dir, const char *entry);
+bool songarr_merge(SongArr *dst, SongArr *src);
+SongArr *songarr_copy(const SongArr *songarr);
+bool songarr_sort(SongArr *songarr, int n_threads);
+size_t songarr_find(const SongArr *songarr, const char *dirname,
+                    const char *name);
+size_t songarr_find_dir(const SongArr *songarr, const char *path);
+bool songarr_apply(SongArr *songarr, const SongArrDelta *delta, size_t *remap);
+/* Rewrites the pool without the strings of removed entries once they make
+ * up a quarter of it. Returns the old name offset of every song, for the
+ * caller to free, or NULL when the pool was left as it is. */
+uint32_t *songarr_compact(SongArr *songarr);
+
+static inline const char *songarr_name(const SongArr *songarr, size_t idx)
+{
+    return strpool_str(&songarr->pool, songarr->arr[idx].name);
+}
+
+static inline const char *songarr_dirpath(const SongArr *songarr, uint32_t dir)
+{
+    return strpool_str(&songarr->pool, songarr->dirs[dir].path);
+}
+
+size_t songarr_path(const SongArr *songarr, size_t idx, char *buf, size_t size);
+
+SongArr *songarr_init(const char *dirname, const SongArrOpts *opts);
 void songarr_destroy(SongArr *songarr);
 
 #endif
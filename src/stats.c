@@ -0,0 +1,147 @@
+/* File: stats.c
+ * Date: 2026-10-17
+ *
+ * Latency histograms, recorded only while enabled.
+ *
+ * Each histogram has fixed log-linear buckets, as in HdrHistogram: values
+ * below 16 get a bucket each, above that every power of two is split into
+ * 16 equal buckets. Recording is a count increment (no allocation, no
+ * sorting) and any quantile is read back within 1/16 (6.25 %) of the true
+ * value, from nanoseconds up to minutes.
+ */
+
+#include <stdio.h>
+#include "stats.h"
+
+#define SUB_BITS 4
+#define SUB_COUNT (1u << SUB_BITS)
+#define MAX_EXP 40 /* 2^40 ns is about 18 minutes; larger values clamp */
+#define N_BUCKETS (SUB_COUNT + (MAX_EXP - SUB_BITS) * SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[N_BUCKETS];
+    uint64_t n;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} Histogram;
+
+bool stats_enabled = false;
+
+static Histogram hist[N_STATS];
+
+static const struct {
+    const char *name;
+    bool is_time;
+} stat_info[N_STATS] = {
+    [STAT_KEY_FRAME]   = { "key_to_frame", true },
+    [STAT_IPC_REPLY]   = { "ipc_reply", true },
+    [STAT_DRAW_MENU]   = { "draw_menu", true },
+    [STAT_DOUPDATE]    = { "doupdate", true },
+    [STAT_WAKE_EVENTS] = { "wake_events", false },
+};
+
+static unsigned bucket_of(uint64_t v)
+{
+    if (v < SUB_COUNT) {
+        return (unsigned)v;
+    }
+    unsigned e = 63 - (unsigned)__builtin_clzll(v); /* >= SUB_BITS */
+    if (e >= MAX_EXP) {
+        return N_BUCKETS - 1;
+    }
+    unsigned sub = (unsigned)(v >> (e - SUB_BITS)) & (SUB_COUNT - 1);
+    return SUB_COUNT + (e - SUB_BITS) * SUB_COUNT + sub;
+}
+
+static uint64_t bucket_low(unsigned b)
+{
+    if (b < SUB_COUNT) {
+        return b;
+    }
+    unsigned e = (b - SUB_COUNT) / SUB_COUNT + SUB_BITS;
+    uint64_t sub = (b - SUB_COUNT) % SUB_COUNT;
+    return (SUB_COUNT + sub) << (e - SUB_BITS);
+}
+
+static uint64_t bucket_high(unsigned b)
+{
+    /* Largest value of the bucket */
+    return b + 1 < N_BUCKETS ? bucket_low(b + 1) - 1 : UINT64_MAX;
+}
+
+void stats_record(StatId id, uint64_t value)
+{
+    Histogram *h = &hist[id];
+    h->counts[bucket_of(value)]++;
+    if (h->n == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+    h->n++;
+    h->sum += value;
+}
+
+static uint64_t quantile(const Histogram *h, double q)
+{
+    /* Upper end of the bucket holding the q-th value, capped at max */
+    if (h->n == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)(h->n - 1)) + 1;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < N_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            uint64_t high = bucket_high(b);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_summary(StatId id, StatSummary *out)
+{
+    const Histogram *h = &hist[id];
+    out->name = stat_info[id].name;
+    out->is_time = stat_info[id].is_time;
+    out->n = h->n;
+    out->max = h->max;
+    out->p50 = quantile(h, 0.50);
+    out->p90 = quantile(h, 0.90);
+    out->p99 = quantile(h, 0.99);
+}
+
+bool stats_dump(const char *path)
+{
+    /* One summary line per histogram, then its non-empty buckets as
+     * "low high count" (inclusive bounds) */
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    for (int id = 0; id < N_STATS; id++) {
+        const Histogram *h = &hist[id];
+        fprintf(f, "%s unit=%s n=%llu min=%llu p50=%llu p90=%llu p99=%llu "
+                "p999=%llu max=%llu mean=%.1f\n", stat_info[id].name,
+                stat_info[id].is_time ? "ns" : "count",
+                (unsigned long long)h->n, (unsigned long long)h->min,
+                (unsigned long long)quantile(h, 0.50),
+                (unsigned long long)quantile(h, 0.90),
+                (unsigned long long)quantile(h, 0.99),
+                (unsigned long long)quantile(h, 0.999),
+                (unsigned long long)h->max,
+                h->n > 0 ? (double)h->sum / (double)h->n : 0.0);
+        for (unsigned b = 0; b < N_BUCKETS; b++) {
+            if (h->counts[b] > 0) {
+                fprintf(f, "  %llu %llu %llu\n",
+                        (unsigned long long)bucket_low(b),
+                        (unsigned long long)bucket_high(b),
+                        (unsigned long long)h->counts[b]);
+            }
+        }
+    }
+    return fclose(f) == 0;
+}
@@ -0,0 +1,61 @@
+/* File: stats.h
+ * Date: 2026-10-17
+ *
+ * Latency histograms, recorded only while enabled.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    STAT_KEY_FRAME,    /* Wakeup with keys to the end of the next doupdate */
+    STAT_IPC_REPLY,    /* mpv command queued to its reply parsed */
+    STAT_DRAW_MENU,    /* One draw_menu() */
+    STAT_DOUPDATE,     /* One doupdate(): the terminal's share */
+    STAT_WAKE_EVENTS,  /* Keys and messages handled per poll() wakeup */
+    N_STATS,
+} StatId;
+
+/* Read on every hot path: a plain flag, so disabled costs one branch */
+extern bool stats_enabled;
+
+static inline uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* 0 while disabled, which stats_since() then ignores */
+static inline uint64_t stats_start(void)
+{
+    return stats_enabled ? stats_now() : 0;
+}
+
+void stats_record(StatId id, uint64_t value);
+
+static inline void stats_since(StatId id, uint64_t start)
+{
+    if (start != 0) {
+        stats_record(id, stats_now() - start);
+    }
+}
+
+typedef struct {
+    const char *name;
+    bool is_time;      /* Nanoseconds, otherwise a plain count */
+    uint64_t n;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+} StatSummary;
+
+void stats_summary(StatId id, StatSummary *out);
+bool stats_dump(const char *path);
+
+#endif
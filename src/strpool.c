@@ -0,0 +1,96 @@
+/* File: strpool.c
+ * Date: 2026-10-17
+ *
+ * Offset-addressed string pool.
+ *
+ * Every string is appended, NUL-terminated, to one growing blob and named
+ * by its 32-bit offset, so references survive the blob being moved and a
+ * whole library is released with a single free. The blob may also be
+ * borrowed from read-only memory (the mapped library index); it is copied
+ * to the heap the first time something is appended.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "strpool.h"
+
+#define POOL_MIN (64 * 1024)
+
+void strpool_init(StrPool *pool)
+{
+    pool->base = NULL;
+    pool->used = 0;
+    pool->reserved = 0;
+}
+
+void strpool_borrow(StrPool *pool, const char *base, size_t len)
+{
+    pool->base = (char *)base;
+    pool->used = len;
+    pool->reserved = 0;
+}
+
+static bool strpool_reserve(StrPool *pool, size_t n)
+{
+    if (pool->used + n > UINT32_MAX) {
+        return false; /* Offsets are 32-bit */
+    }
+    if (pool->reserved > 0 && pool->used + n <= pool->reserved) {
+        return true;
+    }
+
+    size_t cap = pool->reserved > 0 ? pool->reserved : POOL_MIN;
+    while (cap < pool->used + n) {
+        cap *= 2;
+    }
+    char *base;
+    if (pool->reserved > 0) {
+        base = realloc(pool->base, cap);
+    } else {
+        /* Borrowed (or empty): take a private copy */
+        base = malloc(cap);
+        if (base != NULL && pool->used > 0) {
+            memcpy(base, pool->base, pool->used);
+        }
+    }
+    if (base == NULL) {
+        return false;
+    }
+    pool->base = base;
+    pool->reserved = cap;
+    return true;
+}
+
+bool strpool_add(StrPool *pool, const char *s, size_t len, uint32_t *off)
+{
+    if (!strpool_reserve(pool, len + 1)) {
+        return false;
+    }
+    *off = (uint32_t)pool->used;
+    memcpy(pool->base + pool->used, s, len);
+    pool->base[pool->used + len] = '\0';
+    pool->used += len + 1;
+    return true;
+}
+
+bool strpool_append(StrPool *dst, const StrPool *src, uint32_t *base)
+{
+    /* Copies all of src; its offsets become *base + offset in dst */
+    if (!strpool_reserve(dst, src->used)) {
+        return false;
+    }
+    *base = (uint32_t)dst->used;
+    if (src->used > 0) {
+        memcpy(dst->base + dst->used, src->base, src->used);
+    }
+    dst->used += src->used;
+    return true;
+}
+
+void strpool_destroy(StrPool *pool)
+{
+    if (pool->reserved > 0) {
+        free(pool->base);
+    }
+    strpool_init(pool);
+}
@@ -0,0 +1,32 @@
+/* File: strpool.h
+ * Date: 2026-10-17
+ *
+ * Offset-addressed string pool.
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    char *base;
+    size_t used;      /* Bytes handed out */
+    size_t reserved;  /* Bytes obtained from malloc, 0 if base is borrowed */
+} StrPool;
+
+void strpool_init(StrPool *pool);
+void strpool_borrow(StrPool *pool, const char *base, size_t len);
+bool strpool_add(StrPool *pool, const char *s, size_t len, uint32_t *off);
+bool strpool_append(StrPool *dst, const StrPool *src, uint32_t *base);
+void strpool_destroy(StrPool *pool);
+
+static inline const char *strpool_str(const StrPool *pool, uint32_t off)
+{
+    return pool->base + off;
+}
+
+#endif
+
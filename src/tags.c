@@ -0,0 +1,1270 @@
+/* File: tags.c
+ * Date: 2026-10-17
+ *
+ * Background tag reader with a persistent cache.
+ *
+ * Worker threads take song paths from a small job queue, read the tag
+ * headers (ID3v2/ID3v1, FLAC and Ogg Vorbis comments, MP4 atoms) with
+ * bounded preads that never reach into the audio data, and hand results
+ * back through a lock-free ring plus an eventfd. Only the UI thread touches
+ * the tag table, so it never waits on tag I/O.
+ *
+ * Songs are keyed by the pool offset of their name (SFile.name), which
+ * neither sorting nor songarr_apply() changes; songarr_compact() does, and
+ * tags_rekey() follows it. Results are cached in
+ * $XDG_CACHE_HOME/reed/<hash>.tags, keyed by (device, inode, mtime, size):
+ * a file that did not change is answered from the cache after one fstat.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "libindex.h"
+#include "scan.h"
+#include "songarr.h"
+#include "strpool.h"
+#include "tags.h"
+
+#define TAGS_MAGIC "REEDTAG"
+#define TAGS_VERSION 1
+#define MAX_WORKERS 16
+#define MAX_JOBS 256        /* Queued at once; the feed uses half of it */
+#define RING_SIZE 1024      /* Results in flight, power of two */
+#define TEXT_MAX 256        /* Longest kept tag value, bytes */
+#define BLOCK_MAX 65536     /* Longest single read */
+#define NO_TEXT UINT32_MAX
+
+enum { T_ARTIST, T_ALBUM, T_TITLE, N_TEXT };
+
+enum { SLOT_PENDING, SLOT_DONE, SLOT_FAILED };
+
+/* One file in the cache file, and the tags of one song in the table */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint32_t text[N_TEXT]; /* Pool offsets, NO_TEXT when unknown */
+    uint32_t duration;     /* Seconds */
+    uint16_t track;
+    uint16_t pad[3];
+} TagRecord;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t n_records;    /* Sorted by file */
+    uint64_t pool_size;
+} CacheHeader;
+
+typedef struct {
+    uint32_t key;          /* SFile.name of the song */
+    uint32_t gen;          /* tg.gen when it was queued */
+    char path[];
+} TagJob;
+
+typedef struct {
+    uint32_t key;
+    uint32_t gen;
+    bool ok;               /* false: the file could not be read */
+    bool cached;
+    TagRecord rec;         /* Without the text offsets */
+    char text[N_TEXT][TEXT_MAX];
+} TagResult;
+
+typedef struct {
+    uint32_t key;
+    uint8_t state;
+    TagRecord rec;         /* Text offsets point into tg.pool */
+} TagSlot;
+
+typedef struct {
+    int fd;
+    uint64_t size;
+} Reader;
+
+/* Bounded multi-producer ring (Vyukov): workers push, the UI pops */
+typedef struct {
+    atomic_size_t seq;
+    TagResult *res;
+} RingCell;
+
+struct Tags {
+    /* Shared with the workers */
+    pthread_t threads[MAX_WORKERS];
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    TagJob *jobs[MAX_JOBS];
+    size_t head;
+    size_t count;
+    atomic_bool stop;
+    int efd;
+    atomic_bool signalled; /* efd was written and not read yet */
+    RingCell ring[RING_SIZE];
+    atomic_size_t ring_tail;
+    size_t ring_head;      /* UI only */
+
+    /* Read-only once loaded, first thing a worker does */
+    pthread_once_t once;
+    void *map;
+    size_t map_len;
+    const TagRecord *cache;
+    size_t cache_n;
+    const char *cache_pool;
+
+    /* UI only */
+    char path[PATH_MAX];
+    TagSlot *slots;
+    size_t n_slots;
+    size_t slots_cap;
+    uint32_t *hash;        /* Slot index + 1, 0 when empty */
+    size_t hash_cap;
+    StrPool pool;
+    size_t feed_pos;
+    bool fed_all;          /* Every song of the library was queued once */
+    size_t n_pending;
+    uint32_t gen;          /* Bumped when keys change: older results go */
+    size_t parsed;         /* Results that did not come from the cache */
+    bool started;
+} tg = { .efd = -1, .once = PTHREAD_ONCE_INIT };
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t be64(const uint8_t *p)
+{
+    return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t syncsafe(const uint8_t *p)
+{
+    return (uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14 |
+           (uint32_t)(p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+static bool read_at(const Reader *r, uint64_t off, void *buf, size_t len)
+{
+    if (off > r->size || len > r->size - off) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(r->fd, (char *)buf + done, len - done,
+                          (off_t)(off + done));
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+/* Text */
+
+static void set_text(TagResult *res, int field, const char *s, size_t len)
+{
+    /* First value wins. Control characters would break the menu rows. */
+    char *out = res->text[field];
+    if (out[0] != '\0') {
+        return;
+    }
+    while (len > 0 && (unsigned char)*s <= ' ') {
+        s++;
+        len--;
+    }
+    if (len > TEXT_MAX - 1) {
+        len = TEXT_MAX - 1;
+        while (len > 0 && ((unsigned char)s[len] & 0xc0) == 0x80) {
+            len--; /* Do not cut a UTF-8 sequence */
+        }
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < len && s[i] != '\0'; i++) {
+        out[n++] = (unsigned char)s[i] < ' ' ? ' ' : s[i];
+    }
+    while (n > 0 && out[n - 1] == ' ') {
+        n--;
+    }
+    out[n] = '\0';
+}
+
+static bool put_utf8(char *out, size_t *at, size_t size, uint32_t cp)
+{
+    /* False when cp does not fit: nothing is written, callers stop */
+    char tmp[4];
+    size_t n;
+    if (cp < 0x80) {
+        tmp[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        tmp[0] = (char)(0xc0 | cp >> 6);
+        tmp[1] = (char)(0x80 | (cp & 0x3f));
+        n = 2;
+    } else if (cp < 0x10000) {
+        tmp[0] = (char)(0xe0 | cp >> 12);
+        tmp[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+        tmp[2] = (char)(0x80 | (cp & 0x3f));
+        n = 3;
+    } else {
+        tmp[0] = (char)(0xf0 | cp >> 18);
+        tmp[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+        tmp[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+        tmp[3] = (char)(0x80 | (cp & 0x3f));
+        n = 4;
+    }
+    if (*at + n >= size) {
+        return false;
+    }
+    memcpy(out + *at, tmp, n);
+    *at += n;
+    return true;
+}
+
+static void decode_text(int enc, const uint8_t *p, size_t len, char *out,
+                        size_t size)
+{
+    /* ID3v2 encodings: 0 Latin-1, 1 UTF-16 with BOM, 2 UTF-16BE, 3 UTF-8.
+     * Stops at the first NUL, so only the first of several values stays. */
+    size_t at = 0;
+    bool full = false;
+    if (enc == 1 || enc == 2) {
+        bool be = (enc == 2);
+        size_t i = 0;
+        if (enc == 1 && len >= 2 && p[0] == 0xff && p[1] == 0xfe) {
+            i = 2;
+        } else if (enc == 1 && len >= 2 && p[0] == 0xfe && p[1] == 0xff) {
+            be = true;
+            i = 2;
+        }
+        for (; i + 1 < len && !full; i += 2) {
+            uint32_t u = be ? be16(p + i) : (uint32_t)(p[i + 1] << 8 | p[i]);
+            if (u == 0) {
+                break;
+            }
+            if (u >= 0xd800 && u < 0xdc00 && i + 3 < len) {
+                uint32_t lo = be ? be16(p + i + 2)
+                                 : (uint32_t)(p[i + 3] << 8 | p[i + 2]);
+                if (lo >= 0xdc00 && lo < 0xe000) {
+                    u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+                    i += 2;
+                }
+            }
+            full = !put_utf8(out, &at, size, u);
+        }
+    } else {
+        size_t i;
+        for (i = 0; i < len && p[i] != 0 && !full; i++) {
+            if (enc == 0) {
+                full = !put_utf8(out, &at, size, p[i]);
+            } else if (at + 1 < size) {
+                out[at++] = (char)p[i];
+            } else {
+                full = true;
+            }
+        }
+        if (full && enc == 3 && (p[i - 1] & 0xc0) == 0x80) {
+            /* The copy stopped inside a sequence: drop its first bytes */
+            while (at > 0 && ((unsigned char)out[at - 1] & 0xc0) == 0x80) {
+                at--;
+            }
+            at -= (at > 0);
+        }
+    }
+    out[at] = '\0';
+}
+
+/* Vorbis comments (FLAC, Ogg) */
+
+static void parse_comments(TagResult *res, const uint8_t *p, size_t len)
+{
+    /* Vendor string, then a count of "KEY=value" strings; lengths are
+     * little-endian. Pictures may be cut off at the read limit. */
+    if (len < 4 || le32(p) > len - 4) {
+        return;
+    }
+    size_t off = 4 + le32(p);
+    if (len - off < 4) {
+        return;
+    }
+    uint32_t n = le32(p + off);
+    off += 4;
+    for (uint32_t i = 0; i < n && len - off >= 4; i++) {
+        uint32_t clen = le32(p + off);
+        off += 4;
+        if (clen > len - off) {
+            break;
+        }
+        const char *c = (const char *)p + off;
+        off += clen;
+        const char *eq = memchr(c, '=', clen);
+        if (eq == NULL) {
+            continue;
+        }
+        size_t klen = (size_t)(eq - c);
+        const char *v = eq + 1;
+        size_t vlen = clen - klen - 1;
+        if (klen == 6 && strncasecmp(c, "ARTIST", 6) == 0) {
+            set_text(res, T_ARTIST, v, vlen);
+        } else if (klen == 5 && strncasecmp(c, "ALBUM", 5) == 0) {
+            set_text(res, T_ALBUM, v, vlen);
+        } else if (klen == 5 && strncasecmp(c, "TITLE", 5) == 0) {
+            set_text(res, T_TITLE, v, vlen);
+        } else if (klen == 11 && strncasecmp(c, "TRACKNUMBER", 11) == 0) {
+            char num[16];
+            snprintf(num, sizeof(num), "%.*s", (int)(vlen < 15 ? vlen : 15), v);
+            res->rec.track = (uint16_t)atoi(num);
+        }
+    }
+}
+
+static void parse_flac(const Reader *r, TagResult *res, uint64_t off)
+{
+    /* Metadata blocks follow "fLaC"; the audio starts after the last */
+    uint8_t h[18];
+    if (!read_at(r, off, h, 4) || memcmp(h, "fLaC", 4) != 0) {
+        return;
+    }
+    off += 4;
+    for (int blocks = 0; blocks < 128; blocks++) {
+        if (!read_at(r, off, h, 4)) {
+            return;
+        }
+        bool last = (h[0] & 0x80) != 0;
+        int type = h[0] & 0x7f;
+        uint32_t len = (uint32_t)h[1] << 16 | (uint32_t)h[2] << 8 | h[3];
+        off += 4;
+        if (type == 0 && len >= 18 && read_at(r, off, h, 18)) {
+            /* STREAMINFO: 20 bit sample rate, 36 bit sample count */
+            uint32_t rate = (uint32_t)h[10] << 12 | (uint32_t)h[11] << 4 |
+                            h[12] >> 4;
+            uint64_t samples = (uint64_t)(h[13] & 0x0f) << 32 | be32(h + 14);
+            if (rate > 0) {
+                res->rec.duration = (uint32_t)(samples / rate);
+            }
+        } else if (type == 4) {
+            size_t n = len < BLOCK_MAX ? len : BLOCK_MAX;
+            uint8_t *buf = malloc(n + 1);
+            if (buf != NULL && read_at(r, off, buf, n)) {
+                parse_comments(res, buf, n);
+            }
+            free(buf);
+        }
+        off += len;
+        if (last) {
+            return;
+        }
+    }
+}
+
+static void parse_ogg(const Reader *r, TagResult *res)
+{
+    /* The comment header is the second packet, within the first pages */
+    size_t len = r->size < BLOCK_MAX ? (size_t)r->size : BLOCK_MAX;
+    uint8_t *buf = malloc(len + 1);
+    uint8_t *pkt = malloc(len + 1);
+    size_t plen = 0;
+    int packet = 0;
+    if (buf == NULL || pkt == NULL || !read_at(r, 0, buf, len)) {
+        goto out;
+    }
+    size_t off = 0;
+    while (packet < 2 && len - off >= 27 && memcmp(buf + off, "OggS", 4) == 0) {
+        size_t n_segs = buf[off + 26];
+        size_t data = off + 27 + n_segs;
+        if (data > len) {
+            break;
+        }
+        for (size_t i = 0; i < n_segs && packet < 2; i++) {
+            size_t seg = buf[off + 27 + i];
+            if (seg > len - data) {
+                packet = 2; /* Cut off at the read limit: use what we have */
+                break;
+            }
+            if (packet == 1) {
+                memcpy(pkt + plen, buf + data, seg);
+                plen += seg;
+            }
+            data += seg;
+            if (seg < 255) {
+                packet++;
+            }
+        }
+        off = data;
+    }
+    if (plen >= 7 && memcmp(pkt, "\x03vorbis", 7) == 0) {
+        parse_comments(res, pkt + 7, plen - 7);
+    } else if (plen >= 8 && memcmp(pkt, "OpusTags", 8) == 0) {
+        parse_comments(res, pkt + 8, plen - 8);
+    }
+
+    out:
+    free(buf);
+    free(pkt);
+}
+
+/* ID3 */
+
+static bool parse_id3v2(const Reader *r, TagResult *res, uint64_t *end)
+{
+    /* Frames are visited by their headers; only wanted ones are read */
+    uint8_t h[10];
+    if (!read_at(r, 0, h, 10) || memcmp(h, "ID3", 3) != 0) {
+        return false;
+    }
+    int ver = h[3];
+    int flags = h[5];
+    uint64_t tag_end = 10 + (uint64_t)syncsafe(h + 6);
+    *end = tag_end + ((flags & 0x10) ? 10 : 0);
+    if (ver < 2 || ver > 4 || (ver < 4 && (flags & 0x80))) {
+        return true; /* Unknown, or unsynchronised as a whole */
+    }
+
+    uint64_t off = 10;
+    if ((flags & 0x40) && ver >= 3) {
+        if (!read_at(r, off, h, 4)) {
+            return true;
+        }
+        off += (ver == 3) ? 4 + (uint64_t)be32(h) : syncsafe(h);
+    }
+    size_t hdr = (ver == 2) ? 6 : 10;
+    uint8_t body[2 * TEXT_MAX + 4];
+    char text[TEXT_MAX];
+    while (off + hdr <= tag_end) {
+        if (!read_at(r, off, h, hdr) || h[0] == 0) {
+            break; /* Padding */
+        }
+        uint32_t size;
+        if (ver == 2) {
+            size = (uint32_t)h[3] << 16 | (uint32_t)h[4] << 8 | h[5];
+        } else {
+            size = (ver == 3) ? be32(h + 4) : syncsafe(h + 4);
+        }
+        if (size == 0 || size > tag_end - off - hdr) {
+            break;
+        }
+        const char *id = (const char *)h;
+        size_t id_len = (ver == 2) ? 3 : 4;
+        /* v3: compressed/encrypted; v4: also unsynchronised/length field */
+        bool plain = (ver == 2) || (ver == 3 && !(h[9] & 0xc0)) ||
+                     (ver == 4 && !(h[9] & 0x0f));
+        int field = -1;
+        bool track = false;
+        bool length = false;
+        if (!strncmp(id, ver == 2 ? "TT2" : "TIT2", id_len)) {
+            field = T_TITLE;
+        } else if (!strncmp(id, ver == 2 ? "TP1" : "TPE1", id_len)) {
+            field = T_ARTIST;
+        } else if (!strncmp(id, ver == 2 ? "TAL" : "TALB", id_len)) {
+            field = T_ALBUM;
+        } else if (!strncmp(id, ver == 2 ? "TRK" : "TRCK", id_len)) {
+            track = true;
+        } else if (!strncmp(id, ver == 2 ? "TLE" : "TLEN", id_len)) {
+            length = true;
+        }
+        if (plain && (field != -1 || track || length)) {
+            size_t n = size < sizeof(body) ? size : sizeof(body);
+            if (read_at(r, off + hdr, body, n)) {
+                decode_text(body[0], body + 1, n - 1, text, sizeof(text));
+                if (field != -1) {
+                    set_text(res, field, text, strlen(text));
+                } else if (track) {
+                    res->rec.track = (uint16_t)atoi(text);
+                } else {
+                    res->rec.duration = (uint32_t)(atol(text) / 1000);
+                }
+            }
+        }
+        off += hdr + size;
+    }
+    return true;
+}
+
+static void parse_id3v1(const Reader *r, TagResult *res)
+{
+    /* 128 bytes at the very end of the file */
+    uint8_t t[128];
+    char text[TEXT_MAX];
+    if (r->size < 128 || !read_at(r, r->size - 128, t, 128) ||
+        memcmp(t, "TAG", 3) != 0) {
+        return;
+    }
+    static const int fields[][2] = {
+        { T_TITLE, 3 }, { T_ARTIST, 33 }, { T_ALBUM, 63 },
+    };
+    for (int i = 0; i < 3; i++) {
+        decode_text(0, t + fields[i][1], 30, text, sizeof(text));
+        set_text(res, fields[i][0], text, strlen(text));
+    }
+    if (res->rec.track == 0 && t[125] == 0 && t[126] != 0) {
+        res->rec.track = t[126]; /* ID3v1.1 */
+    }
+}
+
+/* MP4 */
+
+#define BOX(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | \
+                         (uint32_t)(c) << 8 | (uint32_t)(d))
+
+static void parse_mp4_item(const Reader *r, TagResult *res, uint32_t type,
+                           uint64_t off, uint64_t len)
+{
+    /* An ilst item holds a 'data' box: type, locale, then the value */
+    uint8_t buf[16 + TEXT_MAX];
+    size_t n = len < sizeof(buf) ? (size_t)len : sizeof(buf);
+    if (n < 16 || !read_at(r, off, buf, n) ||
+        be32(buf + 4) != BOX('d', 'a', 't', 'a')) {
+        return;
+    }
+    size_t dlen = be32(buf) < n ? be32(buf) : n;
+    if (dlen < 16) {
+        return;
+    }
+    const char *v = (const char *)buf + 16;
+    switch (type) {
+        case BOX(0xa9, 'n', 'a', 'm'): set_text(res, T_TITLE, v, dlen - 16);
+                                       break;
+        case BOX(0xa9, 'A', 'R', 'T'): set_text(res, T_ARTIST, v, dlen - 16);
+                                       break;
+        case BOX(0xa9, 'a', 'l', 'b'): set_text(res, T_ALBUM, v, dlen - 16);
+                                       break;
+        case BOX('t', 'r', 'k', 'n'): {
+            if (dlen >= 20) {
+                res->rec.track = be16(buf + 18);
+            }
+            break;
+        }
+        default: break;
+    }
+}
+
+static void walk_mp4(const Reader *r, TagResult *res, uint64_t off,
+                     uint64_t end, uint32_t parent, int depth)
+{
+    /* Only box headers are read on the way; mdat is stepped over */
+    uint8_t h[32];
+    for (int boxes = 0; boxes < 1024 && end - off >= 8; boxes++) {
+        if (!read_at(r, off, h, 8)) {
+            return;
+        }
+        uint64_t size = be32(h);
+        uint32_t type = be32(h + 4);
+        uint64_t hdr = 8;
+        if (size == 1) {
+            if (!read_at(r, off + 8, h + 8, 8)) {
+                return;
+            }
+            size = be64(h + 8);
+            hdr = 16;
+        } else if (size == 0) {
+            size = end - off;
+        }
+        if (size < hdr || size > end - off) {
+            return;
+        }
+        uint64_t body = off + hdr;
+        uint64_t body_end = off + size;
+        switch (type) {
+            case BOX('m', 'o', 'o', 'v'):
+            case BOX('u', 'd', 't', 'a'):
+            case BOX('i', 'l', 's', 't'): {
+                if (depth < 4) {
+                    walk_mp4(r, res, body, body_end, type, depth + 1);
+                }
+                break;
+            }
+            case BOX('m', 'e', 't', 'a'): {
+                /* A full box (version and flags) except in QuickTime files */
+                if (depth < 4 && body_end - body >= 8 &&
+                    read_at(r, body, h, 8)) {
+                    bool full = be32(h + 4) != BOX('h', 'd', 'l', 'r');
+                    walk_mp4(r, res, body + (full ? 4 : 0), body_end, type,
+                             depth + 1);
+                }
+                break;
+            }
+            case BOX('m', 'v', 'h', 'd'): {
+                size_t n = body_end - body < 32 ? body_end - body : 32;
+                if (n >= 20 && read_at(r, body, h, n)) {
+                    uint32_t scale = h[0] == 1 ? (n >= 32 ? be32(h + 20) : 0)
+                                               : be32(h + 12);
+                    uint64_t len = h[0] == 1 ? (n >= 32 ? be64(h + 24) : 0)
+                                             : be32(h + 16);
+                    if (scale > 0) {
+                        res->rec.duration = (uint32_t)(len / scale);
+                    }
+                }
+                break;
+            }
+            default: {
+                if (parent == BOX('i', 'l', 's', 't')) {
+                    parse_mp4_item(r, res, type, body, body_end - body);
+                }
+                break;
+            }
+        }
+        off = body_end;
+    }
+}
+
+static void parse_file(const Reader *r, TagResult *res)
+{
+    uint8_t h[12];
+    if (!read_at(r, 0, h, sizeof(h))) {
+        return;
+    }
+    uint64_t end = 0;
+    if (memcmp(h, "fLaC", 4) == 0) {
+        parse_flac(r, res, 0);
+    } else if (memcmp(h, "OggS", 4) == 0) {
+        parse_ogg(r, res);
+    } else if (memcmp(h + 4, "ftyp", 4) == 0) {
+        walk_mp4(r, res, 0, r->size, 0, 0);
+    } else if (parse_id3v2(r, res, &end)) {
+        parse_flac(r, res, end); /* FLAC with a leading ID3v2 tag */
+        parse_id3v1(r, res);     /* Fills what the ID3v2 tag lacked */
+    } else {
+        parse_id3v1(r, res);
+    }
+}
+
+/* Cache */
+
+static int compare_files(const TagRecord *a, const TagRecord *b)
+{
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    if (a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    if (a->mtime_sec != b->mtime_sec) {
+        return a->mtime_sec < b->mtime_sec ? -1 : 1;
+    }
+    if (a->mtime_nsec != b->mtime_nsec) {
+        return a->mtime_nsec < b->mtime_nsec ? -1 : 1;
+    }
+    if (a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    return 0;
+}
+
+static void load_cache(void)
+{
+    int fd = open(tg.path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const CacheHeader *hdr = map;
+    size_t len = st.st_size;
+    const TagRecord *recs = (const TagRecord *)(hdr + 1);
+    const char *pool = (const char *)(recs + hdr->n_records);
+    bool ok = memcmp(hdr->magic, TAGS_MAGIC, sizeof(TAGS_MAGIC)) == 0 &&
+              hdr->version == TAGS_VERSION &&
+              hdr->n_records <= len / sizeof(TagRecord) &&
+              sizeof(CacheHeader) + hdr->n_records * sizeof(TagRecord) +
+              hdr->pool_size == len &&
+              (hdr->pool_size == 0 || pool[hdr->pool_size - 1] == '\0');
+    for (uint64_t i = 0; ok && i < hdr->n_records; i++) {
+        for (int t = 0; t < N_TEXT; t++) {
+            ok = ok && (recs[i].text[t] == NO_TEXT ||
+                        recs[i].text[t] < hdr->pool_size);
+        }
+    }
+    if (!ok) {
+        munmap(map, len);
+        return;
+    }
+    tg.map = map;
+    tg.map_len = len;
+    tg.cache = recs;
+    tg.cache_n = hdr->n_records;
+    tg.cache_pool = pool;
+}
+
+static bool cache_find(TagResult *res)
+{
+    size_t lo = 0;
+    size_t hi = tg.cache_n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_files(&tg.cache[mid], &res->rec);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            const TagRecord *c = &tg.cache[mid];
+            for (int t = 0; t < N_TEXT; t++) {
+                if (c->text[t] != NO_TEXT) {
+                    const char *s = tg.cache_pool + c->text[t];
+                    set_text(res, t, s, strlen(s));
+                }
+            }
+            res->rec.track = c->track;
+            res->rec.duration = c->duration;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    const TagRecord *rec;
+    const char *pool;
+    int rank;              /* 0: this run, 1: the old cache */
+} CacheRef;
+
+static int compare_refs(const void *p, const void *q)
+{
+    const CacheRef *a = p;
+    const CacheRef *b = q;
+    int cmp = compare_files(a->rec, b->rec);
+    return cmp != 0 ? cmp : a->rank - b->rank;
+}
+
+static bool write_all(FILE *fp, const void *buf, size_t len)
+{
+    return fwrite(buf, 1, len, fp) == len;
+}
+
+static void save_cache(void)
+{
+    /* Old records only survive while some songs were never looked at:
+     * they may still belong to one of those */
+    bool complete = (tg.fed_all && tg.n_pending == 0);
+    size_t n_old = complete ? 0 : tg.cache_n;
+    size_t n_done = 0;
+    for (size_t i = 0; i < tg.n_slots; i++) {
+        n_done += (tg.slots[i].state == SLOT_DONE);
+    }
+    if (tg.parsed == 0 && !(complete && tg.cache_n > n_done)) {
+        return;
+    }
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", tg.path, (long)getpid());
+    CacheRef *refs = malloc((n_done + n_old + 1) * sizeof(CacheRef));
+    if (refs == NULL) {
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < tg.n_slots; i++) {
+        if (tg.slots[i].state == SLOT_DONE) {
+            refs[n++] = (CacheRef){ &tg.slots[i].rec, tg.pool.base, 0 };
+        }
+    }
+    for (size_t i = 0; i < n_old; i++) {
+        refs[n++] = (CacheRef){ &tg.cache[i], tg.cache_pool, 1 };
+    }
+    qsort(refs, n, sizeof(CacheRef), compare_refs);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        free(refs);
+        return;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    CacheHeader hdr = { .magic = TAGS_MAGIC, .version = TAGS_VERSION };
+    bool ok = write_all(fp, &hdr, sizeof(hdr));
+
+    /* Records with offsets into the new pool, then the pool itself */
+    uint64_t off = 0;
+    for (int pass = 0; pass < 2 && ok; pass++) {
+        for (size_t i = 0; ok && i < n; i++) {
+            if (i > 0 && compare_files(refs[i].rec, refs[i - 1].rec) == 0) {
+                continue;
+            }
+            TagRecord rec = *refs[i].rec;
+            if (pass == 0) {
+                hdr.n_records++;
+            }
+            for (int t = 0; ok && t < N_TEXT; t++) {
+                if (rec.text[t] == NO_TEXT) {
+                    continue;
+                }
+                const char *s = refs[i].pool + rec.text[t];
+                size_t len = strlen(s) + 1;
+                if (pass == 0) {
+                    rec.text[t] = (uint32_t)off;
+                    off += len;
+                } else {
+                    ok = write_all(fp, s, len);
+                }
+            }
+            if (pass == 0) {
+                ok = write_all(fp, &rec, sizeof(rec));
+            }
+        }
+    }
+    hdr.pool_size = off;
+    ok = ok && off < NO_TEXT && fseek(fp, 0, SEEK_SET) == 0 &&
+         write_all(fp, &hdr, sizeof(hdr));
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmp, tg.path) == -1) {
+        unlink(tmp);
+    }
+    free(refs);
+}
+
+/* Workers */
+
+static bool ring_push(TagResult *res)
+{
+    size_t pos = atomic_load_explicit(&tg.ring_tail, memory_order_relaxed);
+    RingCell *cell;
+    for (;;) {
+        cell = &tg.ring[pos & (RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &tg.ring_tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; /* Full */
+        } else {
+            pos = atomic_load_explicit(&tg.ring_tail, memory_order_relaxed);
+        }
+    }
+    cell->res = res;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static TagResult *ring_pop(void)
+{
+    RingCell *cell = &tg.ring[tg.ring_head & (RING_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != tg.ring_head + 1) {
+        return NULL;
+    }
+    TagResult *res = cell->res;
+    atomic_store_explicit(&cell->seq, tg.ring_head + RING_SIZE,
+                          memory_order_release);
+    tg.ring_head++;
+    return res;
+}
+
+static void deliver(TagResult *res)
+{
+    struct timespec wait = { 0, 1000000 };
+    while (!ring_push(res)) {
+        /* The UI is busy: wait for it, unless we are shutting down */
+        if (atomic_load(&tg.stop)) {
+            free(res);
+            return;
+        }
+        nanosleep(&wait, NULL);
+    }
+    if (!atomic_exchange(&tg.signalled, true)) {
+        uint64_t one = 1;
+        (void)!write(tg.efd, &one, sizeof(one));
+    }
+}
+
+static void read_tags(const TagJob *job)
+{
+    TagResult *res = calloc(1, sizeof(TagResult));
+    if (res == NULL) {
+        return;
+    }
+    res->key = job->key;
+    res->gen = job->gen;
+    int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd != -1 && fstat(fd, &st) == 0) {
+        res->ok = true;
+        res->rec.dev = st.st_dev;
+        res->rec.ino = st.st_ino;
+        res->rec.mtime_sec = st.st_mtim.tv_sec;
+        res->rec.mtime_nsec = st.st_mtim.tv_nsec;
+        res->rec.size = st.st_size;
+        res->cached = cache_find(res);
+        if (!res->cached) {
+            /* No readahead: it would pull in the audio after the tags */
+            posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+            Reader r = { fd, (uint64_t)st.st_size };
+            parse_file(&r, res);
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    deliver(res);
+}
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    pthread_once(&tg.once, load_cache);
+    for (;;) {
+        pthread_mutex_lock(&tg.lock);
+        while (tg.count == 0 && !atomic_load(&tg.stop)) {
+            pthread_cond_wait(&tg.cond, &tg.lock);
+        }
+        if (atomic_load(&tg.stop)) {
+            pthread_mutex_unlock(&tg.lock);
+            return NULL;
+        }
+        TagJob *job = tg.jobs[tg.head];
+        tg.head = (tg.head + 1) % MAX_JOBS;
+        tg.count--;
+        pthread_mutex_unlock(&tg.lock);
+
+        read_tags(job);
+        free(job);
+    }
+}
+
+/* Table (UI thread) */
+
+static uint32_t hash_key(uint32_t key, size_t cap)
+{
+    /* Fibonacci hashing: the top bits of the product are the mixed ones */
+    int bits = __builtin_ctzll(cap);
+    return (uint32_t)(key * 2654435761u) >> (32 - bits);
+}
+
+static TagSlot *find_slot(uint32_t key)
+{
+    if (tg.hash_cap == 0) {
+        return NULL;
+    }
+    for (uint32_t h = hash_key(key, tg.hash_cap); tg.hash[h] != 0;
+         h = (h + 1) & (tg.hash_cap - 1)) {
+        if (tg.slots[tg.hash[h] - 1].key == key) {
+            return &tg.slots[tg.hash[h] - 1];
+        }
+    }
+    return NULL;
+}
+
+static bool rehash(size_t cap)
+{
+    uint32_t *hash = calloc(cap, sizeof(uint32_t));
+    if (hash == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < tg.n_slots; i++) {
+        uint32_t h = hash_key(tg.slots[i].key, cap);
+        while (hash[h] != 0) {
+            h = (h + 1) & (cap - 1);
+        }
+        hash[h] = (uint32_t)i + 1;
+    }
+    free(tg.hash);
+    tg.hash = hash;
+    tg.hash_cap = cap;
+    return true;
+}
+
+static bool grow_hash(void)
+{
+    return rehash(tg.hash_cap > 0 ? 2 * tg.hash_cap : 1024);
+}
+
+static TagSlot *add_slot(uint32_t key)
+{
+    if (2 * (tg.n_slots + 1) > tg.hash_cap && !grow_hash()) {
+        return NULL;
+    }
+    if (tg.n_slots == tg.slots_cap) {
+        size_t cap = tg.slots_cap > 0 ? 2 * tg.slots_cap : 1024;
+        TagSlot *slots = realloc(tg.slots, cap * sizeof(TagSlot));
+        if (slots == NULL) {
+            return NULL;
+        }
+        tg.slots = slots;
+        tg.slots_cap = cap;
+    }
+    TagSlot *slot = &tg.slots[tg.n_slots++];
+    memset(slot, 0, sizeof(*slot));
+    slot->key = key;
+    slot->state = SLOT_PENDING;
+    uint32_t h = hash_key(key, tg.hash_cap);
+    while (tg.hash[h] != 0) {
+        h = (h + 1) & (tg.hash_cap - 1);
+    }
+    tg.hash[h] = (uint32_t)tg.n_slots;
+    return slot;
+}
+
+static bool push_job(const SongArr *songarr, size_t idx, bool front,
+                     size_t limit)
+{
+    /* Returns false when the queue is at limit */
+    uint32_t key = songarr->arr[idx].name;
+    char path[PATH_MAX];
+    size_t len = songarr_path(songarr, idx, path, sizeof(path));
+    if (len >= sizeof(path)) {
+        return true; /* Skipped for good */
+    }
+    TagJob *job = malloc(sizeof(TagJob) + len + 1);
+    if (job == NULL) {
+        return false;
+    }
+    job->key = key;
+    job->gen = tg.gen;
+    memcpy(job->path, path, len + 1);
+
+    /* Only this thread adds jobs, so the count cannot grow meanwhile */
+    pthread_mutex_lock(&tg.lock);
+    bool full = (tg.count >= limit);
+    pthread_mutex_unlock(&tg.lock);
+    if (full || add_slot(key) == NULL) {
+        free(job);
+        return false;
+    }
+
+    pthread_mutex_lock(&tg.lock);
+    if (front) {
+        tg.head = (tg.head + MAX_JOBS - 1) % MAX_JOBS;
+        tg.jobs[tg.head] = job;
+    } else {
+        tg.jobs[(tg.head + tg.count) % MAX_JOBS] = job;
+    }
+    tg.count++;
+    pthread_mutex_unlock(&tg.lock);
+    pthread_cond_signal(&tg.cond);
+    tg.n_pending++;
+    return true;
+}
+
+int tags_init(const char *const *roots, size_t n_roots, int n_threads)
+{
+    if (!libindex_cache_path(roots, n_roots, "tags", tg.path, sizeof(tg.path),
+                             true)) {
+        return -1;
+    }
+    tg.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tg.efd == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < RING_SIZE; i++) {
+        atomic_init(&tg.ring[i].seq, i);
+    }
+    strpool_init(&tg.pool);
+    pthread_mutex_init(&tg.lock, NULL);
+    pthread_cond_init(&tg.cond, NULL);
+
+    if (n_threads <= 0) {
+        n_threads = scan_default_threads();
+    }
+    n_threads = n_threads > MAX_WORKERS ? MAX_WORKERS : n_threads;
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&tg.threads[i], NULL, worker_main, NULL) != 0) {
+            break;
+        }
+        tg.n_threads++;
+    }
+    if (tg.n_threads == 0) {
+        close(tg.efd);
+        tg.efd = -1;
+        return -1;
+    }
+    tg.started = true;
+    return tg.efd;
+}
+
+void tags_destroy(void)
+{
+    if (!tg.started) {
+        return;
+    }
+    pthread_mutex_lock(&tg.lock);
+    atomic_store(&tg.stop, true);
+    pthread_cond_broadcast(&tg.cond);
+    pthread_mutex_unlock(&tg.lock);
+    for (int i = 0; i < tg.n_threads; i++) {
+        pthread_join(tg.threads[i], NULL);
+    }
+    tags_collect();
+    for (size_t i = 0; i < tg.count; i++) {
+        free(tg.jobs[(tg.head + i) % MAX_JOBS]);
+    }
+    save_cache();
+
+    if (tg.map != NULL) {
+        munmap(tg.map, tg.map_len);
+    }
+    strpool_destroy(&tg.pool);
+    free(tg.slots);
+    free(tg.hash);
+    close(tg.efd);
+    pthread_mutex_destroy(&tg.lock);
+    pthread_cond_destroy(&tg.cond);
+    tg.started = false;
+}
+
+void tags_feed(const SongArr *songarr)
+{
+    /* Background work, in menu order; keeps half the queue for tags_want */
+    if (!tg.started) {
+        return;
+    }
+    for (; tg.feed_pos < songarr->size; tg.feed_pos++) {
+        if (find_slot(songarr->arr[tg.feed_pos].name) != NULL) {
+            continue;
+        }
+        if (!push_job(songarr, tg.feed_pos, false, MAX_JOBS / 2)) {
+            return;
+        }
+    }
+    tg.fed_all = true;
+}
+
+void tags_want(const SongArr *songarr, size_t idx)
+{
+    /* A visible song: ahead of the background work */
+    if (tg.started && find_slot(songarr->arr[idx].name) == NULL) {
+        push_job(songarr, idx, true, MAX_JOBS);
+    }
+}
+
+bool tags_collect(void)
+{
+    /* Returns true when any song got its tags */
+    if (!tg.started) {
+        return false;
+    }
+    uint64_t count;
+    (void)!read(tg.efd, &count, sizeof(count));
+    atomic_store(&tg.signalled, false);
+
+    bool any = false;
+    TagResult *res;
+    while ((res = ring_pop()) != NULL) {
+        TagSlot *slot = (res->gen == tg.gen) ? find_slot(res->key) : NULL;
+        if (slot != NULL && slot->state == SLOT_PENDING) {
+            tg.n_pending--;
+            slot->state = res->ok ? SLOT_DONE : SLOT_FAILED;
+            slot->rec = res->rec;
+            for (int t = 0; t < N_TEXT; t++) {
+                size_t len = strlen(res->text[t]);
+                slot->rec.text[t] = NO_TEXT;
+                if (len > 0 &&
+                    !strpool_add(&tg.pool, res->text[t], len,
+                                 &slot->rec.text[t])) {
+                    slot->rec.text[t] = NO_TEXT;
+                }
+            }
+            tg.parsed += (res->ok && !res->cached);
+            any = true;
+        }
+        free(res);
+    }
+    return any;
+}
+
+void tags_rescan(void)
+{
+    /* The library changed: look for songs without tags from the start */
+    tg.feed_pos = 0;
+    tg.fed_all = false;
+}
+
+void tags_rekey(const SongArr *songarr, const uint32_t *old_names)
+{
+    /* The library pool was compacted: finished songs move to their new
+     * keys, the rest are dropped with their jobs and asked for again */
+    if (!tg.started) {
+        return;
+    }
+    TagSlot *slots = malloc((songarr->size + 1) * sizeof(TagSlot));
+    size_t n = 0;
+    for (size_t i = 0; slots != NULL && i < songarr->size; i++) {
+        const TagSlot *slot = find_slot(old_names[i]);
+        if (slot != NULL && slot->state != SLOT_PENDING) {
+            slots[n] = *slot;
+            slots[n++].key = songarr->arr[i].name;
+        }
+    }
+    /* Out of memory, the old keys are no good either: start over */
+    if (slots != NULL) {
+        free(tg.slots);
+        tg.slots = slots;
+        tg.slots_cap = songarr->size + 1;
+    }
+    tg.n_slots = n;
+    if (tg.hash_cap > 0 && !rehash(tg.hash_cap)) {
+        memset(tg.hash, 0, tg.hash_cap * sizeof(uint32_t));
+        tg.n_slots = 0;
+    }
+
+    pthread_mutex_lock(&tg.lock);
+    for (size_t i = 0; i < tg.count; i++) {
+        free(tg.jobs[(tg.head + i) % MAX_JOBS]);
+    }
+    tg.count = 0;
+    pthread_mutex_unlock(&tg.lock);
+    tg.n_pending = 0;
+    tg.gen++; /* Results in flight carry old keys */
+    tags_rescan();
+}
+
+bool tags_get(const SongArr *songarr, size_t idx, SongTags *tags)
+{
+    const TagSlot *slot = tg.started ? find_slot(songarr->arr[idx].name)
+                                     : NULL;
+    if (slot == NULL || slot->state != SLOT_DONE) {
+        return false;
+    }
+    const char *text[N_TEXT];
+    for (int t = 0; t < N_TEXT; t++) {
+        text[t] = slot->rec.text[t] == NO_TEXT
+                  ? NULL : strpool_str(&tg.pool, slot->rec.text[t]);
+    }
+    tags->artist = text[T_ARTIST];
+    tags->album = text[T_ALBUM];
+    tags->title = text[T_TITLE];
+    tags->track = slot->rec.track;
+    tags->duration = (int)slot->rec.duration;
+    return true;
+}
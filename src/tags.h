@@ -0,0 +1,35 @@
+/* File: tags.h
+ * Date: 2026-10-17
+ *
+ * Background tag reader with a persistent cache.
+ */
+
+#ifndef TAGS_H
+#define TAGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "songarr.h"
+
+typedef struct {
+    const char *artist; /* NULL when unknown */
+    const char *album;
+    const char *title;
+    int track;          /* 0 when unknown */
+    int duration;       /* Seconds, 0 when unknown */
+} SongTags;
+
+/* Returns an eventfd that becomes readable when results are waiting for
+ * tags_collect(), or -1. */
+int tags_init(const char *const *roots, size_t n_roots, int n_threads);
+void tags_destroy(void);
+void tags_feed(const SongArr *songarr);
+void tags_want(const SongArr *songarr, size_t idx);
+bool tags_collect(void);
+void tags_rescan(void);
+/* After songarr_compact(): old_names[i] was the name offset of song i */
+void tags_rekey(const SongArr *songarr, const uint32_t *old_names);
+/* The strings stay valid until the next tags_collect() */
+bool tags_get(const SongArr *songarr, size_t idx, SongTags *tags);
+
+#endif
@@ -0,0 +1,556 @@
+/* File: tree.c
+ * Date: 2026-10-17
+ *
+ * Lazily read directory tree for the menu's tree view.
+ *
+ * Nothing below a directory is known until it is opened: opening reads that
+ * one directory (subdirectories plus audio files, see filetype.c) and
+ * appends its entries to the node array as one contiguous block, so memory
+ * follows what was opened rather than the size of the library. Listings
+ * are kept when a directory is closed again.
+ *
+ * After a directory is opened, a background thread reads its first few
+ * subdirectories ahead of time; opening one of those then only copies the
+ * finished listing. Only the UI thread touches the nodes and rows.
+ */
+
+#define _GNU_SOURCE /* qsort_r */
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "collate.h"
+#include "filetype.h"
+#include "strpool.h"
+#include "tree.h"
+
+#define MAX_PREFETCH 32  /* Subdirectories read ahead per opened directory */
+#define MAX_DONE 256     /* Finished listings kept until they are opened */
+#define NO_NODE UINT32_MAX
+
+enum {
+    NODE_DIR = 1,
+    NODE_READ = 2,  /* Children are listed */
+    NODE_OPEN = 4,  /* Children are rows */
+};
+
+typedef struct {
+    uint32_t name;        /* Pool offset; roots hold the whole path */
+    uint32_t parent;
+    uint32_t first;       /* Children, once read */
+    uint32_t n_children;
+    uint16_t depth;       /* The root is 0 */
+    uint8_t flags;
+} Node;
+
+typedef struct {
+    uint32_t name;        /* Offset in Listing.names */
+    bool is_dir;
+} Entry;
+
+/* One directory read, by the UI thread or ahead of time */
+typedef struct Listing {
+    struct Listing *next;
+    uint32_t node;
+    bool ok;
+    Entry *entries;
+    size_t n;
+    size_t cap;
+    StrPool names;
+    char path[];
+} Listing;
+
+static struct Tree {
+    bool multi;           /* Node 0 only lists the roots, it has no path */
+    Node *nodes;
+    size_t n_nodes;
+    size_t cap;
+    StrPool pool;
+    uint32_t *rows;       /* Visible nodes, in display order */
+    size_t n_rows;
+    size_t rows_cap;
+
+    /* Shared with the prefetch thread */
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Listing *jobs[MAX_PREFETCH];
+    size_t n_jobs;
+    Listing *done;        /* Newest first */
+    size_t n_done;
+    bool stop;
+} tr;
+
+static int compare_entries(const void *a, const void *b, void *ctx)
+{
+    /* Directories first, then the same order as the flat list */
+    const Entry *ea = a;
+    const Entry *eb = b;
+    const StrPool *names = ctx;
+    if (ea->is_dir != eb->is_dir) {
+        return ea->is_dir ? -1 : 1;
+    }
+    return collate_compare(strpool_str(names, ea->name),
+                           strpool_str(names, eb->name));
+}
+
+static bool listing_add(Listing *ls, const char *name, bool is_dir)
+{
+    if (ls->n == ls->cap) {
+        size_t cap = ls->cap > 0 ? 2 * ls->cap : 64;
+        Entry *tmp = realloc(ls->entries, cap * sizeof(Entry));
+        if (tmp == NULL) {
+            return false;
+        }
+        ls->entries = tmp;
+        ls->cap = cap;
+    }
+    Entry *e = &ls->entries[ls->n];
+    if (!strpool_add(&ls->names, name, strlen(name), &e->name)) {
+        return false;
+    }
+    e->is_dir = is_dir;
+    ls->n++;
+    return true;
+}
+
+static void read_listing(Listing *ls)
+{
+    /* Same rules as scan_one(): no hidden directories, audio files only.
+     * An unreadable directory is simply empty. */
+    ls->ok = true;
+    int fd = openat(AT_FDCWD, ls->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    DIR *pdir = fdopendir(fd);
+    if (pdir == NULL) {
+        close(fd);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(pdir)) != NULL) {
+        bool keep = false;
+        bool is_dir = false;
+        switch (entry->d_type) {
+            case DT_DIR: {
+                keep = is_dir = (entry->d_name[0] != '.');
+                break;
+            }
+            case DT_REG: {
+                keep = filetype_is_audio(fd, entry->d_name);
+                break;
+            }
+            default: break;
+        }
+        if (keep && !listing_add(ls, entry->d_name, is_dir)) {
+            ls->ok = false;
+            break;
+        }
+    }
+    closedir(pdir);
+    if (ls->n > 1) {
+        qsort_r(ls->entries, ls->n, sizeof(Entry), compare_entries,
+                &ls->names);
+    }
+}
+
+static Listing *listing_new(uint32_t node, const char *path)
+{
+    size_t len = strlen(path);
+    Listing *ls = calloc(1, sizeof(Listing) + len + 1);
+    if (ls == NULL) {
+        return NULL;
+    }
+    ls->node = node;
+    strpool_init(&ls->names);
+    memcpy(ls->path, path, len + 1);
+    return ls;
+}
+
+static void listing_free(Listing *ls)
+{
+    if (ls != NULL) {
+        strpool_destroy(&ls->names);
+        free(ls->entries);
+        free(ls);
+    }
+}
+
+static void *prefetch_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&tr.lock);
+    for (;;) {
+        while (tr.n_jobs == 0 && !tr.stop) {
+            pthread_cond_wait(&tr.cond, &tr.lock);
+        }
+        if (tr.stop) {
+            break;
+        }
+        Listing *ls = tr.jobs[0];
+        memmove(tr.jobs, tr.jobs + 1, --tr.n_jobs * sizeof(Listing *));
+        pthread_mutex_unlock(&tr.lock);
+
+        read_listing(ls);
+
+        pthread_mutex_lock(&tr.lock);
+        ls->next = tr.done;
+        tr.done = ls;
+        if (++tr.n_done > MAX_DONE) {
+            /* Forget the oldest: it is read again if it is ever opened */
+            Listing **pp = &tr.done;
+            for (size_t i = 1; i < MAX_DONE; i++) {
+                pp = &(*pp)->next;
+            }
+            listing_free((*pp)->next);
+            (*pp)->next = NULL;
+            tr.n_done = MAX_DONE;
+        }
+    }
+    pthread_mutex_unlock(&tr.lock);
+    return NULL;
+}
+
+static size_t node_path(uint32_t node, char *buf, size_t size)
+{
+    /* Like snprintf() */
+    const Node *nd = &tr.nodes[node];
+    const char *name = strpool_str(&tr.pool, nd->name);
+    if (nd->parent == NO_NODE || (tr.multi && nd->parent == 0)) {
+        int n = snprintf(buf, size, "%s", name);
+        return n < 0 ? 0 : (size_t)n;
+    }
+    size_t len = node_path(nd->parent, buf, size);
+    int n = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0,
+                     "/%s", name);
+    return len + (n < 0 ? 0 : (size_t)n);
+}
+
+static bool in_done(uint32_t node)
+{
+    for (const Listing *ls = tr.done; ls != NULL; ls = ls->next) {
+        if (ls->node == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void prefetch_children(uint32_t node)
+{
+    /* Only the latest opened directory is read ahead: earlier jobs that
+     * have not started are dropped */
+    if (!tr.started) {
+        return;
+    }
+    const Node *nd = &tr.nodes[node];
+    pthread_mutex_lock(&tr.lock);
+    for (size_t i = 0; i < tr.n_jobs; i++) {
+        listing_free(tr.jobs[i]);
+    }
+    tr.n_jobs = 0;
+    for (uint32_t i = 0; i < nd->n_children && tr.n_jobs < MAX_PREFETCH; i++) {
+        uint32_t child = nd->first + i;
+        if ((tr.nodes[child].flags & (NODE_DIR | NODE_READ)) != NODE_DIR ||
+            in_done(child)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        if (node_path(child, path, sizeof(path)) >= sizeof(path)) {
+            continue;
+        }
+        Listing *ls = listing_new(child, path);
+        if (ls == NULL) {
+            break;
+        }
+        tr.jobs[tr.n_jobs++] = ls;
+    }
+    if (tr.n_jobs > 0) {
+        pthread_cond_signal(&tr.cond);
+    }
+    pthread_mutex_unlock(&tr.lock);
+}
+
+static Listing *take_prefetched(uint32_t node)
+{
+    if (!tr.started) {
+        return NULL;
+    }
+    Listing *found = NULL;
+    pthread_mutex_lock(&tr.lock);
+    for (Listing **pp = &tr.done; *pp != NULL; pp = &(*pp)->next) {
+        if ((*pp)->node == node) {
+            found = *pp;
+            *pp = found->next;
+            tr.n_done--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tr.lock);
+    return found;
+}
+
+static bool adopt_listing(uint32_t node, const Listing *ls)
+{
+    if (tr.n_nodes + ls->n >= NO_NODE) {
+        return false;
+    }
+    if (tr.n_nodes + ls->n > tr.cap) {
+        size_t cap = tr.cap > 0 ? 2 * tr.cap : 1024;
+        while (cap < tr.n_nodes + ls->n) {
+            cap *= 2;
+        }
+        Node *tmp = realloc(tr.nodes, cap * sizeof(Node));
+        if (tmp == NULL) {
+            return false;
+        }
+        tr.nodes = tmp;
+        tr.cap = cap;
+    }
+    uint32_t base;
+    if (!strpool_append(&tr.pool, &ls->names, &base)) {
+        return false;
+    }
+
+    Node *nd = &tr.nodes[node];
+    nd->first = (uint32_t)tr.n_nodes;
+    nd->n_children = (uint32_t)ls->n;
+    nd->flags |= NODE_READ;
+    for (size_t i = 0; i < ls->n; i++) {
+        tr.nodes[tr.n_nodes++] = (Node){
+            .name = base + ls->entries[i].name,
+            .parent = node,
+            .first = 0,
+            .n_children = 0,
+            .depth = nd->depth + 1,
+            .flags = ls->entries[i].is_dir ? NODE_DIR : 0,
+        };
+    }
+    return true;
+}
+
+static bool read_node(uint32_t node)
+{
+    Listing *ls = take_prefetched(node);
+    if (ls == NULL || !ls->ok) {
+        listing_free(ls);
+        char path[PATH_MAX];
+        if (node_path(node, path, sizeof(path)) >= sizeof(path)) {
+            tr.nodes[node].flags |= NODE_READ; /* Shown empty */
+            return true;
+        }
+        ls = listing_new(node, path);
+        if (ls == NULL) {
+            return false;
+        }
+        read_listing(ls);
+    }
+    bool ok = ls->ok && adopt_listing(node, ls);
+    listing_free(ls);
+    return ok;
+}
+
+static size_t count_open(uint32_t node)
+{
+    /* Rows below an open directory, including reopened subdirectories */
+    const Node *nd = &tr.nodes[node];
+    size_t n = nd->n_children;
+    for (uint32_t i = 0; i < nd->n_children; i++) {
+        if (tr.nodes[nd->first + i].flags & NODE_OPEN) {
+            n += count_open(nd->first + i);
+        }
+    }
+    return n;
+}
+
+static uint32_t *fill_open(uint32_t node, uint32_t *out)
+{
+    const Node *nd = &tr.nodes[node];
+    for (uint32_t i = 0; i < nd->n_children; i++) {
+        uint32_t child = nd->first + i;
+        *out++ = child;
+        if (tr.nodes[child].flags & NODE_OPEN) {
+            out = fill_open(child, out);
+        }
+    }
+    return out;
+}
+
+static bool show_children(uint32_t node, size_t at)
+{
+    /* Inserts the rows below node at row index at */
+    size_t n = count_open(node);
+    if (tr.n_rows + n > tr.rows_cap) {
+        size_t cap = tr.rows_cap > 0 ? 2 * tr.rows_cap : 1024;
+        while (cap < tr.n_rows + n) {
+            cap *= 2;
+        }
+        uint32_t *tmp = realloc(tr.rows, cap * sizeof(uint32_t));
+        if (tmp == NULL) {
+            return false;
+        }
+        tr.rows = tmp;
+        tr.rows_cap = cap;
+    }
+    memmove(tr.rows + at + n, tr.rows + at, (tr.n_rows - at) * sizeof(uint32_t));
+    fill_open(node, tr.rows + at);
+    tr.n_rows += n;
+    return true;
+}
+
+static bool list_roots(const char *const *roots, size_t n_roots)
+{
+    /* Several roots: they are the top level, in the order given */
+    Listing *ls = listing_new(0, "");
+    bool ok = ls != NULL;
+    for (size_t i = 0; ok && i < n_roots; i++) {
+        ok = listing_add(ls, roots[i], true);
+    }
+    ok = ok && adopt_listing(0, ls);
+    listing_free(ls);
+    return ok;
+}
+
+bool tree_init(const char *const *roots, size_t n_roots)
+{
+    strpool_init(&tr.pool);
+    tr.cap = 1024;
+    tr.nodes = malloc(tr.cap * sizeof(Node));
+    if (tr.nodes == NULL) {
+        return false;
+    }
+    tr.n_nodes = 1;
+    tr.multi = n_roots > 1;
+    tr.nodes[0] = (Node){ .parent = NO_NODE, .flags = NODE_DIR };
+    const char *top = tr.multi ? "" : roots[0];
+    if (!strpool_add(&tr.pool, top, strlen(top), &tr.nodes[0].name)) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&tr.lock, NULL);
+    pthread_cond_init(&tr.cond, NULL);
+    /* Optional: without it every directory is read when opened */
+    tr.started = (pthread_create(&tr.thread, NULL, prefetch_main, NULL) == 0);
+
+    bool listed = tr.multi ? list_roots(roots, n_roots) : read_node(0);
+    if (!listed || !show_children(0, 0)) {
+        tree_destroy();
+        return false;
+    }
+    tr.nodes[0].flags |= NODE_OPEN;
+    prefetch_children(0);
+    return true;
+
+    fail:
+    free(tr.nodes);
+    strpool_destroy(&tr.pool);
+    memset(&tr, 0, sizeof(tr));
+    return false;
+}
+
+void tree_destroy(void)
+{
+    if (tr.started) {
+        pthread_mutex_lock(&tr.lock);
+        tr.stop = true;
+        pthread_cond_signal(&tr.cond);
+        pthread_mutex_unlock(&tr.lock);
+        pthread_join(tr.thread, NULL);
+    }
+    for (size_t i = 0; i < tr.n_jobs; i++) {
+        listing_free(tr.jobs[i]);
+    }
+    while (tr.done != NULL) {
+        Listing *next = tr.done->next;
+        listing_free(tr.done);
+        tr.done = next;
+    }
+    pthread_mutex_destroy(&tr.lock);
+    pthread_cond_destroy(&tr.cond);
+    free(tr.nodes);
+    free(tr.rows);
+    strpool_destroy(&tr.pool);
+    memset(&tr, 0, sizeof(tr));
+}
+
+size_t tree_size(void)
+{
+    return tr.n_rows;
+}
+
+bool tree_row(size_t row, TreeRow *out)
+{
+    if (row >= tr.n_rows) {
+        return false;
+    }
+    const Node *nd = &tr.nodes[tr.rows[row]];
+    out->name = strpool_str(&tr.pool, nd->name);
+    out->node = tr.rows[row];
+    out->depth = nd->depth - 1;
+    out->is_dir = (nd->flags & NODE_DIR) != 0;
+    out->open = (nd->flags & NODE_OPEN) != 0;
+    return true;
+}
+
+bool tree_toggle(size_t row)
+{
+    if (row >= tr.n_rows) {
+        return true;
+    }
+    uint32_t node = tr.rows[row];
+    Node *nd = &tr.nodes[node];
+    if (!(nd->flags & NODE_DIR)) {
+        return true;
+    }
+
+    if (nd->flags & NODE_OPEN) {
+        /* Descendants follow their directory, one level deeper or more */
+        size_t end = row + 1;
+        while (end < tr.n_rows && tr.nodes[tr.rows[end]].depth > nd->depth) {
+            end++;
+        }
+        memmove(tr.rows + row + 1, tr.rows + end,
+                (tr.n_rows - end) * sizeof(uint32_t));
+        tr.n_rows -= end - row - 1;
+        nd->flags &= ~NODE_OPEN;
+        return true;
+    }
+
+    if (!(nd->flags & NODE_READ) && !read_node(node)) {
+        return false;
+    }
+    if (!show_children(node, row + 1)) {
+        return false;
+    }
+    tr.nodes[node].flags |= NODE_OPEN; /* read_node() may have moved it */
+    prefetch_children(node);
+    return true;
+}
+
+size_t tree_parent(size_t row)
+{
+    if (row >= tr.n_rows) {
+        return TREE_NONE;
+    }
+    uint32_t parent = tr.nodes[tr.rows[row]].parent;
+    while (row-- > 0) {
+        if (tr.rows[row] == parent) {
+            return row;
+        }
+    }
+    return TREE_NONE;
+}
+
+size_t tree_dirpath(size_t row, char *buf, size_t size)
+{
+    if (row >= tr.n_rows) {
+        return 0;
+    }
+    return node_path(tr.nodes[tr.rows[row]].parent, buf, size);
+}
@@ -0,0 +1,38 @@
+/* File: tree.h
+ * Date: 2026-10-17
+ *
+ * Lazily read directory tree for the menu's tree view.
+ */
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TREE_NONE ((size_t)-1)
+
+/* One visible row; name stays valid until the next tree_toggle() */
+typedef struct {
+    const char *name;
+    uint32_t node;  /* Stable id of the entry */
+    int depth;      /* 0 for entries directly under the root */
+    bool is_dir;
+    bool open;
+} TreeRow;
+
+/* Reads the root directory only (with several, they are listed instead);
+ * subdirectories are read when opened */
+bool tree_init(const char *const *roots, size_t n_roots);
+void tree_destroy(void);
+size_t tree_size(void);
+bool tree_row(size_t row, TreeRow *out);
+/* Opens or closes the directory on row; false when out of memory */
+bool tree_toggle(size_t row);
+/* Row of the directory holding row, TREE_NONE at the top level */
+size_t tree_parent(size_t row);
+/* Like snprintf(): path of the directory holding row */
+size_t tree_dirpath(size_t row, char *buf, size_t size);
+
+#endif
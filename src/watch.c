@@ -0,0 +1,396 @@
+/* File: watch.c
+ * Date: 2026-10-17
+ *
+ * Live library updates via inotify.
+ *
+ * Events only record which directory entries were touched. Once the burst
+ * settles (or has been pending for too long) every touched entry is checked
+ * against the filesystem and the net result is handed to songarr_apply() in
+ * a single batch, so a large copy costs one merge and one redraw.
+ */
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "filetype.h"
+#include "scan.h"
+#include "songarr.h"
+#include "watch.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_ONLYDIR | IN_EXCL_UNLINK)
+#define SETTLE_MS 100   /* Quiet period that ends a burst */
+#define MAX_DELAY_MS 1000 /* Apply at least this often during a long burst */
+
+typedef struct {
+    char *dir;
+    char *name;
+    bool is_dir;
+} Touched;
+
+struct Watcher {
+    int fd;
+    int n_threads;
+    const char *const *roots;
+    size_t n_roots;
+    char **paths;   /* Watched directory, indexed by watch descriptor */
+    int n_paths;
+    Touched *touched;
+    size_t n_touched;
+    size_t touched_cap;
+    bool overflow;
+    long long first_ms; /* First and last event of the pending burst */
+    long long last_ms;
+} wt = { .fd = -1 };
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static char *join_path(const char *root, const char *branch)
+{
+    size_t root_len = strlen(root);
+    size_t branch_len = strlen(branch);
+    char *full_path = malloc(root_len + branch_len + 2);
+    if (full_path == NULL) {
+        return NULL;
+    }
+
+    memcpy(full_path, root, root_len);
+    full_path[root_len] = '/';
+    memcpy(full_path + root_len + 1, branch, branch_len + 1);
+
+    return full_path;
+}
+
+static bool is_under(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+    return strncmp(path, dir, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/');
+}
+
+static void add_watch(const char *path)
+{
+    int wd = inotify_add_watch(wt.fd, path, WATCH_MASK);
+    if (wd < 0) {
+        /* Out of watches (fs.inotify.max_user_watches): stay partial */
+        return;
+    }
+    if (wd >= wt.n_paths) {
+        int n = wt.n_paths > 0 ? wt.n_paths : 64;
+        while (n <= wd) {
+            n *= 2;
+        }
+        char **tmp = realloc(wt.paths, n * sizeof(char *));
+        if (tmp == NULL) {
+            inotify_rm_watch(wt.fd, wd);
+            return;
+        }
+        memset(tmp + wt.n_paths, 0, (n - wt.n_paths) * sizeof(char *));
+        wt.paths = tmp;
+        wt.n_paths = n;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        inotify_rm_watch(wt.fd, wd);
+        return;
+    }
+    free(wt.paths[wd]);
+    wt.paths[wd] = copy;
+}
+
+static void drop_watches(const char *dir)
+{
+    /* A directory moved out of the tree keeps its watch: remove it */
+    for (int wd = 0; wd < wt.n_paths; wd++) {
+        if (wt.paths[wd] != NULL && is_under(wt.paths[wd], dir)) {
+            inotify_rm_watch(wt.fd, wd);
+            free(wt.paths[wd]);
+            wt.paths[wd] = NULL;
+        }
+    }
+}
+
+int watch_init(const char *const *roots, size_t n_roots,
+               const SongArr *songarr, int n_threads)
+{
+    wt.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (wt.fd == -1) {
+        return -1;
+    }
+    wt.roots = roots;
+    wt.n_roots = n_roots;
+    wt.n_threads = n_threads;
+    for (size_t i = 0; i < songarr->n_dirs; i++) {
+        add_watch(songarr_dirpath(songarr, (uint32_t)i));
+    }
+    return wt.fd;
+}
+
+static void clear_touched(void)
+{
+    for (size_t i = 0; i < wt.n_touched; i++) {
+        free(wt.touched[i].dir);
+        free(wt.touched[i].name);
+    }
+    wt.n_touched = 0;
+    wt.overflow = false;
+}
+
+void watch_destroy(void)
+{
+    if (wt.fd == -1) {
+        return;
+    }
+    clear_touched();
+    free(wt.touched);
+    for (int wd = 0; wd < wt.n_paths; wd++) {
+        free(wt.paths[wd]);
+    }
+    free(wt.paths);
+    close(wt.fd);
+    wt.fd = -1;
+}
+
+static void touch(const char *dir, const char *name, bool is_dir)
+{
+    if (wt.n_touched == wt.touched_cap) {
+        size_t cap = wt.touched_cap > 0 ? 2 * wt.touched_cap : 64;
+        Touched *tmp = realloc(wt.touched, cap * sizeof(Touched));
+        if (tmp == NULL) {
+            wt.overflow = true;
+            return;
+        }
+        wt.touched = tmp;
+        wt.touched_cap = cap;
+    }
+    Touched t = { strdup(dir), strdup(name), is_dir };
+    if (t.dir == NULL || t.name == NULL) {
+        free(t.dir);
+        free(t.name);
+        wt.overflow = true;
+        return;
+    }
+    wt.touched[wt.n_touched++] = t;
+}
+
+void watch_read(void)
+{
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool got = false;
+    ssize_t n;
+
+    while ((n = read(wt.fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            got = true;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                wt.overflow = true;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                if (ev->wd >= 0 && ev->wd < wt.n_paths) {
+                    free(wt.paths[ev->wd]);
+                    wt.paths[ev->wd] = NULL;
+                }
+                continue;
+            }
+            if (ev->len == 0 || ev->wd < 0 || ev->wd >= wt.n_paths ||
+                wt.paths[ev->wd] == NULL) {
+                continue;
+            }
+            bool is_dir = (ev->mask & IN_ISDIR) != 0;
+            if (is_dir && ev->name[0] == '.') {
+                continue; /* The scanner never descends into these */
+            }
+            touch(wt.paths[ev->wd], ev->name, is_dir);
+        }
+    }
+    if (got) {
+        wt.last_ms = now_ms();
+        if (wt.first_ms == 0) {
+            wt.first_ms = wt.last_ms;
+        }
+    }
+}
+
+int watch_timeout(void)
+{
+    /* Milliseconds until pending changes are due, -1 when none */
+    if (wt.n_touched == 0 && !wt.overflow) {
+        return -1;
+    }
+    long long now = now_ms();
+    long long due = wt.last_ms + SETTLE_MS;
+    if (wt.first_ms + MAX_DELAY_MS < due) {
+        due = wt.first_ms + MAX_DELAY_MS;
+    }
+    return due <= now ? 0 : (int)(due - now);
+}
+
+static int compare_touched(const void *p, const void *q)
+{
+    const Touched *t1 = p;
+    const Touched *t2 = q;
+    int cmp = strcmp(t1->dir, t2->dir);
+    if (cmp == 0) {
+        cmp = strcmp(t1->name, t2->name);
+    }
+    if (cmp == 0) {
+        cmp = (int)t1->is_dir - (int)t2->is_dir;
+    }
+    return cmp;
+}
+
+static bool purge_tree(const SongArr *songarr, const char *dir,
+                       SongArr *purge)
+{
+    /* Drop dir and every directory below it */
+    struct timespec none = { 0, 0 };
+    drop_watches(dir);
+    if (!songarr_add_dir(purge, dir, none, NULL)) {
+        return false;
+    }
+    for (size_t i = 0; i < songarr->n_dirs; i++) {
+        const char *path = songarr_dirpath(songarr, (uint32_t)i);
+        if (is_under(path, dir) && !songarr_add_dir(purge, path, none, NULL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool diff_full(SongArr *songarr, const SongArrDelta *delta)
+{
+    /* Events were lost: purge everything and rescan the roots. Files
+     * that are still there keep their index (see songarr_apply()). */
+    for (size_t i = 0; i < wt.n_roots; i++) {
+        if (!purge_tree(songarr, wt.roots[i], delta->purge)) {
+            return false;
+        }
+    }
+    ScanOpts opts = { .n_threads = wt.n_threads };
+    return scan_tree(wt.roots, wt.n_roots, &opts, delta->add);
+}
+
+static bool note_file(SongArr *sa, const char *dir, const char *name,
+                      const char **last_dir, uint32_t *last_id)
+{
+    /* Touched entries arrive sorted: intern each directory once */
+    struct timespec none = { 0, 0 };
+    if ((*last_dir == NULL || strcmp(*last_dir, dir) != 0)) {
+        if (!songarr_add_dir(sa, dir, none, last_id)) {
+            return false;
+        }
+        *last_dir = dir;
+    }
+    return songarr_append(sa, *last_id, name);
+}
+
+static bool diff_touched(SongArr *songarr, const SongArrDelta *delta)
+{
+    qsort(wt.touched, wt.n_touched, sizeof(Touched), compare_touched);
+
+    const char **roots = malloc((wt.n_touched + 1) * sizeof(char *));
+    char **owned = malloc((wt.n_touched + 1) * sizeof(char *));
+    size_t n_roots = 0;
+    const char *add_dir = NULL;
+    const char *del_dir = NULL;
+    uint32_t add_id = 0;
+    uint32_t del_id = 0;
+    bool ok = (roots != NULL && owned != NULL);
+
+    for (size_t i = 0; ok && i < wt.n_touched; i++) {
+        Touched *t = &wt.touched[i];
+        if (i > 0 && compare_touched(t, &wt.touched[i - 1]) == 0) {
+            continue;
+        }
+        char *path = join_path(t->dir, t->name);
+        if (path == NULL) {
+            ok = false;
+            break;
+        }
+        struct stat st;
+        bool exists = (lstat(path, &st) == 0);
+
+        if (t->is_dir) {
+            /* Forget whatever was there and read it again if it exists */
+            ok = purge_tree(songarr, path, delta->purge);
+            if (ok && exists && S_ISDIR(st.st_mode)) {
+                /* Watch before reading so files copied in meanwhile count */
+                add_watch(path);
+                roots[n_roots] = path;
+                owned[n_roots++] = path;
+                continue;
+            }
+        } else {
+            exists = exists && S_ISREG(st.st_mode) &&
+                     filetype_is_audio(AT_FDCWD, path);
+            bool listed = (songarr_find(songarr, t->dir, t->name)
+                           != SONGARR_NONE);
+            if (exists && !listed) {
+                ok = note_file(delta->add, t->dir, t->name, &add_dir, &add_id);
+            } else if (!exists && listed) {
+                ok = note_file(delta->del, t->dir, t->name, &del_dir, &del_id);
+            }
+        }
+        free(path);
+    }
+
+    if (ok && n_roots > 0) {
+        ScanOpts opts = { .n_threads = wt.n_threads };
+        ok = scan_tree(roots, n_roots, &opts, delta->add);
+    }
+    for (size_t i = 0; i < n_roots; i++) {
+        free(owned[i]);
+    }
+    free(roots);
+    free(owned);
+    return ok;
+}
+
+bool watch_apply(SongArr *songarr, size_t *remap)
+{
+    /* remap must hold songarr->size entries, see songarr_apply() */
+    SongArrDelta delta = {
+        .add = songarr_new(),
+        .del = songarr_new(),
+        .purge = songarr_new(),
+    };
+    bool ok = (delta.add != NULL && delta.del != NULL && delta.purge != NULL);
+
+    if (ok) {
+        ok = wt.overflow ? diff_full(songarr, &delta)
+                         : diff_touched(songarr, &delta);
+    }
+    if (ok) {
+        for (size_t i = 0; i < delta.add->n_dirs; i++) {
+            add_watch(songarr_dirpath(delta.add, (uint32_t)i));
+        }
+        ok = songarr_apply(songarr, &delta, remap);
+    }
+    clear_touched();
+    wt.first_ms = 0;
+    SongArr *parts[] = { delta.add, delta.del, delta.purge };
+    for (int i = 0; i < 3; i++) {
+        if (parts[i] != NULL) {
+            songarr_destroy(parts[i]);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,22 @@
+/* File: watch.h
+ * Date: 2026-10-17
+ *
+ * Live library updates via inotify.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "songarr.h"
+
+int watch_init(const char *const *roots, size_t n_roots,
+               const SongArr *songarr, int n_threads);
+void watch_destroy(void);
+void watch_read(void);
+int watch_timeout(void);
+bool watch_apply(SongArr *songarr, size_t *remap);
+
+#endif
+
@@ -0,0 +1,815 @@
+/* File: mockmpv.c
+ * Date: 2026-10-17
+ *
+ * Stand-in for mpv's JSON IPC, for load and latency tests without audio.
+ *
+ * Speaks the part of the protocol reed uses (loadfile replace/append, also
+ * with named arguments and a start= option, playlist-clear, cycle pause,
+ * seek, add volume, observe_property, get_property, quit) and "plays" its
+ * playlist in real time, so autoplay and gapless hand-over behave like the
+ * real thing. A script adds stress on top: property-change floods,
+ * end-file storms, slow or split replies, dropped replies and dropped
+ * connections. Every command received is logged with a timestamp.
+ *
+ *   mockmpv [options] --input-ipc-server=PATH     listen (reed --mpv-connect)
+ *   mockmpv [options] --input-ipc-client=fd://N   already connected
+ *
+ * Other --options are ignored, so it can also be started by reed in place
+ * of mpv (as "mpv", first in PATH). Options:
+ *
+ *   --script=FILE   actions to run once a client is connected (see below)
+ *   --log=FILE      command log (default: stderr)
+ *   --length=SECS   length of every track (default: 180)
+ *   --tick=MS       time-pos update period (default: 50)
+ *
+ * MOCKMPV_SCRIPT, MOCKMPV_LOG, MOCKMPV_LENGTH and MOCKMPV_TICK are read
+ * first, for when the command line is not ours to choose.
+ *
+ * Script lines, one action each ('#' starts a comment):
+ *
+ *   sleep MS        wait before the next action
+ *   wait CMD        wait for a command (e.g. loadfile); logs how long after
+ *                   the last write it arrived (a round trip)
+ *   flood N NAME    N property-change events for NAME, back to back
+ *   eof N           N end-file (eof) events, back to back
+ *   finish          end the current track now, as if it ran out
+ *   delay MS        hold every following reply for MS (0: off)
+ *   split BYTES     write at most BYTES per write(), 1 ms apart (0: off);
+ *                   whatever the socket takes already is sent whole
+ *   drop N          do not reply to the next N commands
+ *   send JSON       send one raw message
+ *   disconnect      close the connection (a server waits for the next)
+ *   quit            exit
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/json.h"
+
+#define IN_MAX 65536
+#define MAX_TOKENS 64
+#define MAX_OBSERVED 32
+#define NAME_MAX_LEN 64
+#define LINE_MAX_LEN 8192
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Buf;
+
+typedef struct {
+    double due;
+    char *line;
+} Delayed;
+
+typedef struct {
+    int64_t id;
+    char name[NAME_MAX_LEN];
+} Observed;
+
+struct Mock {
+    int listen_fd;
+    int fd;
+    FILE *log;
+    double t0;
+    double tick_ms;
+
+    /* Connection */
+    char in[IN_MAX];
+    size_t in_len;
+    Buf out;
+    size_t out_off;
+    size_t split;        /* Bytes per write(), 0 for no limit */
+    double next_write;
+    double last_write;   /* When bytes last went out */
+    double wait_ref;     /* last_write before the commands being handled */
+
+    /* Replies */
+    double reply_delay;
+    Delayed *delayed;
+    size_t n_delayed;
+    size_t delayed_cap;
+    int drop;
+
+    /* Player */
+    char **playlist;
+    size_t n_entries;
+    size_t entries_cap;
+    long pos;            /* Playing entry, -1 when idle */
+    bool paused;
+    double time_pos;
+    double length;
+    double volume;
+    double last_tick;
+    Observed observed[MAX_OBSERVED];
+    int n_observed;
+
+    /* Script */
+    char **script;
+    size_t n_lines;
+    size_t pc;
+    double wake;
+    char waiting[NAME_MAX_LEN];
+    bool quit;
+} mk = {
+    .listen_fd = -1,
+    .fd = -1,
+    .tick_ms = 50,
+    .pos = -1,
+    .length = 180,
+    .volume = 100,
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void log_line(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void log_line(const char *fmt, ...)
+{
+    /* Milliseconds since start, then the entry */
+    fprintf(mk.log, "%.3f ", now_ms() - mk.t0);
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(mk.log, fmt, ap);
+    va_end(ap);
+    fputc('\n', mk.log);
+    fflush(mk.log);
+}
+
+/* Output */
+
+static bool buf_add(Buf *b, const char *s, size_t len)
+{
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len) {
+            cap *= 2;
+        }
+        char *p = realloc(b->buf, cap);
+        if (p == NULL) {
+            return false;
+        }
+        b->buf = p;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, s, len);
+    b->len += len;
+    return true;
+}
+
+static void send_now(const char *line)
+{
+    if (mk.fd == -1) {
+        return;
+    }
+    if (!buf_add(&mk.out, line, strlen(line)) || !buf_add(&mk.out, "\n", 1)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+static void send_fmt(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void send_fmt(const char *fmt, ...)
+{
+    char line[LINE_MAX_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    send_now(line);
+}
+
+static void flush_out(void)
+{
+    /* Writes what the socket takes; in split mode one piece per call */
+    while (mk.fd != -1 && mk.out_off < mk.out.len) {
+        if (mk.split > 0 && now_ms() < mk.next_write) {
+            return;
+        }
+        size_t n = mk.out.len - mk.out_off;
+        if (mk.split > 0 && n > mk.split) {
+            n = mk.split;
+        }
+        ssize_t w = send(mk.fd, mk.out.buf + mk.out_off, n,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                mk.out_off = mk.out.len; /* Gone; read() notices */
+            }
+            return;
+        }
+        mk.out_off += (size_t)w;
+        mk.last_write = now_ms();
+        if (mk.split > 0) {
+            mk.next_write = mk.last_write + 1;
+        }
+    }
+    if (mk.out_off == mk.out.len) {
+        mk.out.len = 0;
+        mk.out_off = 0;
+    }
+}
+
+static void reply(int64_t request_id, const char *error, const char *data)
+{
+    char line[LINE_MAX_LEN];
+    snprintf(line, sizeof(line),
+             "{\"request_id\":%lld,\"error\":\"%s\",\"data\":%s}",
+             (long long)request_id, error, data);
+    if (mk.reply_delay <= 0 && mk.n_delayed == 0) {
+        send_now(line);
+        return;
+    }
+    /* Kept in order, even when the delay shrinks */
+    double due = now_ms() + mk.reply_delay;
+    if (mk.n_delayed > 0 && due < mk.delayed[mk.n_delayed - 1].due) {
+        due = mk.delayed[mk.n_delayed - 1].due;
+    }
+    if (mk.n_delayed == mk.delayed_cap) {
+        size_t cap = mk.delayed_cap ? mk.delayed_cap * 2 : 64;
+        Delayed *d = realloc(mk.delayed, cap * sizeof(Delayed));
+        if (d == NULL) {
+            return;
+        }
+        mk.delayed = d;
+        mk.delayed_cap = cap;
+    }
+    mk.delayed[mk.n_delayed].due = due;
+    mk.delayed[mk.n_delayed].line = strdup(line);
+    mk.n_delayed++;
+}
+
+static void send_due_replies(void)
+{
+    size_t i = 0;
+    double now = now_ms();
+    for (; i < mk.n_delayed && mk.delayed[i].due <= now; i++) {
+        send_now(mk.delayed[i].line);
+        free(mk.delayed[i].line);
+    }
+    memmove(mk.delayed, mk.delayed + i, (mk.n_delayed - i) * sizeof(Delayed));
+    mk.n_delayed -= i;
+}
+
+/* Player */
+
+static void prop_value(const char *name, char *buf, size_t size)
+{
+    bool playing = mk.pos >= 0;
+    if (strcmp(name, "time-pos") == 0 && playing) {
+        snprintf(buf, size, "%.6f", mk.time_pos);
+    } else if (strcmp(name, "duration") == 0 && playing) {
+        snprintf(buf, size, "%.6f", mk.length);
+    } else if (strcmp(name, "volume") == 0) {
+        snprintf(buf, size, "%.6f", mk.volume);
+    } else if (strcmp(name, "pause") == 0) {
+        snprintf(buf, size, "%s", mk.paused ? "true" : "false");
+    } else if (strcmp(name, "idle-active") == 0) {
+        snprintf(buf, size, "%s", playing ? "false" : "true");
+    } else if (strcmp(name, "playlist-pos") == 0) {
+        snprintf(buf, size, "%ld", mk.pos);
+    } else if (strcmp(name, "playlist-count") == 0) {
+        snprintf(buf, size, "%zu", mk.n_entries);
+    } else if (strcmp(name, "path") == 0 && playing) {
+        buf[0] = '"';
+        size_t n = json_escape(mk.playlist[mk.pos], buf + 1, size - 2);
+        if (n > size - 3) {
+            n = size - 3;
+        }
+        buf[n + 1] = '"';
+        buf[n + 2] = '\0';
+    } else {
+        snprintf(buf, size, "null");
+    }
+}
+
+static void prop_changed(const char *name)
+{
+    /* One event per observer of name, like mpv */
+    for (int i = 0; i < mk.n_observed; i++) {
+        if (strcmp(mk.observed[i].name, name) == 0) {
+            char val[LINE_MAX_LEN - 128];
+            prop_value(name, val, sizeof(val));
+            send_fmt("{\"event\":\"property-change\",\"id\":%lld,"
+                     "\"name\":\"%s\",\"data\":%s}",
+                     (long long)mk.observed[i].id, name, val);
+        }
+    }
+}
+
+static void start_entry(long pos)
+{
+    mk.pos = pos;
+    mk.time_pos = 0;
+    mk.last_tick = now_ms();
+    send_fmt("{\"event\":\"start-file\",\"playlist_entry_id\":%ld}", pos + 1);
+    prop_changed("path");
+    prop_changed("playlist-pos");
+    prop_changed("idle-active");
+    prop_changed("duration");
+    send_fmt("{\"event\":\"file-loaded\"}");
+    prop_changed("time-pos");
+}
+
+static void go_idle(void)
+{
+    mk.pos = -1;
+    prop_changed("path");
+    prop_changed("time-pos");
+    prop_changed("duration");
+    prop_changed("playlist-pos");
+    prop_changed("idle-active");
+    send_fmt("{\"event\":\"idle\"}");
+}
+
+static void end_entry(const char *reason)
+{
+    send_fmt("{\"event\":\"end-file\",\"reason\":\"%s\","
+             "\"playlist_entry_id\":%ld}", reason, mk.pos + 1);
+}
+
+static void finish_entry(void)
+{
+    /* Ran out: on to the next entry without a gap, or idle */
+    if (mk.pos < 0) {
+        return;
+    }
+    end_entry("eof");
+    if ((size_t)mk.pos + 1 < mk.n_entries) {
+        start_entry(mk.pos + 1);
+    } else {
+        go_idle();
+    }
+}
+
+static void clear_playlist(size_t keep)
+{
+    /* Drops every entry but playlist[keep] (all when keep is out of range) */
+    size_t n = 0;
+    for (size_t i = 0; i < mk.n_entries; i++) {
+        if (i == keep) {
+            mk.playlist[n++] = mk.playlist[i];
+        } else {
+            free(mk.playlist[i]);
+        }
+    }
+    mk.n_entries = n;
+}
+
+static bool add_entry(const char *path)
+{
+    if (mk.n_entries == mk.entries_cap) {
+        size_t cap = mk.entries_cap ? mk.entries_cap * 2 : 16;
+        char **p = realloc(mk.playlist, cap * sizeof(char *));
+        if (p == NULL) {
+            return false;
+        }
+        mk.playlist = p;
+        mk.entries_cap = cap;
+    }
+    mk.playlist[mk.n_entries] = strdup(path);
+    return mk.playlist[mk.n_entries++] != NULL;
+}
+
+static void tick(void)
+{
+    double now = now_ms();
+    if (mk.pos < 0 || mk.paused) {
+        mk.last_tick = now;
+        return;
+    }
+    if (now - mk.last_tick < mk.tick_ms) {
+        return;
+    }
+    mk.time_pos += (now - mk.last_tick) / 1000.0;
+    mk.last_tick = now;
+    if (mk.time_pos >= mk.length) {
+        finish_entry();
+    } else {
+        prop_changed("time-pos");
+    }
+}
+
+/* Commands */
+
+static void handle_command(const char *js, size_t len)
+{
+    JsonTok toks[MAX_TOKENS];
+    int n = json_parse(js, len, toks, MAX_TOKENS);
+    int c = n > 0 ? json_find(js, toks, n, 0, "command") : -1;
+    if (c == -1 || toks[c].size < 1 ||
+        (toks[c].type != JSON_ARRAY && toks[c].type != JSON_OBJECT)) {
+        log_line("bad %.*s", (int)len, js);
+        return;
+    }
+    int64_t request_id = 0;
+    double num;
+    int r = json_find(js, toks, n, 0, "request_id");
+    if (r != -1 && json_number(js, &toks[r], &num)) {
+        request_id = (int64_t)num;
+    }
+
+    /* Arguments as strings (numbers keep their text) */
+    char args[4][LINE_MAX_LEN / 2];
+    char options[LINE_MAX_LEN / 2] = "";
+    int n_args = 0;
+    if (toks[c].type == JSON_OBJECT) {
+        /* Named arguments: only loadfile is sent this way */
+        static const char *const names[] = { "name", "url", "flags" };
+        for (int k = 0; k < 3; k++) {
+            int a = json_find(js, toks, n, c, names[k]);
+            if (a == -1 ||
+                !json_string(js, &toks[a], args[k], sizeof(args[0]))) {
+                break;
+            }
+            n_args++;
+        }
+        int o = json_find(js, toks, n, c, "options");
+        if (o != -1) {
+            json_string(js, &toks[o], options, sizeof(options));
+        }
+        if (n_args == 0) {
+            log_line("bad %.*s", (int)len, js);
+            return;
+        }
+    }
+    for (int i = c + 1; toks[c].type == JSON_ARRAY && i < n &&
+         n_args < toks[c].size && n_args < 4; i = json_skip(toks, n, i)) {
+        if (!json_string(js, &toks[i], args[n_args], sizeof(args[0]))) {
+            snprintf(args[n_args], sizeof(args[0]), "%.*s",
+                     toks[i].end - toks[i].start, js + toks[i].start);
+        }
+        n_args++;
+    }
+    const char *cmd = args[0];
+
+    if (mk.waiting[0] != '\0' && strcmp(mk.waiting, cmd) == 0) {
+        log_line("waited %s %.3f ms after the last write", cmd,
+                 now_ms() - mk.wait_ref);
+        mk.waiting[0] = '\0';
+    }
+    bool answer = mk.drop == 0;
+    if (mk.drop > 0) {
+        mk.drop--;
+    }
+    const char *error = "success";
+    char data[LINE_MAX_LEN / 2] = "null";
+
+    if (strcmp(cmd, "loadfile") == 0 && n_args >= 2) {
+        bool append = n_args >= 3 && strcmp(args[2], "append") == 0;
+        if (!append) {
+            if (mk.pos >= 0) {
+                end_entry("stop");
+            }
+            clear_playlist(SIZE_MAX);
+        }
+        if (!add_entry(args[1])) {
+            error = "error running command";
+        } else if (!append) {
+            start_entry(0);
+            const char *at = strstr(options, "start=");
+            if (at != NULL) {
+                mk.time_pos = strtod(at + strlen("start="), NULL);
+                prop_changed("time-pos");
+            }
+        }
+    } else if (strcmp(cmd, "playlist-clear") == 0) {
+        clear_playlist(mk.pos >= 0 ? (size_t)mk.pos : SIZE_MAX);
+        if (mk.pos >= 0) {
+            mk.pos = 0;
+            prop_changed("playlist-pos");
+        }
+    } else if (strcmp(cmd, "cycle") == 0 && n_args >= 2 &&
+               strcmp(args[1], "pause") == 0) {
+        mk.paused = !mk.paused;
+        prop_changed("pause");
+    } else if (strcmp(cmd, "seek") == 0 && n_args >= 2 && mk.pos >= 0) {
+        mk.time_pos += strtod(args[1], NULL);
+        if (mk.time_pos < 0) {
+            mk.time_pos = 0;
+        }
+        if (mk.time_pos >= mk.length) {
+            finish_entry();
+        } else {
+            prop_changed("time-pos");
+        }
+    } else if (strcmp(cmd, "add") == 0 && n_args >= 3 &&
+               strcmp(args[1], "volume") == 0) {
+        mk.volume += strtod(args[2], NULL);
+        mk.volume = mk.volume < 0 ? 0 : mk.volume > 130 ? 130 : mk.volume;
+        prop_changed("volume");
+    } else if (strcmp(cmd, "observe_property") == 0 && n_args >= 3) {
+        if (mk.n_observed < MAX_OBSERVED) {
+            Observed *o = &mk.observed[mk.n_observed++];
+            o->id = strtoll(args[1], NULL, 10);
+            snprintf(o->name, sizeof(o->name), "%.*s",
+                     (int)sizeof(o->name) - 1, args[2]);
+        }
+    } else if (strcmp(cmd, "get_property") == 0 && n_args >= 2) {
+        prop_value(args[1], data, sizeof(data));
+        if (strcmp(data, "null") == 0) {
+            error = "property unavailable";
+        }
+    } else if (strcmp(cmd, "quit") == 0) {
+        mk.quit = true;
+    } else {
+        error = "invalid parameter";
+    }
+
+    if (answer) {
+        reply(request_id, error, data);
+    }
+    if (strcmp(cmd, "observe_property") == 0 && n_args >= 3) {
+        prop_changed(args[2]); /* The current value follows the reply */
+    }
+}
+
+static bool read_commands(void)
+{
+    /* Returns false once the client has gone away */
+    ssize_t n = read(mk.fd, mk.in + mk.in_len, sizeof(mk.in) - mk.in_len);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        return false;
+    }
+    if (n < 0) {
+        return true;
+    }
+    mk.in_len += (size_t)n;
+    mk.wait_ref = mk.last_write; /* Replies queued below do not count */
+
+    char *start = mk.in;
+    char *nl;
+    while ((nl = memchr(start, '\n', mk.in + mk.in_len - start)) != NULL) {
+        size_t len = (size_t)(nl - start);
+        log_line("recv %.*s", (int)len, start);
+        handle_command(start, len);
+        start = nl + 1;
+    }
+    mk.in_len -= (size_t)(start - mk.in);
+    memmove(mk.in, start, mk.in_len);
+    if (mk.in_len == sizeof(mk.in)) {
+        mk.in_len = 0; /* One command larger than the buffer: dropped */
+    }
+    return true;
+}
+
+static void close_client(void)
+{
+    if (mk.fd != -1) {
+        log_line("disconnected");
+        close(mk.fd);
+        mk.fd = -1;
+    }
+    mk.in_len = 0;
+    mk.out.len = 0;
+    mk.out_off = 0;
+    mk.n_observed = 0;
+    for (size_t i = 0; i < mk.n_delayed; i++) {
+        free(mk.delayed[i].line);
+    }
+    mk.n_delayed = 0;
+}
+
+/* Script */
+
+static bool load_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open script %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[LINE_MAX_LEN];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *p = line + strspn(line, " \t");
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        char **s = realloc(mk.script, (mk.n_lines + 1) * sizeof(char *));
+        if (s == NULL || (s[mk.n_lines] = strdup(p)) == NULL) {
+            fclose(f);
+            return false;
+        }
+        mk.script = s;
+        mk.n_lines++;
+    }
+    fclose(f);
+    return true;
+}
+
+static void run_script(void)
+{
+    /* Runs actions until one has to wait */
+    while (mk.fd != -1 && mk.pc < mk.n_lines && mk.waiting[0] == '\0' &&
+           now_ms() >= mk.wake) {
+        const char *line = mk.script[mk.pc++];
+        char action[16] = "";
+        char arg[NAME_MAX_LEN] = "";
+        long n = 0;
+        sscanf(line, "%15s", action);
+        const char *rest = line + strlen(action);
+        rest += strspn(rest, " \t");
+        log_line("script %s", line);
+
+        if (strcmp(action, "sleep") == 0) {
+            mk.wake = now_ms() + strtod(rest, NULL);
+        } else if (strcmp(action, "wait") == 0) {
+            snprintf(mk.waiting, sizeof(mk.waiting), "%s", rest);
+        } else if (strcmp(action, "flood") == 0 &&
+                   sscanf(rest, "%ld %63s", &n, arg) == 2) {
+            for (long i = 0; i < n; i++) {
+                prop_changed(arg);
+                if (strcmp(arg, "time-pos") == 0) {
+                    mk.time_pos += 0.001;
+                }
+            }
+        } else if (strcmp(action, "eof") == 0) {
+            n = strtol(rest, NULL, 10);
+            for (long i = 0; i < n; i++) {
+                send_fmt("{\"event\":\"end-file\",\"reason\":\"eof\"}");
+            }
+        } else if (strcmp(action, "finish") == 0) {
+            finish_entry();
+        } else if (strcmp(action, "delay") == 0) {
+            mk.reply_delay = strtod(rest, NULL);
+        } else if (strcmp(action, "split") == 0) {
+            mk.split = 0;
+            flush_out(); /* Only what is sent from now on is split */
+            mk.split = (size_t)strtoul(rest, NULL, 10);
+        } else if (strcmp(action, "drop") == 0) {
+            mk.drop = (int)strtol(rest, NULL, 10);
+        } else if (strcmp(action, "send") == 0) {
+            send_now(rest);
+        } else if (strcmp(action, "disconnect") == 0) {
+            flush_out();
+            close_client();
+        } else if (strcmp(action, "quit") == 0) {
+            mk.quit = true;
+        } else {
+            log_line("unknown action: %s", line);
+        }
+    }
+}
+
+/* Setup */
+
+static bool listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    mk.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mk.listen_fd == -1 ||
+        bind(mk.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(mk.listen_fd, 1) == -1) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static const char *option(const char *arg, const char *name)
+{
+    /* Value of --name=value, or NULL */
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        return arg + len + 1;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    mk.t0 = now_ms();
+    mk.log = stderr;
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *script = getenv("MOCKMPV_SCRIPT");
+    const char *log = getenv("MOCKMPV_LOG");
+    const char *length = getenv("MOCKMPV_LENGTH");
+    const char *tick_ms = getenv("MOCKMPV_TICK");
+    const char *server = NULL;
+    const char *client = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char *v;
+        if ((v = option(argv[i], "--input-ipc-server")) != NULL) {
+            server = v;
+        } else if ((v = option(argv[i], "--input-ipc-client")) != NULL) {
+            client = v;
+        } else if ((v = option(argv[i], "--script")) != NULL) {
+            script = v;
+        } else if ((v = option(argv[i], "--log")) != NULL) {
+            log = v;
+        } else if ((v = option(argv[i], "--length")) != NULL) {
+            length = v;
+        } else if ((v = option(argv[i], "--tick")) != NULL) {
+            tick_ms = v;
+        }
+    }
+    if (length != NULL) {
+        mk.length = strtod(length, NULL);
+    }
+    if (tick_ms != NULL) {
+        mk.tick_ms = strtod(tick_ms, NULL);
+    }
+    if (log != NULL && (mk.log = fopen(log, "a")) == NULL) {
+        fprintf(stderr, "Cannot open log %s: %s\n", log, strerror(errno));
+        return 1;
+    }
+    if (script != NULL && !load_script(script)) {
+        return 1;
+    }
+
+    if (client != NULL && strncmp(client, "fd://", 5) == 0) {
+        mk.fd = (int)strtol(client + 5, NULL, 10);
+        log_line("connected fd %d", mk.fd);
+    } else if (server == NULL || !listen_on(server)) {
+        fprintf(stderr, "Usage: %s [--script=FILE] [--log=FILE] "
+                        "[--length=SECS] [--tick=MS]\n"
+                        "       (--input-ipc-server=PATH | "
+                        "--input-ipc-client=fd://N)\n", argv[0]);
+        return 1;
+    }
+
+    while (!mk.quit) {
+        struct pollfd fds[2] = {
+            { .fd = mk.fd, .events = POLLIN },
+            { .fd = mk.fd == -1 ? mk.listen_fd : -1, .events = POLLIN },
+        };
+        if (mk.fd != -1 && mk.out_off < mk.out.len) {
+            fds[0].events |= POLLOUT;
+        }
+        if (mk.fd == -1 && mk.listen_fd == -1) {
+            break; /* The one client we had is gone */
+        }
+
+        /* Sleep until the next tick, script action or held reply */
+        double now = now_ms();
+        double next = now + 1000;
+        if (mk.pos >= 0 && !mk.paused) {
+            next = mk.last_tick + mk.tick_ms;
+        }
+        if (mk.pc < mk.n_lines && mk.waiting[0] == '\0' && mk.wake < next) {
+            next = mk.wake;
+        }
+        if (mk.n_delayed > 0 && mk.delayed[0].due < next) {
+            next = mk.delayed[0].due;
+        }
+        if (mk.split > 0 && mk.out_off < mk.out.len && mk.next_write < next) {
+            next = mk.next_write;
+        }
+        int timeout = next > now ? (int)(next - now + 0.999) : 0;
+        if (poll(fds, 2, timeout) == -1 && errno != EINTR) {
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            mk.fd = accept4(mk.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (mk.fd != -1) {
+                log_line("connected");
+            }
+        }
+        if (mk.fd != -1 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            !read_commands()) {
+            close_client();
+        }
+        send_due_replies();
+        tick();
+        run_script();
+        flush_out();
+    }
+
+    flush_out();
+    close_client();
+    if (server != NULL) {
+        unlink(server);
+    }
+    return 0;
+}